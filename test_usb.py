@@ -36,6 +36,16 @@ usb_dll.USB_CloseDevice.restype = c_int
 usb_dll.USB_ReadData.argtypes = [c_char_p, POINTER(c_ubyte), c_int]
 usb_dll.USB_ReadData.restype = c_int
 
+usb_dll.USB_StartStream.argtypes = [c_char_p, c_int, c_int]
+usb_dll.USB_StartStream.restype = c_int
+
+usb_dll.USB_StopStream.argtypes = [c_char_p]
+usb_dll.USB_StopStream.restype = c_int
+
+usb_dll.USB_ReadBatch.argtypes = [c_char_p, POINTER(c_ubyte), c_int, c_int,
+                                  POINTER(c_int), POINTER(c_ulonglong), c_int]
+usb_dll.USB_ReadBatch.restype = c_int
+
 # 错误码定义
 USB_SUCCESS = 0
 USB_ERROR_NOT_FOUND = -1
@@ -49,6 +59,7 @@ USB_ERROR_PIPE = -8
 USB_ERROR_INTERRUPTED = -9
 USB_ERROR_NO_MEM = -10
 USB_ERROR_NOT_SUPPORTED = -11
+USB_ERROR_DATA_LOST = -12
 
 def get_error_string(error_code):
     error_dict = {
@@ -63,7 +74,8 @@ def get_error_string(error_code):
         USB_ERROR_PIPE: "管道错误",
         USB_ERROR_INTERRUPTED: "被中断",
         USB_ERROR_NO_MEM: "内存不足",
-        USB_ERROR_NOT_SUPPORTED: "不支持的操作"
+        USB_ERROR_NOT_SUPPORTED: "不支持的操作",
+        USB_ERROR_DATA_LOST: "数据包丢失"
     }
     return error_dict.get(error_code, f"未知错误: {error_code}")
 
@@ -0,0 +1,65 @@
+// 设备表规模：打开 1 到 512 个设备时，句柄查找和序列号查找的耗时应基本不变
+#include "test_common.h"
+
+#define DEVICES 512
+#define LOOKUPS 1000000
+
+static int handles[DEVICES];
+static char serials[DEVICES][16];
+
+static void serial_of(int index, char *serial) {
+    snprintf(serial, 16, "SN%04d", index);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "512");
+    fake_config("FAKE_RATE_HZ", "0");
+
+    static const int steps[] = { 1, 8, 64, 256, 512 };
+    char serial[16];
+    int opened = 0;
+    double handle_ns[5], serial_ns[5];
+
+    printf("%8s %18s %18s\n", "devices", "handle lookup ns", "serial lookup ns");
+    for (int s = 0; s < 5; s++) {
+        for (; opened < steps[s]; opened++) {
+            serial_of(opened, serials[opened]);
+            handles[opened] = USB_OpenDeviceEx(serials[opened]);
+            CHECK(handles[opened] > 0);
+        }
+
+        usb_stream_stats_t stats;
+        volatile int sink = 0;
+        double start = now_ms();
+        for (int k = 0; k < LOOKUPS; k++) sink += USB_GetStreamStatsEx(handles[k % opened], &stats);
+        handle_ns[s] = (now_ms() - start) * 1e6 / LOOKUPS;
+
+        start = now_ms();
+        for (int k = 0; k < LOOKUPS; k++) sink += USB_GetDeviceHandle(serials[k % opened]);
+        serial_ns[s] = (now_ms() - start) * 1e6 / LOOKUPS;
+        (void)sink;
+        printf("%8d %18.1f %18.1f\n", opened, handle_ns[s], serial_ns[s]);
+    }
+
+    // 关闭一半再重新打开，查找结果与打开状态一致
+    for (int i = 0; i < DEVICES; i += 2) CHECK_EQ(USB_CloseDeviceEx(handles[i]), USB_SUCCESS);
+    for (int i = 0; i < DEVICES; i++) {
+        serial_of(i, serial);
+        int handle = USB_GetDeviceHandle(serial);
+        if (i % 2 == 0) CHECK_EQ(handle, USB_ERROR_NOT_FOUND);
+        else CHECK_EQ(handle, handles[i]);
+    }
+    for (int i = 0; i < DEVICES; i += 2) {
+        serial_of(i, serial);
+        CHECK(USB_OpenDeviceEx(serial) > 0);
+    }
+    for (int i = 0; i < DEVICES; i++) {
+        serial_of(i, serial);
+        CHECK(USB_GetDeviceHandle(serial) > 0);
+    }
+    unsigned char buffer[8];
+    CHECK_EQ(USB_ReadDataEx(handles[0], buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+
+    test_unload();
+    return 0;
+}
@@ -0,0 +1,49 @@
+// 打开设备的耗时与打开次数：按缓存位置直接打开目标设备，不逐个打开总线上的所有设备
+#include "test_common.h"
+
+static long long open_one(const char *what, const char *serial, int expect_found) {
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    double start = now_ms();
+    int handle = USB_OpenDeviceEx(serial);
+    double elapsed = now_ms() - start;
+    opens = FAKE_COUNTER("fake_open_calls") - opens;
+    printf("%-28s %8.2f ms %4lld libusb_open calls\n", what, elapsed, opens);
+    if (expect_found) {
+        CHECK(handle > 0);
+        CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    } else {
+        CHECK_EQ(handle, USB_ERROR_NOT_FOUND);
+    }
+    return opens;
+}
+
+int main(void) {
+    // 64 个目标设备和 64 个其他厂商的设备，每次读取序列号 2 ms
+    fake_config("FAKE_NDEV", "64");
+    fake_config("FAKE_OTHER", "64");
+    fake_config("FAKE_RATE_HZ", "0");
+    fake_config("FAKE_STR_LAT_MS", "2");
+
+    // 冷启动时只打开目标 VID/PID 的设备，找到即停止
+    CHECK(open_one("cold open SN0031", "SN0031", 1) <= 32);
+    // 已知位置的设备只打开一次
+    CHECK_EQ(open_one("open SN0031 again", "SN0031", 1), 1);
+
+    device_info_t devices[128];
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    CHECK_EQ(USB_ScanDevice(devices, 128), 64);
+    CHECK(FAKE_COUNTER("fake_open_calls") - opens <= 64);
+
+    CHECK_EQ(open_one("open SN0017 after scan", "SN0017", 1), 1);
+    // 找不到时最多打开每个目标设备一次，不打开其他厂商的设备
+    CHECK(open_one("open missing serial", "SNXXXX", 0) <= 64);
+
+    // 本进程已打开的设备不会被再次打开
+    int held = USB_OpenDeviceEx("SN0003");
+    CHECK(held > 0);
+    CHECK(open_one("open missing, SN0003 held", "SNYYYY", 0) <= 63);
+    CHECK_EQ(USB_CloseDeviceEx(held), USB_SUCCESS);
+
+    test_unload();
+    return 0;
+}
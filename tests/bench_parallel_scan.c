@@ -0,0 +1,35 @@
+// 冷启动扫描的耗时：并行读取各设备的序列号，总耗时远小于逐个读取的耗时之和
+#include "test_common.h"
+
+#define DEVICES 64
+#define STRING_LATENCY_MS 10
+
+int main(void) {
+    fake_config("FAKE_NDEV", "64");
+    fake_config("FAKE_RATE_HZ", "0");
+    fake_config("FAKE_STR_LAT_MS", "10");
+
+    device_info_t devices[DEVICES];
+    double start = now_ms();
+    CHECK_EQ(USB_ScanDevice(devices, DEVICES), DEVICES);
+    double cold_ms = now_ms() - start;
+    for (int i = 0; i < DEVICES; i++) {
+        char expected[16];
+        snprintf(expected, sizeof(expected), "SN%04d", i);
+        CHECK(strcmp(devices[i].serial_number, expected) == 0);
+    }
+
+    start = now_ms();
+    CHECK_EQ(USB_ScanDevice(devices, DEVICES), DEVICES);
+    double warm_ms = now_ms() - start;
+
+    // 逐个读取时每个设备至少要一次序列号读取的延迟
+    double sequential_ms = DEVICES * STRING_LATENCY_MS;
+    printf("cold scan of %d devices: %8.1f ms (sequential >= %.0f ms, %.1fx)\n",
+           DEVICES, cold_ms, sequential_ms, sequential_ms / cold_ms);
+    printf("warm scan:                  %8.3f ms\n", warm_ms);
+    CHECK(cold_ms < sequential_ms / 2);
+
+    test_unload();
+    return 0;
+}
@@ -0,0 +1,62 @@
+// 流式读取吞吐量：每种传输数量、缓冲区大小和读取方式下的 MB/s 与每字节 CPU 时间
+//
+// 模拟设备不限速地发送连续的 32 位序号，读取时检查序号在任意读取边界上都连续，
+// 只有接收队列满而丢弃传输时才允许出现间断。
+#include "test_common.h"
+
+#define RUN_MS 1000
+
+static void run(int handle, const char *name, int transfers, int buffer_size, int chunk, int bytes_mode) {
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_BULK, buffer_size, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, transfers, 0), USB_SUCCESS);
+
+    unsigned char *buffer = malloc(chunk);
+    CHECK(buffer != NULL);
+    unsigned char word[4];
+    int partial = 0, first = 1, gaps = 0;
+    unsigned expected = 0;
+    long long total = 0;
+    double cpu_start = cpu_seconds(), start = now_ms();
+    while (now_ms() - start < RUN_MS) {
+        int n = bytes_mode ? USB_ReadStreamBytesEx(handle, buffer, chunk, 1000)
+                           : USB_ReadStreamEx(handle, buffer, chunk, 1000);
+        CHECK(n > 0);
+        total += n;
+        for (int i = 0; i < n; i++) {
+            word[partial++] = buffer[i];
+            if (partial < 4) continue;
+            partial = 0;
+            unsigned value;
+            memcpy(&value, word, sizeof(value));
+            if (!first && value != expected) gaps++;
+            first = 0;
+            expected = value + 1;
+        }
+    }
+    double elapsed = (now_ms() - start) / 1000, cpu = cpu_seconds() - cpu_start;
+
+    usb_stream_stats_t stats;
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    CHECK(gaps == 0 || stats.overflows > 0);
+    printf("%-12s %2d x %6d, read %7d: %8.1f MB/s %6.2f ns/B cpu, %llu overflows\n",
+           name, transfers, buffer_size, chunk, total / elapsed / 1e6, cpu * 1e9 / total, stats.overflows);
+    free(buffer);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "0");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    run(handle, "packets", 4, 512, 512, 0);
+    run(handle, "packets", 8, 65536, 65536, 0);
+    run(handle, "bytes", 8, 65536, 1 << 20, 1);
+    run(handle, "bytes", 8, 65536, 999, 1);
+    run(handle, "bytes", 16, 262144, 1 << 20, 1);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+
+    test_unload();
+    return 0;
+}
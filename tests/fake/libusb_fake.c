@@ -0,0 +1,922 @@
+// libusb 模拟实现：在没有真实硬件的情况下驱动 usb_api 的测试
+//
+// 以共享库形式构建，由 tests/posix/windows.h 中的 LoadLibrary 通过 FAKE_LIBUSB 环境变量加载。
+// 设备行为由下列环境变量控制，在第一次 libusb_init 时读取：
+//   FAKE_NDEV        目标设备(1733:AABB)数量，默认 2
+//   FAKE_OTHER       额外的非目标设备数量，默认 0
+//   FAKE_RATE_HZ     每个设备输入端点产生数据包的速率，0 表示不主动产生，默认 1000
+//   FAKE_MPS         中断端点最大包长，默认 64
+//   FAKE_ISO_MPS     同步端点最大包长，默认 1024
+//   FAKE_ISO_ERR     非零时每 97 个同步包标记一个错误
+//   FAKE_BULK_EP     为 0 时配置描述符中不包含批量端点，默认 1
+//   FAKE_ECHO        非零时 OUT 端点收到的数据会原样从 IN 端点返回
+//   FAKE_STR_LAT_MS  字符串描述符读取延迟
+//   FAKE_SLOW_DEV    单独设置控制传输延迟的设备序号，延迟为 FAKE_SLOW_MS
+//   FAKE_OUT_LAT_US  OUT 传输完成延迟
+//   FAKE_OUT_GAP_US  同一设备两次 OUT 传输完成之间的最小间隔
+//   FAKE_HOTPLUG     非零时支持热插拔回调
+//   FAKE_DEVMEM      非零时 libusb_dev_mem_alloc 成功
+// 测试通过 GetProcAddress 访问以 fake_ 开头的导出变量和函数来制造故障和读取计数。
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "libusb.h"
+
+#define FAKE_MAX_DEVICES 1024
+#define FAKE_ECHO_SLOTS 64
+#define FAKE_ECHO_SIZE 512
+#define FAKE_HOTPLUG_QUEUE 4096
+
+typedef struct {
+    int index;
+    int connected;
+    int generation;         // 每次重新连接递增，旧句柄随之失效
+    int opened;
+    int claimed;
+    int halted;
+    int inject_errors;      // 接下来这么多个 IN 传输以错误完成
+    int open_error;         // 非零时 libusb_open 返回该错误
+    int alt;
+    uint16_t vid, pid, bcd;
+    uint8_t bus, address, ports[7];
+    int port_count;
+    int speed;
+    int max_packet;
+    int echo;
+    char serial[64];
+
+    long long period_ns;    // 数据包间隔，0 表示不主动产生数据
+    long long next_in_ns;   // 下一个数据包的产生时间
+    unsigned sequence;      // 每个数据包开头写入的递增序号
+    long long device_drops; // 没有等待中的 IN 传输时设备丢弃的数据包
+    long long delivered;
+
+    long long out_busy_until;
+    long long out_transfers, out_bytes;
+
+    unsigned char echo_buffer[FAKE_ECHO_SLOTS][FAKE_ECHO_SIZE];
+    int echo_length[FAKE_ECHO_SLOTS];
+    int echo_head, echo_count;
+} fake_device_t;
+
+struct libusb_device { fake_device_t *device; };
+struct libusb_device_handle {
+    fake_device_t *device;
+    int closed;
+    int generation;
+    struct libusb_device_handle *next_closed;
+};
+struct libusb_context { int unused; };
+
+// 句柄失效：设备已拔出、已重新连接或句柄已关闭
+#define HANDLE_DEAD(h) (!(h)->device->connected || (h)->generation != (h)->device->generation || (h)->closed)
+
+typedef struct fake_transfer {
+    struct fake_transfer *next;
+    int cancelled;
+    int inflight;
+    long long submit_ns;
+    long long out_due;
+    struct libusb_transfer transfer;    // 必须放在最后，后面跟着同步包描述符
+} fake_transfer_t;
+
+#define FAKE_TRANSFER(t) ((fake_transfer_t *)((char *)(t) - offsetof(fake_transfer_t, transfer)))
+
+// 全部状态由 g_lock 保护，g_cond 在有新提交、取消或完成时广播
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static fake_device_t g_devices[FAKE_MAX_DEVICES];
+static struct libusb_device g_device_objects[FAKE_MAX_DEVICES];
+static int g_device_count;
+static struct libusb_device_handle *g_closed_handles;
+static fake_transfer_t *g_pending_head, *g_pending_tail;
+static int g_event_owner;
+static int g_interrupted;
+static long long g_string_latency_ns, g_out_latency_ns, g_out_gap_ns;
+
+static libusb_hotplug_callback_fn g_hotplug_cb;
+static void *g_hotplug_user_data;
+static int g_hotplug_vid, g_hotplug_pid;
+static int g_hotplug_queue[FAKE_HOTPLUG_QUEUE][2];
+static int g_hotplug_count;
+
+// 测试读取的计数
+long long fake_open_calls;
+long long fake_string_reads;
+long long fake_control_reads;
+long long fake_submits;
+long long fake_list_calls;
+long long fake_alt_sets;
+long long fake_closed_use;          // 在已关闭句柄上提交的传输数，应始终为 0
+long long fake_devmem_live;
+long long fake_devmem_allocs;
+
+static long long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec t = { ns / 1000000000LL, ns % 1000000000LL };
+    nanosleep(&t, NULL);
+}
+
+// 在 g_cond 上等待到单调时钟的 until_ns
+static void wait_until(long long until_ns) {
+    long long rel = until_ns - now_ns();
+    if (rel < 0) rel = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += rel % 1000000000LL;
+    ts.tv_sec += rel / 1000000000LL + ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&g_cond, &g_lock, &ts);
+}
+
+static void setup(void) {
+    static int done;
+    if (done) return;
+    done = 1;
+
+    int targets = env_int("FAKE_NDEV", 2);
+    int total = targets + env_int("FAKE_OTHER", 0);
+    if (total > FAKE_MAX_DEVICES) total = FAKE_MAX_DEVICES;
+    int rate = env_int("FAKE_RATE_HZ", 1000);
+    g_string_latency_ns = env_int("FAKE_STR_LAT_MS", 0) * 1000000LL;
+    g_out_latency_ns = env_int("FAKE_OUT_LAT_US", 0) * 1000LL;
+    g_out_gap_ns = env_int("FAKE_OUT_GAP_US", 0) * 1000LL;
+
+    for (int i = 0; i < total; i++) {
+        fake_device_t *d = &g_devices[i];
+        d->index = i;
+        d->connected = 1;
+        d->vid = i < targets ? 0x1733 : 0x046d;
+        d->pid = i < targets ? 0xAABB : 0xC52B;
+        d->bcd = 0x0100;
+        d->bus = 1 + i / 100;
+        d->address = 1 + i % 100;
+        d->port_count = 2;
+        d->ports[0] = 1 + (i / 10) % 10;
+        d->ports[1] = 1 + i % 10;
+        d->speed = LIBUSB_SPEED_FULL;
+        d->max_packet = env_int("FAKE_MPS", 64);
+        d->echo = env_int("FAKE_ECHO", 0);
+        snprintf(d->serial, sizeof(d->serial), "SN%04d", i);
+        d->period_ns = rate > 0 ? 1000000000LL / rate : 0;
+        d->next_in_ns = now_ns();
+        g_device_objects[i].device = d;
+    }
+    g_device_count = total;
+}
+
+// ---------------------------------------------------------------------------
+// 测试控制接口
+
+// 拔出(connected=0)或重新插入设备；重新插入时分配新的地址并使旧句柄失效
+void fake_set_connected(int index, int connected) {
+    pthread_mutex_lock(&g_lock);
+    fake_device_t *d = &g_devices[index];
+    d->connected = connected;
+    if (connected) {
+        d->generation++;
+        d->alt = 0;
+        d->halted = 0;
+        d->next_in_ns = now_ns();
+        d->address = 1 + (d->address + 37) % 127;
+    }
+    if (g_hotplug_cb && g_hotplug_count < FAKE_HOTPLUG_QUEUE) {
+        g_hotplug_queue[g_hotplug_count][0] = index;
+        g_hotplug_queue[g_hotplug_count][1] = connected;
+        g_hotplug_count++;
+    }
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void fake_inject_errors(int index, int count) {
+    pthread_mutex_lock(&g_lock);
+    g_devices[index].inject_errors = count;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void fake_set_halt(int index, int halted) {
+    pthread_mutex_lock(&g_lock);
+    g_devices[index].halted = halted;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// 改变设备产生数据包的速率，0 表示中断和同步端点不再产生数据
+void fake_set_rate(int index, int hz) {
+    pthread_mutex_lock(&g_lock);
+    fake_device_t *d = &g_devices[index];
+    d->period_ns = hz > 0 ? 1000000000LL / hz : 0;
+    d->next_in_ns = now_ns();
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+// 模拟设备被其他进程占用等打开失败的情况，error 为 0 时恢复
+void fake_set_open_error(int index, int error) {
+    pthread_mutex_lock(&g_lock);
+    g_devices[index].open_error = error;
+    pthread_mutex_unlock(&g_lock);
+}
+
+long long fake_device_drops(int index) { return g_devices[index].device_drops; }
+long long fake_delivered(int index) { return g_devices[index].delivered; }
+long long fake_out_transfers(int index) { return g_devices[index].out_transfers; }
+long long fake_out_bytes(int index) { return g_devices[index].out_bytes; }
+
+// ---------------------------------------------------------------------------
+// 上下文与设备枚举
+
+int libusb_init(libusb_context **ctx) {
+    static struct libusb_context context;
+    setup();
+    if (ctx) *ctx = &context;
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_exit(libusb_context *ctx) {
+    (void)ctx;
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list) {
+    (void)ctx;
+    pthread_mutex_lock(&g_lock);
+    fake_list_calls++;
+    libusb_device **result = calloc(g_device_count + 1, sizeof(*result));
+    int count = 0;
+    for (int i = 0; i < g_device_count; i++) {
+        if (g_devices[i].connected) result[count++] = &g_device_objects[i];
+    }
+    pthread_mutex_unlock(&g_lock);
+    *list = result;
+    return count;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices) {
+    (void)unref_devices;
+    free(list);
+}
+
+libusb_device *libusb_ref_device(libusb_device *dev) { return dev; }
+void libusb_unref_device(libusb_device *dev) { (void)dev; }
+uint8_t libusb_get_bus_number(libusb_device *dev) { return dev->device->bus; }
+uint8_t libusb_get_device_address(libusb_device *dev) { return dev->device->address; }
+int libusb_get_device_speed(libusb_device *dev) { return dev->device->speed; }
+
+uint8_t libusb_get_port_number(libusb_device *dev) {
+    return dev->device->ports[dev->device->port_count - 1];
+}
+
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *ports, int length) {
+    if (length < dev->device->port_count) return LIBUSB_ERROR_OVERFLOW;
+    memcpy(ports, dev->device->ports, dev->device->port_count);
+    return dev->device->port_count;
+}
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc) {
+    memset(desc, 0, sizeof(*desc));
+    desc->bLength = LIBUSB_DT_DEVICE_SIZE;
+    desc->bDescriptorType = LIBUSB_DT_DEVICE;
+    desc->bcdUSB = 0x0200;
+    desc->bMaxPacketSize0 = 64;
+    desc->idVendor = dev->device->vid;
+    desc->idProduct = dev->device->pid;
+    desc->bcdDevice = dev->device->bcd;
+    desc->iSerialNumber = 3;
+    desc->bNumConfigurations = 1;
+    return LIBUSB_SUCCESS;
+}
+
+static void fake_endpoint(struct libusb_endpoint_descriptor *ep, uint8_t address, uint8_t type, uint16_t max_packet) {
+    ep->bLength = LIBUSB_DT_ENDPOINT_SIZE;
+    ep->bDescriptorType = LIBUSB_DT_ENDPOINT;
+    ep->bEndpointAddress = address;
+    ep->bmAttributes = type;
+    ep->wMaxPacketSize = max_packet;
+    ep->bInterval = type == LIBUSB_TRANSFER_TYPE_BULK ? 0 : 1;
+}
+
+// 配置描述符：接口0 备用设置0 = 中断 IN 0x81 / OUT 0x01 (FAKE_MPS)
+// 以及批量 IN 0x82 / OUT 0x02 (512)；备用设置1 = 同步 IN 0x83 (FAKE_ISO_MPS)
+int libusb_get_config_descriptor(libusb_device *dev, uint8_t index, struct libusb_config_descriptor **config) {
+    if (index != 0) return LIBUSB_ERROR_NOT_FOUND;
+
+    struct libusb_config_descriptor *c = calloc(1, sizeof(*c));
+    struct libusb_interface *itf = calloc(1, sizeof(*itf));
+    struct libusb_interface_descriptor *alt = calloc(2, sizeof(*alt));
+    struct libusb_endpoint_descriptor *ep = calloc(5, sizeof(*ep));
+    uint16_t mps = (uint16_t)dev->device->max_packet;
+
+    fake_endpoint(&ep[0], 0x81, LIBUSB_TRANSFER_TYPE_INTERRUPT, mps);
+    fake_endpoint(&ep[1], 0x01, LIBUSB_TRANSFER_TYPE_INTERRUPT, mps);
+    fake_endpoint(&ep[2], 0x82, LIBUSB_TRANSFER_TYPE_BULK, 512);
+    fake_endpoint(&ep[3], 0x02, LIBUSB_TRANSFER_TYPE_BULK, 512);
+    fake_endpoint(&ep[4], 0x83, LIBUSB_TRANSFER_TYPE_ISOCHRONOUS, (uint16_t)env_int("FAKE_ISO_MPS", 1024));
+
+    alt[0].bLength = LIBUSB_DT_INTERFACE_SIZE;
+    alt[0].bDescriptorType = LIBUSB_DT_INTERFACE;
+    alt[0].bAlternateSetting = 0;
+    alt[0].bNumEndpoints = env_int("FAKE_BULK_EP", 1) ? 4 : 2;
+    alt[0].bInterfaceClass = LIBUSB_CLASS_VENDOR_SPEC;
+    alt[0].endpoint = ep;
+    alt[1].bLength = LIBUSB_DT_INTERFACE_SIZE;
+    alt[1].bDescriptorType = LIBUSB_DT_INTERFACE;
+    alt[1].bAlternateSetting = 1;
+    alt[1].bNumEndpoints = 1;
+    alt[1].bInterfaceClass = LIBUSB_CLASS_VENDOR_SPEC;
+    alt[1].endpoint = ep + 4;
+    itf->altsetting = alt;
+    itf->num_altsetting = 2;
+
+    c->bLength = LIBUSB_DT_CONFIG_SIZE;
+    c->bDescriptorType = LIBUSB_DT_CONFIG;
+    c->wTotalLength = LIBUSB_DT_CONFIG_SIZE + 2 * LIBUSB_DT_INTERFACE_SIZE + 5 * LIBUSB_DT_ENDPOINT_SIZE;
+    c->bNumInterfaces = 1;
+    c->bConfigurationValue = 1;
+    c->bmAttributes = 0x80;
+    c->MaxPower = 50;
+    c->interface = itf;
+    *config = c;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config) {
+    return libusb_get_config_descriptor(dev, 0, config);
+}
+
+void libusb_free_config_descriptor(struct libusb_config_descriptor *config) {
+    if (!config) return;
+    free((void *)config->interface->altsetting[0].endpoint);
+    free((void *)config->interface->altsetting);
+    free((void *)config->interface);
+    free(config);
+}
+
+// ---------------------------------------------------------------------------
+// 设备句柄
+
+int libusb_open(libusb_device *dev, libusb_device_handle **handle) {
+    __atomic_add_fetch(&fake_open_calls, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&g_lock);
+    fake_device_t *d = dev->device;
+    int error = !d->connected ? LIBUSB_ERROR_NO_DEVICE : d->open_error;
+    if (error) {
+        pthread_mutex_unlock(&g_lock);
+        return error;
+    }
+    struct libusb_device_handle *h = calloc(1, sizeof(*h));
+    h->device = d;
+    h->generation = d->generation;
+    d->opened++;
+    pthread_mutex_unlock(&g_lock);
+    *handle = h;
+    return LIBUSB_SUCCESS;
+}
+
+// 句柄不释放而是留在已关闭列表中，这样在已关闭句柄上提交传输能被检测到
+void libusb_close(libusb_device_handle *handle) {
+    pthread_mutex_lock(&g_lock);
+    handle->device->opened--;
+    handle->closed = 1;
+    handle->next_closed = g_closed_handles;
+    g_closed_handles = handle;
+    pthread_mutex_unlock(&g_lock);
+}
+
+libusb_device *libusb_get_device(libusb_device_handle *handle) {
+    return &g_device_objects[handle->device->index];
+}
+
+int libusb_claim_interface(libusb_device_handle *handle, int interface_number) {
+    (void)interface_number;
+    if (HANDLE_DEAD(handle)) return LIBUSB_ERROR_NO_DEVICE;
+    handle->device->claimed = 1;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_release_interface(libusb_device_handle *handle, int interface_number) {
+    (void)interface_number;
+    handle->device->claimed = 0;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_set_interface_alt_setting(libusb_device_handle *handle, int interface_number, int alternate_setting) {
+    if (interface_number != 0 || alternate_setting < 0 || alternate_setting > 1) return LIBUSB_ERROR_NOT_FOUND;
+    if (HANDLE_DEAD(handle)) return LIBUSB_ERROR_NO_DEVICE;
+    handle->device->alt = alternate_setting;
+    fake_alt_sets++;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_clear_halt(libusb_device_handle *handle, unsigned char endpoint) {
+    (void)endpoint;
+    if (HANDLE_DEAD(handle)) return LIBUSB_ERROR_NO_DEVICE;
+    handle->device->halted = 0;
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *handle, uint8_t index, unsigned char *data, int length) {
+    __atomic_add_fetch(&fake_string_reads, 1, __ATOMIC_SEQ_CST);
+    if (g_string_latency_ns) sleep_ns(g_string_latency_ns);
+    if (!handle->device->connected) return LIBUSB_ERROR_NO_DEVICE;
+    if (index != 3) return LIBUSB_ERROR_INVALID_PARAM;
+    snprintf((char *)data, length, "%s", handle->device->serial);
+    return (int)strlen((char *)data);
+}
+
+// 只支持 GET_DESCRIPTOR 读取语言表(0x0300)和序列号字符串(0x0303)
+int libusb_control_transfer(libusb_device_handle *handle, uint8_t request_type, uint8_t request, uint16_t value,
+                            uint16_t index, unsigned char *data, uint16_t length, unsigned int timeout) {
+    (void)index;
+    __atomic_add_fetch(&fake_control_reads, 1, __ATOMIC_SEQ_CST);
+
+    long long latency = g_string_latency_ns;
+    if (handle->device->index == env_int("FAKE_SLOW_DEV", -1)) latency = env_int("FAKE_SLOW_MS", 0) * 1000000LL;
+    int timed_out = timeout && latency > (long long)timeout * 1000000LL;
+    if (latency) sleep_ns(timed_out ? (long long)timeout * 1000000LL : latency);
+    if (timed_out) return LIBUSB_ERROR_TIMEOUT;
+    if (!handle->device->connected) return LIBUSB_ERROR_NO_DEVICE;
+    if (request_type != LIBUSB_ENDPOINT_IN || request != LIBUSB_REQUEST_GET_DESCRIPTOR) return LIBUSB_ERROR_PIPE;
+
+    unsigned char buffer[256];
+    int n;
+    if (value == 0x0300) {
+        buffer[0] = 4;
+        buffer[1] = LIBUSB_DT_STRING;
+        buffer[2] = 0x09;
+        buffer[3] = 0x04;
+        n = 4;
+    } else if (value == 0x0303) {
+        int len = (int)strlen(handle->device->serial);
+        n = 2 + 2 * len;
+        buffer[0] = (unsigned char)n;
+        buffer[1] = LIBUSB_DT_STRING;
+        for (int i = 0; i < len; i++) {
+            buffer[2 + 2 * i] = (unsigned char)handle->device->serial[i];
+            buffer[3 + 2 * i] = 0;
+        }
+    } else {
+        return LIBUSB_ERROR_PIPE;
+    }
+    if (n > length) n = length;
+    memcpy(data, buffer, n);
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// 热插拔
+
+int libusb_has_capability(uint32_t capability) {
+    return capability == LIBUSB_CAP_HAS_HOTPLUG ? env_int("FAKE_HOTPLUG", 0) : 1;
+}
+
+int libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id,
+                                     int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data,
+                                     libusb_hotplug_callback_handle *callback_handle) {
+    (void)ctx; (void)events; (void)flags; (void)dev_class;
+    if (!env_int("FAKE_HOTPLUG", 0)) return LIBUSB_ERROR_NOT_SUPPORTED;
+    pthread_mutex_lock(&g_lock);
+    g_hotplug_vid = vendor_id;
+    g_hotplug_pid = product_id;
+    g_hotplug_user_data = user_data;
+    g_hotplug_cb = cb_fn;
+    pthread_mutex_unlock(&g_lock);
+    if (callback_handle) *callback_handle = 1;
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle) {
+    (void)ctx; (void)callback_handle;
+    pthread_mutex_lock(&g_lock);
+    g_hotplug_cb = NULL;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// 在事件处理中分发排队的热插拔事件，进入和返回时持有 g_lock
+static void deliver_hotplug(void) {
+    while (g_hotplug_count && g_hotplug_cb) {
+        int index = g_hotplug_queue[0][0];
+        int connected = g_hotplug_queue[0][1];
+        g_hotplug_count--;
+        memmove(g_hotplug_queue, g_hotplug_queue + 1, g_hotplug_count * sizeof(g_hotplug_queue[0]));
+
+        fake_device_t *d = &g_devices[index];
+        if (g_hotplug_vid != LIBUSB_HOTPLUG_MATCH_ANY && d->vid != g_hotplug_vid) continue;
+        if (g_hotplug_pid != LIBUSB_HOTPLUG_MATCH_ANY && d->pid != g_hotplug_pid) continue;
+
+        libusb_hotplug_callback_fn cb = g_hotplug_cb;
+        void *user_data = g_hotplug_user_data;
+        pthread_mutex_unlock(&g_lock);
+        cb(NULL, &g_device_objects[index],
+           connected ? LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED : LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, user_data);
+        pthread_mutex_lock(&g_lock);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 异步传输
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets) {
+    fake_transfer_t *x = calloc(1, sizeof(fake_transfer_t) + iso_packets * sizeof(struct libusb_iso_packet_descriptor));
+    return x ? &x->transfer : NULL;
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer) {
+    if (!transfer) return;
+    fake_transfer_t *x = FAKE_TRANSFER(transfer);
+    if (x->inflight) {
+        fprintf(stderr, "FAKE: free of in-flight transfer\n");
+        abort();
+    }
+    free(x);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer) {
+    fake_transfer_t *x = FAKE_TRANSFER(transfer);
+    pthread_mutex_lock(&g_lock);
+    if (x->inflight) {
+        pthread_mutex_unlock(&g_lock);
+        return LIBUSB_ERROR_BUSY;
+    }
+    if (transfer->dev_handle->closed) {
+        fake_closed_use++;
+        fprintf(stderr, "FAKE: submit on closed handle\n");
+    }
+    if (HANDLE_DEAD(transfer->dev_handle)) {
+        pthread_mutex_unlock(&g_lock);
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS && transfer->dev_handle->device->alt != 1) {
+        pthread_mutex_unlock(&g_lock);
+        return LIBUSB_ERROR_IO;
+    }
+    x->inflight = 1;
+    x->cancelled = 0;
+    x->out_due = 0;
+    x->submit_ns = now_ns();
+    x->next = NULL;
+    if (g_pending_tail) g_pending_tail->next = x;
+    else g_pending_head = x;
+    g_pending_tail = x;
+    fake_submits++;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer) {
+    fake_transfer_t *x = FAKE_TRANSFER(transfer);
+    pthread_mutex_lock(&g_lock);
+    int result = LIBUSB_ERROR_NOT_FOUND;
+    if (x->inflight) {
+        x->cancelled = 1;
+        result = LIBUSB_SUCCESS;
+    }
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    return result;
+}
+
+void libusb_interrupt_event_handler(libusb_context *ctx) {
+    (void)ctx;
+    pthread_mutex_lock(&g_lock);
+    g_interrupted = 1;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static int is_in(const fake_transfer_t *x) {
+    return (x->transfer.endpoint & LIBUSB_ENDPOINT_IN) != 0;
+}
+
+// 该设备在 x 之前是否还有等待中的中断 IN 传输；数据包按提交顺序交付
+static int has_earlier_in(const fake_transfer_t *x, const fake_device_t *d) {
+    for (const fake_transfer_t *y = g_pending_head; y != x; y = y->next) {
+        if (y->transfer.dev_handle->device == d && is_in(y) && !y->cancelled) return 1;
+    }
+    return 0;
+}
+
+// 没有等待中的 IN 传输时设备产生的数据包被丢弃，模拟主机来不及接收
+static void count_device_drops(long long now) {
+    for (int i = 0; i < g_device_count; i++) {
+        fake_device_t *d = &g_devices[i];
+        if (!d->period_ns || !d->connected) continue;
+        int waiting = 0;
+        for (fake_transfer_t *x = g_pending_head; x; x = x->next) {
+            if (x->transfer.dev_handle->device == d && is_in(x) &&
+                x->transfer.type != LIBUSB_TRANSFER_TYPE_BULK && !x->cancelled) {
+                waiting = 1;
+                break;
+            }
+        }
+        if (waiting) continue;
+        while (d->next_in_ns <= now) {
+            d->device_drops++;
+            d->sequence++;
+            d->next_in_ns += d->period_ns;
+        }
+    }
+}
+
+// OUT 传输：返回 1 表示已完成，0 表示仍在等待 *next_due
+static int complete_out(fake_transfer_t *x, fake_device_t *d, long long now, long long *next_due) {
+    struct libusb_transfer *t = &x->transfer;
+    if (g_out_latency_ns || g_out_gap_ns) {
+        if (!x->out_due) {
+            long long ready = x->submit_ns + g_out_latency_ns;
+            long long slot = d->out_busy_until + g_out_gap_ns;
+            x->out_due = ready > slot ? ready : slot;
+            d->out_busy_until = x->out_due;
+        }
+        if (now < x->out_due) {
+            if (x->out_due < *next_due) *next_due = x->out_due;
+            return 0;
+        }
+    }
+    t->status = LIBUSB_TRANSFER_COMPLETED;
+    t->actual_length = t->length;
+    d->out_transfers++;
+    d->out_bytes += t->length;
+    if (d->echo && d->echo_count < FAKE_ECHO_SLOTS) {
+        int slot = (d->echo_head + d->echo_count) % FAKE_ECHO_SLOTS;
+        int n = t->length < FAKE_ECHO_SIZE ? t->length : FAKE_ECHO_SIZE;
+        memcpy(d->echo_buffer[slot], t->buffer, n);
+        d->echo_length[slot] = n;
+        d->echo_count++;
+    }
+    return 1;
+}
+
+// IN 传输：返回 1 表示已完成，0 表示仍在等待 *next_due
+static int complete_in(fake_transfer_t *x, fake_device_t *d, long long now, long long *next_due) {
+    struct libusb_transfer *t = &x->transfer;
+
+    if (d->echo) {
+        if (!d->echo_count) return 0;
+        int n = d->echo_length[d->echo_head];
+        if (n > t->length) n = t->length;
+        memcpy(t->buffer, d->echo_buffer[d->echo_head], n);
+        d->echo_head = (d->echo_head + 1) % FAKE_ECHO_SLOTS;
+        d->echo_count--;
+        t->actual_length = n;
+        t->status = LIBUSB_TRANSFER_COMPLETED;
+        return 1;
+    }
+
+    // 批量端点总是立即填满，每 4 字节一个递增序号
+    if (t->type == LIBUSB_TRANSFER_TYPE_BULK) {
+        for (int k = 0; k + 4 <= t->length; k += 4) {
+            memcpy(t->buffer + k, &d->sequence, 4);
+            d->sequence++;
+        }
+        t->actual_length = t->length;
+        t->status = LIBUSB_TRANSFER_COMPLETED;
+        return 1;
+    }
+
+    if (!d->period_ns) return 0;
+    if (d->next_in_ns > now) {
+        if (d->next_in_ns < *next_due) *next_due = d->next_in_ns;
+        return 0;
+    }
+
+    if (t->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+        int inject = getenv("FAKE_ISO_ERR") != NULL;
+        for (int k = 0; k < t->num_iso_packets; k++) {
+            struct libusb_iso_packet_descriptor *p = &t->iso_packet_desc[k];
+            unsigned n = p->length < 4 ? p->length : 4;
+            memcpy(t->buffer + k * p->length, &d->sequence, n);
+            p->actual_length = n;
+            p->status = inject && d->sequence % 97 == 0 ? LIBUSB_TRANSFER_ERROR : LIBUSB_TRANSFER_COMPLETED;
+            d->sequence++;
+            d->delivered++;
+        }
+        d->next_in_ns += d->period_ns * t->num_iso_packets;
+        t->actual_length = 0;
+        t->status = LIBUSB_TRANSFER_COMPLETED;
+        return 1;
+    }
+
+    // 中断端点：设备的第一个等待中的 IN 传输得到这个数据包
+    if (has_earlier_in(x, d)) return 0;
+    int n = t->length < d->max_packet ? t->length : d->max_packet;
+    memset(t->buffer, 0, n);
+    memcpy(t->buffer, &d->sequence, n < 4 ? n : 4);
+    d->sequence++;
+    d->delivered++;
+    d->next_in_ns += d->period_ns;
+    t->actual_length = n;
+    t->status = LIBUSB_TRANSFER_COMPLETED;
+    return 1;
+}
+
+// 持有 g_lock 调用：把现在可以完成的传输移到 *done，返回最早的下一个到期时间
+static long long process_pending(fake_transfer_t **done, long long now) {
+    long long next_due = now + 1000000000LL;
+    fake_transfer_t **link = &g_pending_head, *prev = NULL, *done_tail = NULL;
+
+    count_device_drops(now);
+
+    while (*link) {
+        fake_transfer_t *x = *link;
+        struct libusb_transfer *t = &x->transfer;
+        fake_device_t *d = t->dev_handle->device;
+        int complete = 1;
+
+        t->actual_length = 0;
+        if (x->cancelled) {
+            t->status = LIBUSB_TRANSFER_CANCELLED;
+        } else if (HANDLE_DEAD(t->dev_handle)) {
+            t->status = LIBUSB_TRANSFER_NO_DEVICE;
+        } else if (d->halted) {
+            t->status = LIBUSB_TRANSFER_STALL;
+        } else if (d->inject_errors > 0 && is_in(x)) {
+            d->inject_errors--;
+            t->status = LIBUSB_TRANSFER_ERROR;
+        } else {
+            complete = is_in(x) ? complete_in(x, d, now, &next_due) : complete_out(x, d, now, &next_due);
+        }
+
+        if (!complete && t->timeout) {
+            long long due = x->submit_ns + (long long)t->timeout * 1000000LL;
+            if (now >= due) {
+                t->status = LIBUSB_TRANSFER_TIMED_OUT;
+                t->actual_length = 0;
+                complete = 1;
+            } else if (due < next_due) {
+                next_due = due;
+            }
+        }
+
+        if (complete) {
+            *link = x->next;
+            if (g_pending_tail == x) g_pending_tail = prev;
+            x->next = NULL;
+            x->inflight = 0;
+            if (done_tail) done_tail->next = x;
+            else *done = x;
+            done_tail = x;
+        } else {
+            prev = x;
+            link = &x->next;
+        }
+    }
+    return next_due;
+}
+
+// 同一时间只有一个线程处理事件，其他线程等待完成广播后返回，与 libusb 的事件锁语义一致
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed) {
+    (void)ctx;
+    long long deadline = now_ns() + (tv ? tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL : 60000000000LL);
+
+    pthread_mutex_lock(&g_lock);
+    if (g_event_owner) {
+        if (!(completed && *completed)) {
+            long long until = now_ns() + 2000000LL;
+            wait_until(until < deadline ? until : deadline);
+        }
+        pthread_mutex_unlock(&g_lock);
+        return LIBUSB_SUCCESS;
+    }
+
+    g_event_owner = 1;
+    for (;;) {
+        if (completed && *completed) break;
+        if (g_hotplug_count) {
+            deliver_hotplug();
+            if (completed) continue;
+            break;
+        }
+
+        long long now = now_ns();
+        fake_transfer_t *done = NULL;
+        long long due = process_pending(&done, now);
+        if (done) {
+            pthread_mutex_unlock(&g_lock);
+            while (done) {
+                fake_transfer_t *next = done->next;
+                done->transfer.callback(&done->transfer);
+                done = next;
+            }
+            pthread_mutex_lock(&g_lock);
+            pthread_cond_broadcast(&g_cond);
+            break;
+        }
+        if (g_interrupted) {
+            g_interrupted = 0;
+            break;
+        }
+        if (now >= deadline) break;
+        wait_until(due < deadline ? due : deadline);
+    }
+    g_event_owner = 0;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv) {
+    return libusb_handle_events_timeout_completed(ctx, tv, NULL);
+}
+
+// ---------------------------------------------------------------------------
+// 同步传输：与 libusb 一样基于异步传输和事件处理实现
+
+static void LIBUSB_CALL sync_transfer_cb(struct libusb_transfer *transfer) {
+    pthread_mutex_lock(&g_lock);
+    *(int *)transfer->user_data = 1;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static int sync_transfer(libusb_device_handle *handle, unsigned char endpoint, unsigned char type,
+                         unsigned char *data, int length, int *transferred, unsigned int timeout) {
+    struct libusb_transfer *t = libusb_alloc_transfer(0);
+    int completed = 0;
+    t->dev_handle = handle;
+    t->endpoint = endpoint;
+    t->type = type;
+    t->timeout = timeout;
+    t->buffer = data;
+    t->length = length;
+    t->callback = sync_transfer_cb;
+    t->user_data = &completed;
+
+    int result = libusb_submit_transfer(t);
+    if (result != LIBUSB_SUCCESS) {
+        libusb_free_transfer(t);
+        return result;
+    }
+    for (;;) {
+        pthread_mutex_lock(&g_lock);
+        int done = completed;
+        pthread_mutex_unlock(&g_lock);
+        if (done) break;
+        struct timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout_completed(NULL, &tv, &completed);
+    }
+
+    if (transferred) *transferred = t->actual_length;
+    int status = t->status;
+    libusb_free_transfer(t);
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED: return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+        default:                        return LIBUSB_ERROR_IO;
+    }
+}
+
+int libusb_interrupt_transfer(libusb_device_handle *handle, unsigned char endpoint, unsigned char *data,
+                              int length, int *transferred, unsigned int timeout) {
+    return sync_transfer(handle, endpoint, LIBUSB_TRANSFER_TYPE_INTERRUPT, data, length, transferred, timeout);
+}
+
+int libusb_bulk_transfer(libusb_device_handle *handle, unsigned char endpoint, unsigned char *data,
+                         int length, int *transferred, unsigned int timeout) {
+    return sync_transfer(handle, endpoint, LIBUSB_TRANSFER_TYPE_BULK, data, length, transferred, timeout);
+}
+
+const char *libusb_error_name(int error_code) {
+    (void)error_code;
+    return "LIBUSB_ERROR";
+}
+
+// ---------------------------------------------------------------------------
+// 设备内存：FAKE_DEVMEM 非零时可用，否则与不支持的后端一样返回 NULL
+
+unsigned char *libusb_dev_mem_alloc(libusb_device_handle *handle, size_t length) {
+    (void)handle;
+    if (!env_int("FAKE_DEVMEM", 0)) return NULL;
+    void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    __atomic_add_fetch(&fake_devmem_live, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&fake_devmem_allocs, 1, __ATOMIC_SEQ_CST);
+    return p;
+}
+
+int libusb_dev_mem_free(libusb_device_handle *handle, unsigned char *buffer, size_t length) {
+    (void)handle;
+    munmap(buffer, length);
+    __atomic_sub_fetch(&fake_devmem_live, 1, __ATOMIC_SEQ_CST);
+    return LIBUSB_SUCCESS;
+}
@@ -0,0 +1,388 @@
+// 测试用的最小 Win32 兼容层：让 usb_api.c 在 Linux 上基于 pthread 编译运行
+//
+// 只实现 usb_api.c 和测试用到的接口，语义以满足测试为准：
+//   - LoadLibrary 忽略参数，加载 FAKE_LIBUSB 指向的模拟 libusb(默认 ./libusb-1.0.dll)
+//   - 事件和线程句柄是同一种可等待对象，线程结束时置位；线程对象在句柄关闭且线程结束后释放
+//   - 新线程开始和结束时都要经过 shim_loader_lock，测试调用 DllMain 时持有它，与 Windows 加载器锁一致
+//   - CRITICAL_SECTION 是递归互斥量，SRWLOCK 是读写锁
+//   - 文件映射只支持磁盘缓存需要的 OPEN_ALWAYS + 整个文件映射
+#ifndef USB_TEST_WINDOWS_H
+#define USB_TEST_WINDOWS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define WINAPI
+#define CALLBACK
+#define __stdcall
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned long DWORD;
+typedef long LONG;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef int64_t LONG64;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef void *HMODULE;
+typedef void *HINSTANCE;
+typedef const char *LPCSTR;
+typedef char *LPSTR;
+typedef union {
+    struct { DWORD LowPart; LONG HighPart; };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+#define TRUE 1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFFu
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFFu
+#define MAX_PATH 260
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define DLL_PROCESS_DETACH 0
+#define DLL_PROCESS_ATTACH 1
+#define DLL_THREAD_ATTACH 2
+#define DLL_THREAD_DETACH 3
+
+// 动态库
+
+static inline HMODULE LoadLibraryA(const char *name) {
+    const char *path = getenv("FAKE_LIBUSB");
+    (void)name;
+    // 卸载后模拟库仍留在内存中，LeakSanitizer 才能在退出时看到它保存的已关闭句柄
+    return dlopen(path ? path : "./libusb-1.0.dll", RTLD_NOW | RTLD_NODELETE);
+}
+#define LoadLibrary LoadLibraryA
+
+static inline void *GetProcAddress(HMODULE module, const char *name) { return dlsym(module, name); }
+static inline BOOL FreeLibrary(HMODULE module) { dlclose(module); return TRUE; }
+static inline BOOL DisableThreadLibraryCalls(HMODULE module) { (void)module; return TRUE; }
+
+// 原子操作
+
+static inline LONG InterlockedIncrement(volatile LONG *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedDecrement(volatile LONG *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchange(volatile LONG *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchangeAdd(volatile LONG *p, LONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedCompareExchange(volatile LONG *p, LONG exchange, LONG comparand) {
+    __atomic_compare_exchange_n(p, &comparand, exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+static inline LONG64 InterlockedIncrement64(volatile LONG64 *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG64 InterlockedExchangeAdd64(volatile LONG64 *p, LONG64 v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline void *InterlockedExchangePointer(void *volatile *p, void *v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline void *InterlockedCompareExchangePointer(void *volatile *p, void *exchange, void *comparand) {
+    __atomic_compare_exchange_n(p, &comparand, exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+#define MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#if defined(__x86_64__) || defined(__i386__)
+#define YieldProcessor() __builtin_ia32_pause()
+#else
+#define YieldProcessor() __asm__ __volatile__("" ::: "memory")
+#endif
+
+// 锁与条件变量
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+static inline void InitializeCriticalSection(CRITICAL_SECTION *cs) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+static inline void EnterCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_lock(cs); }
+static inline void LeaveCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_unlock(cs); }
+static inline void DeleteCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_destroy(cs); }
+
+typedef pthread_rwlock_t SRWLOCK;
+#define SRWLOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+static inline void InitializeSRWLock(SRWLOCK *lock) { pthread_rwlock_init(lock, NULL); }
+static inline void AcquireSRWLockShared(SRWLOCK *lock) { pthread_rwlock_rdlock(lock); }
+static inline void ReleaseSRWLockShared(SRWLOCK *lock) { pthread_rwlock_unlock(lock); }
+static inline void AcquireSRWLockExclusive(SRWLOCK *lock) { pthread_rwlock_wrlock(lock); }
+static inline void ReleaseSRWLockExclusive(SRWLOCK *lock) { pthread_rwlock_unlock(lock); }
+static inline BOOL TryAcquireSRWLockExclusive(SRWLOCK *lock) { return pthread_rwlock_trywrlock(lock) == 0; }
+
+typedef pthread_cond_t CONDITION_VARIABLE;
+#define CONDITION_VARIABLE_INIT PTHREAD_COND_INITIALIZER
+static inline void InitializeConditionVariable(CONDITION_VARIABLE *cv) { pthread_cond_init(cv, NULL); }
+static inline void WakeConditionVariable(CONDITION_VARIABLE *cv) { pthread_cond_signal(cv); }
+static inline void WakeAllConditionVariable(CONDITION_VARIABLE *cv) { pthread_cond_broadcast(cv); }
+
+// 把相对毫秒数换算成 pthread 需要的绝对时间
+static inline struct timespec shim_deadline(DWORD ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static inline BOOL SleepConditionVariableCS(CONDITION_VARIABLE *cv, CRITICAL_SECTION *cs, DWORD ms) {
+    if (ms == INFINITE) return pthread_cond_wait(cv, cs) == 0;
+    struct timespec ts = shim_deadline(ms);
+    return pthread_cond_timedwait(cv, cs, &ts) == 0;
+}
+
+// 时间
+
+static inline ULONGLONG GetTickCount64(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (ULONGLONG)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+static inline DWORD GetTickCount(void) { return (DWORD)GetTickCount64(); }
+static inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency) {
+    frequency->QuadPart = 1000000000LL;
+    return TRUE;
+}
+static inline BOOL QueryPerformanceCounter(LARGE_INTEGER *counter) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    counter->QuadPart = (LONGLONG)t.tv_sec * 1000000000LL + t.tv_nsec;
+    return TRUE;
+}
+static inline void Sleep(DWORD ms) {
+    struct timespec t = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&t, NULL);
+}
+static inline BOOL SwitchToThread(void) { sched_yield(); return TRUE; }
+
+// 事件与线程
+
+// 所有内核对象共用的头部，CloseHandle 据此释放
+#define SHIM_WAITABLE 1
+#define SHIM_FILE 2
+#define SHIM_MAPPING 3
+
+typedef struct {
+    int kind;
+    int refs;                   // 线程对象由句柄和线程本身各持有一个引用
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int signaled;
+    int manual_reset;
+    DWORD (*start)(LPVOID);
+    LPVOID arg;
+} shim_object_t;
+
+static inline void shim_object_unref(shim_object_t *o) {
+    if (__atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    pthread_mutex_destroy(&o->lock);
+    pthread_cond_destroy(&o->cond);
+    free(o);
+}
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+static inline shim_object_t *shim_object_new(int manual_reset, int signaled) {
+    shim_object_t *o = calloc(1, sizeof(*o));
+    o->kind = SHIM_WAITABLE;
+    o->refs = 1;
+    pthread_mutex_init(&o->lock, NULL);
+    pthread_cond_init(&o->cond, NULL);
+    o->manual_reset = manual_reset;
+    o->signaled = signaled;
+    return o;
+}
+
+static inline BOOL SetEvent(HANDLE handle) {
+    shim_object_t *o = handle;
+    pthread_mutex_lock(&o->lock);
+    o->signaled = 1;
+    pthread_cond_broadcast(&o->cond);
+    pthread_mutex_unlock(&o->lock);
+    return TRUE;
+}
+
+static inline BOOL ResetEvent(HANDLE handle) {
+    shim_object_t *o = handle;
+    pthread_mutex_lock(&o->lock);
+    o->signaled = 0;
+    pthread_mutex_unlock(&o->lock);
+    return TRUE;
+}
+
+static inline HANDLE CreateEventA(void *attributes, BOOL manual_reset, BOOL initial_state, const char *name) {
+    (void)attributes; (void)name;
+    return shim_object_new(manual_reset, initial_state);
+}
+#define CreateEvent CreateEventA
+
+// 模拟加载器锁：Windows 上线程启动和退出时要为其他 DLL 调用 DllMain，必须获取加载器锁
+// 弱符号使测试程序和 usb_api 共用同一个锁
+__attribute__((weak)) pthread_mutex_t shim_loader_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void shim_pass_loader_lock(void) {
+    pthread_mutex_lock(&shim_loader_lock);
+    pthread_mutex_unlock(&shim_loader_lock);
+}
+
+static void *shim_thread_main(void *arg) {
+    shim_object_t *o = arg;
+    shim_pass_loader_lock();
+    o->start(o->arg);
+    shim_pass_loader_lock();
+    SetEvent(o);
+    shim_object_unref(o);
+    return NULL;
+}
+
+static inline HANDLE CreateThread(void *attributes, size_t stack_size, LPTHREAD_START_ROUTINE start,
+                                  LPVOID arg, DWORD flags, DWORD *thread_id) {
+    (void)attributes; (void)stack_size; (void)flags; (void)thread_id;
+    shim_object_t *o = shim_object_new(1, 0);
+    o->start = start;
+    o->arg = arg;
+    o->refs = 2;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, shim_thread_main, o) != 0) {
+        free(o);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return o;
+}
+
+static inline DWORD WaitForSingleObject(HANDLE handle, DWORD ms) {
+    shim_object_t *o = handle;
+    struct timespec ts = shim_deadline(ms == INFINITE ? 0 : ms);
+    int error = 0;
+    pthread_mutex_lock(&o->lock);
+    while (!o->signaled && error == 0) {
+        error = ms == INFINITE ? pthread_cond_wait(&o->cond, &o->lock)
+                               : pthread_cond_timedwait(&o->cond, &o->lock, &ts);
+    }
+    DWORD result = o->signaled ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+    if (o->signaled && !o->manual_reset) o->signaled = 0;
+    pthread_mutex_unlock(&o->lock);
+    return result;
+}
+
+static inline DWORD GetCurrentThreadId(void) { return (DWORD)(uintptr_t)pthread_self(); }
+
+// 内存
+
+static inline void *_aligned_malloc(size_t size, size_t alignment) {
+    void *p = NULL;
+    return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+static inline void _aligned_free(void *p) { free(p); }
+
+// 环境变量与文件
+
+static inline DWORD GetEnvironmentVariableA(const char *name, char *buffer, DWORD size) {
+    const char *value = getenv(name);
+    if (!value) return 0;
+    size_t length = strlen(value);
+    if (length + 1 > size) return (DWORD)(length + 1);
+    memcpy(buffer, value, length + 1);
+    return (DWORD)length;
+}
+
+static inline DWORD GetTempPathA(DWORD size, char *buffer) {
+    const char *dir = getenv("TMPDIR");
+    char path[MAX_PATH];
+    int length = snprintf(path, sizeof(path), "%s/", dir && dir[0] ? dir : "/tmp");
+    if ((DWORD)length + 1 > size) return (DWORD)(length + 1);
+    memcpy(buffer, path, length + 1);
+    return (DWORD)length;
+}
+
+static inline BOOL CreateDirectoryA(const char *path, void *attributes) {
+    (void)attributes;
+    return mkdir(path, 0755) == 0;
+}
+
+#define GENERIC_READ 0x80000000u
+#define GENERIC_WRITE 0x40000000u
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define OPEN_ALWAYS 4
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READWRITE 4
+#define FILE_MAP_ALL_ACCESS 0xF001F
+
+typedef struct {
+    int kind;
+    int fd;
+    size_t size;
+} shim_file_t;
+
+static inline HANDLE CreateFileA(const char *path, DWORD access, DWORD share, void *attributes,
+                                 DWORD disposition, DWORD flags, HANDLE template_file) {
+    (void)access; (void)share; (void)attributes; (void)disposition; (void)flags; (void)template_file;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return INVALID_HANDLE_VALUE;
+    shim_file_t *f = calloc(1, sizeof(*f));
+    f->kind = SHIM_FILE;
+    f->fd = fd;
+    return f;
+}
+
+static inline HANDLE CreateFileMappingA(HANDLE file, void *attributes, DWORD protect,
+                                        DWORD size_high, DWORD size_low, const char *name) {
+    (void)attributes; (void)protect; (void)size_high; (void)name;
+    int fd = ((shim_file_t *)file)->fd;
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+    if (st.st_size < (off_t)size_low && ftruncate(fd, size_low) != 0) return NULL;
+    shim_file_t *m = calloc(1, sizeof(*m));
+    m->kind = SHIM_MAPPING;
+    m->fd = dup(fd);
+    m->size = size_low;
+    return m;
+}
+
+static inline void *MapViewOfFile(HANDLE mapping, DWORD access, DWORD offset_high, DWORD offset_low, size_t size) {
+    (void)access; (void)offset_high; (void)offset_low;
+    shim_file_t *m = mapping;
+    void *p = mmap(NULL, size ? size : m->size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// 视图大小没有记录，不真正解除映射，进程退出时由系统回收
+static inline BOOL UnmapViewOfFile(const void *view) { (void)view; return TRUE; }
+static inline BOOL FlushViewOfFile(const void *view, size_t size) { (void)view; (void)size; return TRUE; }
+
+static inline BOOL CloseHandle(HANDLE handle) {
+    int kind = *(int *)handle;
+    if (kind == SHIM_WAITABLE) {
+        shim_object_unref(handle);
+    } else {
+        close(((shim_file_t *)handle)->fd);
+        free(handle);
+    }
+    return TRUE;
+}
+
+#endif // USB_TEST_WINDOWS_H
@@ -0,0 +1,37 @@
+// 基本接口：扫描、按序列号打开、同步读取和关闭
+#include "test_common.h"
+
+int main(void) {
+    fake_config("FAKE_NDEV", "3");
+    fake_config("FAKE_OTHER", "2");
+
+    // 只列出目标设备，序列号来自字符串描述符
+    device_info_t devices[16];
+    CHECK_EQ(USB_ScanDevice(devices, 16), 3);
+    for (int i = 0; i < 3; i++) {
+        char serial[16];
+        snprintf(serial, sizeof(serial), "SN%04d", i);
+        CHECK(strcmp(devices[i].serial_number, serial) == 0);
+        CHECK_EQ(devices[i].vid, 0x1733);
+        CHECK_EQ(devices[i].pid, 0xAABB);
+    }
+
+    CHECK_EQ(USB_OpenDevice("SN0002"), USB_SUCCESS);
+    CHECK_EQ(USB_OpenDevice("SN9999"), USB_ERROR_NOT_FOUND);
+
+    // 设备每个数据包开头是递增序号
+    unsigned char buffer[64];
+    unsigned first, second;
+    CHECK_EQ(USB_ReadData("SN0002", buffer, sizeof(buffer)), 64);
+    memcpy(&first, buffer, sizeof(first));
+    CHECK_EQ(USB_ReadData("SN0002", buffer, sizeof(buffer)), 64);
+    memcpy(&second, buffer, sizeof(second));
+    CHECK(second > first);
+
+    CHECK_EQ(USB_CloseDevice("SN0002"), USB_SUCCESS);
+    CHECK_EQ(USB_ReadData("SN0002", buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+
+    test_unload();
+    printf("basic: scan, open, read and close\n");
+    return 0;
+}
@@ -0,0 +1,55 @@
+// 批量读取：一次调用取出队列中所有已到达的数据包，序号连续，时间戳单调
+#include "test_common.h"
+
+#define SLOT 64
+#define MAX_PACKETS 512
+
+int main(void) {
+    fake_config("FAKE_NDEV", "2");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    CHECK_EQ(USB_OpenDevice("SN0001"), USB_SUCCESS);
+    CHECK_EQ(USB_StartStream("SN0001", 16, 4096), USB_SUCCESS);
+
+    static unsigned char buffer[SLOT * MAX_PACKETS];
+    int lengths[MAX_PACKETS];
+    unsigned long long timestamps[MAX_PACKETS];
+    unsigned long long last_timestamp = 0;
+    unsigned last = 0;
+    int received = 0, calls = 0, gaps = 0, most = 0;
+
+    double start = now_ms();
+    while (now_ms() - start < 1000) {
+        int n = USB_ReadBatch("SN0001", buffer, SLOT, MAX_PACKETS, lengths, timestamps, 100);
+        CHECK(n > 0);
+        for (int i = 0; i < n; i++) {
+            CHECK_EQ(lengths[i], SLOT);
+            CHECK(timestamps[i] >= last_timestamp);
+            last_timestamp = timestamps[i];
+            unsigned sequence;
+            memcpy(&sequence, buffer + i * SLOT, sizeof(sequence));
+            if (received && sequence != last + 1) gaps++;
+            last = sequence;
+            received++;
+        }
+        if (n > most) most = n;
+        calls++;
+        Sleep(5);
+    }
+    CHECK_EQ(gaps, 0);
+    CHECK(received >= 900);
+    // 每次调用间隔约 5 ms，一次应取出多个数据包
+    CHECK(most > 1);
+    CHECK(calls < received);
+
+    unsigned char small[8];
+    CHECK_EQ(USB_ReadBatch("SN0001", small, sizeof(small), 1, lengths, NULL, 100), USB_ERROR_OVERFLOW);
+    CHECK_EQ(USB_ReadBatch("SN0001", buffer, SLOT, 0, lengths, NULL, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ReadBatch("SN0001", buffer, SLOT, 1, NULL, NULL, 0), USB_ERROR_INVALID);
+
+    CHECK_EQ(USB_StopStream("SN0001"), USB_SUCCESS);
+    CHECK_EQ(USB_CloseDevice("SN0001"), USB_SUCCESS);
+    test_unload();
+    printf("batch: %d packets in %d calls\n", received, calls);
+    return 0;
+}
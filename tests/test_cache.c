@@ -0,0 +1,78 @@
+// 设备缓存：打不开的设备以空序列号列出，重复扫描不再打开它，有设备插拔后重试一次
+#include "test_common.h"
+
+#define DEVICES 8
+#define BUSY 2
+
+static int arrivals, departures;
+static char last_arrived[64];
+
+static void on_change(const device_info_t *device, int arrived, void *user_data) {
+    (void)user_data;
+    if (arrived) {
+        arrivals++;
+        snprintf(last_arrived, sizeof(last_arrived), "%s", device->serial_number);
+    } else {
+        departures++;
+    }
+}
+
+// 扫描并返回打开设备的次数，同时检查被占用设备的序列号
+static long long scan(const char *busy_serial) {
+    device_info_t devices[DEVICES];
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    CHECK_EQ(USB_ScanDevice(devices, DEVICES), DEVICES);
+    int found = 0;
+    for (int i = 0; i < DEVICES; i++) {
+        if (strcmp(devices[i].serial_number, busy_serial) == 0) found++;
+    }
+    CHECK_EQ(found, 1);
+    return FAKE_COUNTER("fake_open_calls") - opens;
+}
+
+// 重新插入一个设备后扫描，返回期间打开设备的次数(包括事件线程定期刷新时的打开)
+static long long replug_and_scan(int index, const char *busy_serial) {
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    fake_set_connected(index, 0);
+    fake_set_connected(index, 1);
+    scan(busy_serial);
+    return FAKE_COUNTER("fake_open_calls") - opens;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "8");
+    fake_config("FAKE_HOTPLUG", "0");
+
+    // 被其他进程占用的设备仍然列出，只是序列号为空
+    fake_set_open_error(BUSY, -3);
+    CHECK_EQ(scan(""), DEVICES);
+
+    // 不支持热插拔时每次扫描都重新枚举，但拓扑不变就不再打开它
+    for (int i = 0; i < 3; i++) CHECK_EQ(scan(""), 0);
+
+    // 其他设备重新插入后重试一次：打开新插入的设备和被占用的设备
+    CHECK_EQ(USB_RegisterChangeCallback(on_change, NULL), USB_SUCCESS);
+    CHECK_EQ(replug_and_scan(5, ""), 2);
+    CHECK_EQ(scan(""), 0);
+    CHECK_EQ(arrivals, 1);
+    CHECK_EQ(departures, 1);
+
+    // 占用解除后，下一次插拔时读到序列号：空序列号的记录离开，带序列号的记录到达
+    fake_set_open_error(BUSY, 0);
+    CHECK_EQ(scan(""), 0);
+    CHECK_EQ(replug_and_scan(6, "SN0002"), 2);
+    CHECK_EQ(scan("SN0002"), 0);
+    CHECK_EQ(arrivals, 3);
+    CHECK_EQ(departures, 3);
+    CHECK(strcmp(last_arrived, "SN0002") == 0 || strcmp(last_arrived, "SN0006") == 0);
+
+    // 读到序列号后可以按序列号打开
+    int handle = USB_OpenDeviceEx("SN0002");
+    CHECK(handle > 0);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+
+    CHECK_EQ(USB_RegisterChangeCallback(NULL, NULL), USB_SUCCESS);
+    test_unload();
+    printf("cache: unopenable device listed once, retried after each replug\n");
+    return 0;
+}
@@ -0,0 +1,102 @@
+// 命令通道：按标签匹配响应；与其他线程的异步写入并发时，每个命令仍单独占用一个 OUT 传输
+//
+// 模拟设备把每个 OUT 传输原样作为一个 IN 数据包返回。填充数据的标签位置为 0xFFFF，
+// 不匹配任何命令；命令若与填充数据合并到同一个传输，其响应就无法匹配而超时。
+#include "test_common.h"
+
+#define COMMAND_THREADS 4
+#define COMMANDS 300
+#define FILL_THREADS 2
+
+static int g_handle;
+static volatile int g_filling = 1;
+static volatile long g_callbacks, g_bad_callbacks;
+
+static DWORD WINAPI fill_thread(LPVOID param) {
+    (void)param;
+    unsigned char fill[8];
+    memset(fill, 0xFF, sizeof(fill));
+    while (g_filling) CHECK_EQ(USB_WriteAsyncEx(g_handle, fill, 5), 5);
+    return 0;
+}
+
+static DWORD WINAPI command_thread(LPVOID param) {
+    intptr_t id = (intptr_t)param;
+    unsigned char command[16] = {0}, response[64];
+    for (int i = 0; i < COMMANDS; i++) {
+        command[2] = (unsigned char)id;
+        command[3] = (unsigned char)i;
+        CHECK_EQ(USB_SendCommandEx(g_handle, command, sizeof(command), response, sizeof(response), 2000), 16);
+        CHECK_EQ(response[2], (unsigned char)id);
+        CHECK_EQ(response[3], (unsigned char)i);
+    }
+    return 0;
+}
+
+static void on_response(int tag, int result, const unsigned char *response, void *user_data) {
+    intptr_t id = (intptr_t)user_data;
+    if (result != 16 || response[0] != (tag & 0xFF) || response[2] != (unsigned char)id) {
+        __atomic_add_fetch(&g_bad_callbacks, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&g_callbacks, 1, __ATOMIC_SEQ_CST);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "0");
+    fake_config("FAKE_ECHO", "1");
+    fake_config("FAKE_OUT_LAT_US", "200");
+
+    int handle = g_handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    unsigned char command[128] = {0}, response[128];
+    CHECK_EQ(USB_SendCommandEx(handle, command, 16, response, sizeof(response), 100), USB_ERROR_INVALID);
+    CHECK_EQ(USB_StartCommandChannelEx(handle, 0, 3), USB_ERROR_INVALID);
+    CHECK_EQ(USB_StartCommandChannelEx(handle, 0, 2), USB_SUCCESS);
+    CHECK_EQ(USB_StartCommandChannelEx(handle, 0, 2), USB_ERROR_BUSY);
+
+    // 超过一个 OUT 传输(中断端点最大包长 64)的命令会被拆分，直接拒绝
+    CHECK_EQ(USB_SendCommandEx(handle, command, 65, response, sizeof(response), 100), USB_ERROR_INVALID);
+    CHECK_EQ(USB_SendCommandAsyncEx(handle, command, 65, on_response, NULL), USB_ERROR_INVALID);
+    CHECK_EQ(USB_SendCommandEx(handle, command, 64, response, sizeof(response), 1000), 64);
+
+    // 超时为 0 时命令照常发送但不等待响应
+    CHECK_EQ(USB_SendCommandEx(handle, command, 16, response, sizeof(response), 0), USB_ERROR_TIMEOUT);
+
+    // 同步命令与其他线程的小块异步写入并发
+    HANDLE fillers[FILL_THREADS], senders[COMMAND_THREADS];
+    for (int i = 0; i < FILL_THREADS; i++) fillers[i] = CreateThread(NULL, 0, fill_thread, NULL, 0, NULL);
+    for (intptr_t i = 0; i < COMMAND_THREADS; i++) senders[i] = CreateThread(NULL, 0, command_thread, (LPVOID)i, 0, NULL);
+    for (int i = 0; i < COMMAND_THREADS; i++) {
+        WaitForSingleObject(senders[i], INFINITE);
+        CloseHandle(senders[i]);
+    }
+    g_filling = 0;
+    for (int i = 0; i < FILL_THREADS; i++) {
+        WaitForSingleObject(fillers[i], INFINITE);
+        CloseHandle(fillers[i]);
+    }
+    CHECK_EQ(USB_FlushWriteEx(handle, 2000), USB_SUCCESS);
+
+    // 异步命令的回调恰好调用一次
+    long sent = 0;
+    for (intptr_t i = 0; i < 500; i++) {
+        command[2] = (unsigned char)i;
+        int tag;
+        while ((tag = USB_SendCommandAsyncEx(handle, command, 16, on_response, (void *)i)) == USB_ERROR_BUSY) Sleep(0);
+        CHECK(tag >= 0);
+        sent++;
+    }
+    double deadline = now_ms() + 5000;
+    while (g_callbacks < sent && now_ms() < deadline) Sleep(1);
+    CHECK_EQ(g_callbacks, sent);
+    CHECK_EQ(g_bad_callbacks, 0);
+
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    CHECK_EQ(USB_SendCommandEx(handle, command, 16, response, sizeof(response), 100), USB_ERROR_INVALID);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+
+    test_unload();
+    printf("command: %d commands interleaved with async writes\n", COMMAND_THREADS * COMMANDS);
+    return 0;
+}
@@ -0,0 +1,98 @@
+// 测试公共部分：断言、计时和模拟 libusb 的控制接口
+//
+// 每个测试是一个独立的可执行文件，由 build_tests.sh 构建运行。测试在第一次调用 USB_* 之前
+// 用 fake_config 设置模拟设备，结束时调用 test_unload 模拟 DLL 卸载，返回 0 表示通过。
+#ifndef USB_TEST_COMMON_H
+#define USB_TEST_COMMON_H
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "usb_api.h"
+
+BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved);
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+    long long actual_ = (long long)(actual), expected_ = (long long)(expected); \
+    if (actual_ != expected_) { \
+        fprintf(stderr, "%s:%d: %s == %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, expected_); \
+        exit(1); \
+    } \
+} while (0)
+
+// 设置模拟设备的环境变量，必须在第一次调用 USB_* 之前完成
+static inline void fake_config(const char *name, const char *value) {
+    setenv(name, value, 1);
+}
+
+// 取模拟 libusb 导出的控制函数或计数变量，与 usb_api 加载的是同一个库实例
+static inline void *fake_symbol(const char *name) {
+    static HMODULE module;
+    if (!module) module = LoadLibraryA("libusb-1.0.dll");
+    void *symbol = module ? GetProcAddress(module, name) : NULL;
+    if (!symbol) {
+        fprintf(stderr, "fake libusb symbol %s not found\n", name);
+        exit(1);
+    }
+    return symbol;
+}
+
+#define FAKE_COUNTER(name) (*(volatile long long *)fake_symbol(name))
+
+static inline void fake_set_connected(int index, int connected) {
+    ((void (*)(int, int))fake_symbol("fake_set_connected"))(index, connected);
+}
+
+static inline void fake_set_open_error(int index, int error) {
+    ((void (*)(int, int))fake_symbol("fake_set_open_error"))(index, error);
+}
+
+static inline void fake_inject_errors(int index, int count) {
+    ((void (*)(int, int))fake_symbol("fake_inject_errors"))(index, count);
+}
+
+static inline void fake_set_halt(int index, int halted) {
+    ((void (*)(int, int))fake_symbol("fake_set_halt"))(index, halted);
+}
+
+static inline void fake_set_rate(int index, int hz) {
+    ((void (*)(int, int))fake_symbol("fake_set_rate"))(index, hz);
+}
+
+static inline long long fake_device_counter(const char *name, int index) {
+    return ((long long (*)(int))fake_symbol(name))(index);
+}
+
+// 单调时钟，毫秒
+static inline double now_ms(void) {
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return counter.QuadPart * 1000.0 / frequency.QuadPart;
+}
+
+// 进程消耗的 CPU 时间，秒
+static inline double cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// 模拟 FreeLibrary 卸载 DLL，与 Windows 一样在加载器锁内调用 DllMain
+static inline void test_unload(void) {
+    pthread_mutex_lock(&shim_loader_lock);
+    DllMain(NULL, DLL_PROCESS_DETACH, NULL);
+    pthread_mutex_unlock(&shim_loader_lock);
+}
+
+#endif // USB_TEST_COMMON_H
@@ -0,0 +1,65 @@
+// 端点发现与配置：默认端点、批量端点、参数检查，流式读取运行时不能更改配置
+#include "test_common.h"
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+
+    // 接口0两个备用设置中的全部端点
+    usb_endpoint_info_t endpoints[USB_MAX_ENDPOINTS];
+    CHECK_EQ(USB_GetEndpointsEx(handle, endpoints, USB_MAX_ENDPOINTS), 5);
+    CHECK_EQ(endpoints[0].address, 0x81);
+    CHECK_EQ(endpoints[0].transfer_type, USB_TRANSFER_INTERRUPT);
+    CHECK_EQ(endpoints[0].max_packet_size, 64);
+    CHECK_EQ(endpoints[2].address, 0x82);
+    CHECK_EQ(endpoints[2].transfer_type, USB_TRANSFER_BULK);
+    CHECK_EQ(endpoints[2].max_packet_size, 512);
+    CHECK_EQ(endpoints[4].address, 0x83);
+    CHECK_EQ(endpoints[4].transfer_type, USB_TRANSFER_ISOCHRONOUS);
+    CHECK_EQ(endpoints[4].alt_setting, 1);
+    CHECK_EQ(USB_GetEndpointsEx(handle, endpoints, 2), 2);
+
+    // 默认从中断端点读取一个最大包长
+    unsigned char buffer[4096];
+    CHECK_EQ(USB_ReadDataEx(handle, buffer, sizeof(buffer)), 64);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, 0, 0, 0), USB_SUCCESS);
+    CHECK(USB_ReadDataEx(handle, buffer, sizeof(buffer)) > 0);
+
+    // 无效的端点、类型和缓冲区大小
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x02, 0, 0, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x85, 0, 0, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_INTERRUPT, 0, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, 0, (1 << 20) + 1, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, 0, 1000, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, 0, 0, -1), USB_ERROR_INVALID);
+
+    // 流式读取运行时不能更改
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_BULK, 4096, 200), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 256), USB_SUCCESS);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 0), USB_ERROR_BUSY);
+    CHECK(USB_ReadStreamEx(handle, buffer, sizeof(buffer), 1000) > 0);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 切换到等时端点时自动选择备用设置1，恢复默认时切回设置0
+    long long alt_sets = FAKE_COUNTER("fake_alt_sets");
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x83, 0, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_ReadDataEx(handle, buffer, sizeof(buffer)), USB_ERROR_NOT_SUPPORTED);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 0), USB_SUCCESS);
+    CHECK_EQ(FAKE_COUNTER("fake_alt_sets"), alt_sets + 2);
+    CHECK_EQ(USB_ReadDataEx(handle, buffer, sizeof(buffer)), 64);
+
+    // 按序列号调用的版本
+    CHECK_EQ(USB_GetEndpoints("SN0000", endpoints, 2), 2);
+    CHECK_EQ(USB_ConfigureDevice("SN0000", 0x81, 0, 0, 0), USB_SUCCESS);
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 0), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_GetEndpointsEx(handle, endpoints, 2), USB_ERROR_NOT_FOUND);
+
+    test_unload();
+    printf("configure: endpoints discovered and switched\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+// 设备内存：可用时流传输缓冲区位于设备内存，数据正确，关闭设备时全部归还；可用环境变量禁用
+#include "test_common.h"
+
+static unsigned char buffer[1 << 20];
+
+// 读取一段批量流，检查序号连续(没有溢出时)
+static void read_bulk(int handle) {
+    unsigned expected = 0;
+    int first = 1, gaps = 0;
+    for (int i = 0; i < 200; i++) {
+        int n = USB_ReadStreamBytesEx(handle, buffer, sizeof(buffer) & ~3u, 1000);
+        CHECK(n > 0 && n % 4 == 0);
+        for (int k = 0; k < n; k += 4) {
+            unsigned value;
+            memcpy(&value, buffer + k, sizeof(value));
+            if (!first && value != expected) gaps++;
+            first = 0;
+            expected = value + 1;
+        }
+    }
+    usb_stream_stats_t stats;
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK(gaps == 0 || stats.overflows > 0);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "0");
+    fake_config("FAKE_DEVMEM", "1");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_BULK, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+    usb_pool_stats_t stats;
+    CHECK_EQ(USB_GetPoolStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK_EQ(stats.stream_buffer_mode, USB_BUFFER_DEVICE_MEMORY);
+    CHECK(stats.device_memory_bytes > 0 && stats.device_memory_bytes <= stats.reserved_bytes);
+    CHECK(FAKE_COUNTER("fake_devmem_live") > 0);
+    read_bulk(handle);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 重复启动复用已分配的设备内存
+    long long allocs = FAKE_COUNTER("fake_devmem_allocs");
+    for (int i = 0; i < 20; i++) {
+        CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+        CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    }
+    CHECK_EQ(FAKE_COUNTER("fake_devmem_allocs"), allocs);
+    unsigned char data[4096] = {0};
+    CHECK_EQ(USB_WriteDataEx(handle, data, sizeof(data)), (int)sizeof(data));
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    CHECK_EQ(FAKE_COUNTER("fake_devmem_live"), 0);
+    test_unload();
+
+    // 禁用后使用普通内存
+    setenv("USB_API_DEVICE_MEMORY", "0", 1);
+    allocs = FAKE_COUNTER("fake_devmem_allocs");
+    handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_BULK, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_GetPoolStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK_EQ(stats.stream_buffer_mode, USB_BUFFER_HEAP);
+    CHECK_EQ(stats.device_memory_bytes, 0);
+    read_bulk(handle);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    CHECK_EQ(FAKE_COUNTER("fake_devmem_allocs"), allocs);
+    test_unload();
+
+    printf("devmem: %lld device memory blocks allocated and returned\n", allocs);
+    return 0;
+}
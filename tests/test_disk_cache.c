@@ -0,0 +1,79 @@
+// 序列号磁盘缓存：后续进程冷启动时不打开设备即可列出序列号，拓扑变化时缓存作废
+#include "test_common.h"
+#include <limits.h>
+#include <sys/wait.h>
+
+#define DEVICES 16
+
+// 冷启动扫描，返回打开设备的次数
+static long long cold_scan(int expect_devices) {
+    device_info_t devices[DEVICES];
+    CHECK_EQ(USB_ScanDevice(devices, DEVICES), expect_devices);
+    for (int i = 0; i < expect_devices; i++) {
+        char expected[16];
+        snprintf(expected, sizeof(expected), "SN%04d", i);
+        CHECK(strcmp(devices[i].serial_number, expected) == 0);
+    }
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    test_unload();
+    return opens;
+}
+
+// 在新进程中冷启动扫描，返回子进程打开设备的次数
+static long long run_child(const char *self, const char *devices) {
+    char output[PATH_MAX];
+    snprintf(output, sizeof(output), "%s/opens.txt", getenv("TMPDIR"));
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        setenv("FAKE_NDEV", devices, 1);
+        execl(self, self, output, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    CHECK_EQ(waitpid(pid, &status, 0), pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    FILE *file = fopen(output, "r");
+    CHECK(file != NULL);
+    long long opens = -1;
+    CHECK_EQ(fscanf(file, "%lld", &opens), 1);
+    fclose(file);
+    return opens;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        long long opens = cold_scan(atoi(getenv("FAKE_NDEV")));
+        FILE *file = fopen(argv[1], "w");
+        CHECK(file != NULL);
+        fprintf(file, "%lld\n", opens);
+        fclose(file);
+        return 0;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/serials.bin", getenv("TMPDIR"));
+    setenv("USB_API_SERIAL_CACHE", path, 1);
+    fake_config("FAKE_RATE_HZ", "0");
+
+    // 第一个进程打开所有设备并写入缓存
+    CHECK_EQ(run_child(argv[0], "16"), DEVICES);
+    // 拓扑不变时后续进程不打开任何设备
+    CHECK_EQ(run_child(argv[0], "16"), 0);
+    CHECK_EQ(run_child(argv[0], "16"), 0);
+    // 设备数量变化后缓存作废，重新打开并写入
+    CHECK_EQ(run_child(argv[0], "12"), 12);
+    CHECK_EQ(run_child(argv[0], "12"), 0);
+
+    // 损坏的缓存文件被忽略
+    FILE *file = fopen(path, "r+b");
+    CHECK(file != NULL);
+    CHECK_EQ(fseek(file, 64, SEEK_SET), 0);
+    fputc(0x5a, file);
+    fclose(file);
+    CHECK_EQ(run_child(argv[0], "12"), 12);
+    CHECK_EQ(run_child(argv[0], "12"), 0);
+
+    printf("disk cache: warm processes opened no devices\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+// 事件线程：调用者不驱动事件也能完成异步传输；卸载时即使事件线程正在并行读取序列号、
+// 或者还没有开始运行也能安全停止
+#include "test_common.h"
+
+#define DEVICES 64
+#define REPLUGGED 32
+
+static volatile int changes;
+
+static void on_change(const device_info_t *device, int arrived, void *user_data) {
+    (void)device; (void)arrived; (void)user_data;
+    __atomic_add_fetch(&changes, 1, __ATOMIC_SEQ_CST);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "64");
+    fake_config("FAKE_RATE_HZ", "1000");
+    fake_config("FAKE_STR_LAT_MS", "20");
+    fake_config("FAKE_HOTPLUG", "1");
+
+    CHECK_EQ(USB_SetEventPollInterval(0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_SetEventPollInterval(1001), USB_ERROR_INVALID);
+    CHECK_EQ(USB_SetEventPollInterval(50), USB_SUCCESS);
+
+    device_info_t devices[DEVICES];
+    CHECK_EQ(USB_ScanDevice(devices, DEVICES), DEVICES);
+
+    // 流的传输只由事件线程完成，读取者只等待环形缓冲区
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 256), USB_SUCCESS);
+    unsigned char packet[64];
+    for (int i = 0; i < 100; i++) CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+
+    // 重新插入的设备地址改变，事件线程在热插拔通知后并行读取它们的序列号
+    CHECK_EQ(USB_RegisterChangeCallback(on_change, NULL), USB_SUCCESS);
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    for (int i = 0; i < REPLUGGED; i++) fake_set_connected(i, 0);
+    for (int i = 0; i < REPLUGGED; i++) fake_set_connected(i, 1);
+    double deadline = now_ms() + 1000;
+    while (FAKE_COUNTER("fake_open_calls") < opens + 1 && now_ms() < deadline) Sleep(1);
+    CHECK(FAKE_COUNTER("fake_open_calls") > opens);
+
+    // 卸载发生在读取过程中：持有加载器锁时工作线程无法启动，事件线程必须自己读完剩下的设备
+    double start = now_ms();
+    test_unload();
+    double unload_ms = now_ms() - start;
+
+    // 返回之后事件线程已经结束，不会再访问 libusb
+    long long after = FAKE_COUNTER("fake_open_calls");
+    Sleep(200);
+    CHECK_EQ(FAKE_COUNTER("fake_open_calls"), after);
+    CHECK(unload_ms < REPLUGGED * 20 + 1000);
+
+    // 重新初始化后立即卸载：事件线程创建后还在等待加载器锁，卸载不能等它
+    pthread_mutex_lock(&shim_loader_lock);
+    CHECK_EQ(USB_ScanDevice(devices, DEVICES), DEVICES);
+    start = now_ms();
+    DllMain(NULL, DLL_PROCESS_DETACH, NULL);
+    double early_ms = now_ms() - start;
+    pthread_mutex_unlock(&shim_loader_lock);
+    after = FAKE_COUNTER("fake_open_calls");
+    Sleep(200);
+    CHECK_EQ(FAKE_COUNTER("fake_open_calls"), after);
+    CHECK(early_ms < 1000);
+
+    printf("event thread: unload during refresh took %.1f ms, %d change callbacks, "
+           "unload before the thread started took %.1f ms\n", unload_ms, changes, early_ms);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// 设备过滤条件：只匹配满足任一条件的设备，不匹配的设备不会被打开
+#include "test_common.h"
+
+#define TARGETS 8
+#define OTHERS 4
+
+static int arrivals, departures;
+
+static void on_change(const device_info_t *device, int arrived, void *user_data) {
+    (void)device; (void)user_data;
+    if (arrived) arrivals++;
+    else departures++;
+}
+
+static int scan(void) {
+    device_info_t devices[64];
+    return USB_ScanDevice(devices, 64);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "8");
+    fake_config("FAKE_OTHER", "4");
+    fake_config("FAKE_RATE_HZ", "0");
+
+    // 默认只匹配 VENDOR_ID/PRODUCT_ID，其他厂商的设备不会被打开
+    CHECK_EQ(USB_RegisterChangeCallback(on_change, NULL), USB_SUCCESS);
+    CHECK_EQ(scan(), TARGETS);
+    CHECK_EQ(FAKE_COUNTER("fake_open_calls"), TARGETS);
+    arrivals = departures = 0;
+
+    // 新条件在下次扫描时生效，并通过变化回调报告
+    usb_device_filter_t filters[4100] = {
+        {0x046d, 0xC52B, USB_MATCH_ANY},
+        {VENDOR_ID, USB_MATCH_ANY, USB_MATCH_ANY},
+    };
+    CHECK_EQ(USB_SetDeviceFilter(filters, 2), USB_SUCCESS);
+    CHECK_EQ(scan(), TARGETS + OTHERS);
+    CHECK_EQ(arrivals, OTHERS);
+    CHECK_EQ(departures, 0);
+
+    // 设备类必须同时匹配
+    filters[0].device_class = 3;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 1), USB_SUCCESS);
+    CHECK_EQ(scan(), 0);
+    filters[0].device_class = 0;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 1), USB_SUCCESS);
+    CHECK_EQ(scan(), OTHERS);
+
+    // 重复的条件合并，大量条件时匹配最后一条
+    filters[1] = filters[0];
+    filters[1].device_class = USB_MATCH_ANY;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 2), USB_SUCCESS);
+    CHECK_EQ(scan(), OTHERS);
+    for (int i = 0; i < 4096; i++) {
+        filters[i].vid = 0x2000 + i % 0x1000;
+        filters[i].pid = i;
+        filters[i].device_class = USB_MATCH_ANY;
+    }
+    filters[4095].vid = VENDOR_ID;
+    filters[4095].pid = PRODUCT_ID;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 4096), USB_SUCCESS);
+    CHECK_EQ(scan(), TARGETS);
+
+    // 通配 VID 和设备类
+    filters[0].vid = USB_MATCH_ANY;
+    filters[0].pid = 0xC52B;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 1), USB_SUCCESS);
+    CHECK_EQ(scan(), OTHERS);
+    filters[0].pid = USB_MATCH_ANY;
+    filters[0].device_class = 0;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 1), USB_SUCCESS);
+    CHECK_EQ(scan(), TARGETS + OTHERS);
+
+    // 无效的条件不改变当前设置
+    filters[0].vid = 0x10000;
+    CHECK_EQ(USB_SetDeviceFilter(filters, 1), USB_ERROR_INVALID);
+    CHECK_EQ(USB_SetDeviceFilter(filters, 4097), USB_ERROR_INVALID);
+    CHECK_EQ(USB_SetDeviceFilter(NULL, 1), USB_ERROR_INVALID);
+    CHECK_EQ(scan(), TARGETS + OTHERS);
+
+    // 恢复默认后其他厂商的设备离开
+    arrivals = departures = 0;
+    CHECK_EQ(USB_SetDeviceFilter(NULL, 0), USB_SUCCESS);
+    CHECK_EQ(scan(), TARGETS);
+    CHECK_EQ(arrivals, 0);
+    CHECK_EQ(departures, OTHERS);
+
+    CHECK_EQ(USB_RegisterChangeCallback(NULL, NULL), USB_SUCCESS);
+    test_unload();
+    printf("filter: %lld libusb_open calls\n", FAKE_COUNTER("fake_open_calls"));
+    return 0;
+}
@@ -0,0 +1,42 @@
+// 整数句柄：与序列号接口等价，关闭后旧句柄失效，重新打开得到不同的句柄
+#include "test_common.h"
+
+int main(void) {
+    fake_config("FAKE_NDEV", "2");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    unsigned char buffer[64];
+    int handle = USB_OpenDeviceEx("SN0001");
+    CHECK(handle > 0);
+    CHECK_EQ(USB_GetDeviceHandle("SN0001"), handle);
+    CHECK_EQ(USB_GetDeviceHandle("SN0000"), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_OpenDeviceEx("SN0001"), USB_ERROR_BUSY);
+    CHECK_EQ(USB_OpenDeviceEx("SN9999"), USB_ERROR_NOT_FOUND);
+
+    CHECK_EQ(USB_ReadDataEx(handle, buffer, sizeof(buffer)), 64);
+    CHECK_EQ(USB_ReadData("SN0001", buffer, sizeof(buffer)), 64);
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    CHECK_EQ(USB_ReadDataEx(handle, buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_ERROR_NOT_FOUND);
+
+    // 同一个槽位重新使用时代数改变，旧句柄不会误指向新设备
+    int reopened = USB_OpenDeviceEx("SN0001");
+    CHECK(reopened > 0);
+    CHECK(reopened != handle);
+    CHECK_EQ(USB_ReadDataEx(handle, buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_ReadDataEx(reopened, buffer, sizeof(buffer)), 64);
+
+    CHECK_EQ(USB_StartStreamEx(reopened, 4, 64), USB_SUCCESS);
+    CHECK_EQ(USB_ReadStreamEx(reopened, buffer, sizeof(buffer), 100), 64);
+
+    // 序列号接口关闭的设备，其句柄同样失效
+    CHECK_EQ(USB_CloseDevice("SN0001"), USB_SUCCESS);
+    CHECK_EQ(USB_ReadStreamEx(reopened, buffer, sizeof(buffer), 0), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_ReadDataEx(0, buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_ReadDataEx(-1, buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+    CHECK_EQ(USB_ReadDataEx(0x7fffffff, buffer, sizeof(buffer)), USB_ERROR_NOT_FOUND);
+
+    test_unload();
+    return 0;
+}
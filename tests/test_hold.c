@@ -0,0 +1,87 @@
+// 保持缓冲区：保持期间传输不重新提交；停止流、关闭设备和卸载时未释放的保持自动失效，不会挂起
+#include "test_common.h"
+
+static int g_handle;
+static volatile int g_hold;                   // 非0时回调保持收到的缓冲区
+static const unsigned char *volatile g_held;  // 最近一次保持的缓冲区
+static volatile long g_packets, g_held_count, g_ended;
+
+static void on_data(const unsigned char *data, int length, void *user_data) {
+    (void)user_data;
+    if (!data) {
+        if (length == USB_ERROR_INTERRUPTED) __atomic_add_fetch(&g_ended, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    __atomic_add_fetch(&g_packets, 1, __ATOMIC_SEQ_CST);
+    if (g_hold && USB_HoldBufferEx(g_handle, data) == USB_SUCCESS) {
+        g_held = data;
+        __atomic_add_fetch(&g_held_count, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void wait_for(volatile long *counter, long value) {
+    double deadline = now_ms() + 2000;
+    while (*counter < value && now_ms() < deadline) Sleep(1);
+    CHECK(*counter >= value);
+}
+
+// 启动回调模式的流，并让回调保持 count 个缓冲区后不再保持
+static void start_holding(int count) {
+    g_held_count = 0;
+    g_hold = 1;
+    CHECK_EQ(USB_RegisterDataCallbackEx(g_handle, on_data, NULL), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(g_handle, 4, 0), USB_SUCCESS);
+    wait_for(&g_held_count, count);
+    g_hold = 0;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    int handle = g_handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+
+    // 回调之外的指针不能保持
+    unsigned char local[64];
+    CHECK_EQ(USB_HoldBufferEx(handle, local), USB_ERROR_INVALID);
+
+    // 4 个传输全部被保持后不再有数据，释放一个后恢复
+    start_holding(4);
+    Sleep(50);
+    long packets = g_packets;
+    Sleep(50);
+    CHECK_EQ(g_packets, packets);
+    const unsigned char *held = g_held;
+    CHECK_EQ(USB_ReleaseBufferEx(handle, held), USB_SUCCESS);
+    CHECK_EQ(USB_ReleaseBufferEx(handle, held), USB_ERROR_INVALID);
+    wait_for(&g_packets, packets + 1);
+
+    // 其余保持从不释放，停止流不等待它们
+    long ended = g_ended;
+    double start = now_ms();
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    double stop_ms = now_ms() - start;
+    CHECK(stop_ms < 500);
+    CHECK_EQ(g_ended, ended + 1);
+    CHECK_EQ(USB_ReleaseBufferEx(handle, g_held), USB_ERROR_INVALID);
+
+    // 关闭设备时同样不等待
+    start_holding(2);
+    start = now_ms();
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    double close_ms = now_ms() - start;
+    CHECK(close_ms < 500);
+
+    // 卸载时持有加载器锁，保持者永远不会释放
+    handle = g_handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    start_holding(2);
+    start = now_ms();
+    test_unload();
+    double unload_ms = now_ms() - start;
+    CHECK(unload_ms < 500);
+
+    printf("hold: stop %.1f ms, close %.1f ms, unload %.1f ms with buffers held\n", stop_ms, close_ms, unload_ms);
+    return 0;
+}
@@ -0,0 +1,95 @@
+// 等时流：切换备用设置，出错和队列满丢失的包以间隙标记表示，序号跳变之前总有间隙标记
+#include "test_common.h"
+
+#define SLOT 1024
+#define BATCH 256
+
+static unsigned char buffer[BATCH * SLOT];
+static int lengths[BATCH];
+
+// 读取 duration_ms 毫秒，检查每次序号跳变之前都有间隙标记，返回间隙数
+static long drain(int handle, int duration_ms, long *packets) {
+    unsigned expected = 0;
+    int first = 1, marked = 0;
+    long gaps = 0;
+    *packets = 0;
+    double start = now_ms();
+    while (now_ms() - start < duration_ms) {
+        int n = USB_ReadBatchEx(handle, buffer, SLOT, BATCH, lengths, NULL, 50);
+        if (n == USB_ERROR_TIMEOUT) continue;
+        CHECK(n >= 0);
+        for (int i = 0; i < n; i++) {
+            if (lengths[i] == USB_ERROR_DATA_LOST) {
+                gaps++;
+                marked = 1;
+                continue;
+            }
+            unsigned value;
+            memcpy(&value, buffer + i * SLOT, sizeof(value));
+            CHECK(first || value == expected || marked);
+            first = marked = 0;
+            expected = value + 1;
+            (*packets)++;
+        }
+    }
+    return gaps;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "8000");
+    fake_config("FAKE_ISO_ERR", "1");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+
+    // 类型必须一致，缓冲区大小必须是最大包长的整数倍
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x83, USB_TRANSFER_BULK, 0, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x83, 0, 1000, 0), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, USB_TRANSFER_ISOCHRONOUS, 0, 0), USB_ERROR_INVALID);
+
+    long long alt_sets = FAKE_COUNTER("fake_alt_sets");
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x83, 0, 0, 0), USB_SUCCESS);
+    CHECK_EQ(FAKE_COUNTER("fake_alt_sets"), alt_sets + 1);
+    unsigned char packet[SLOT];
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), USB_ERROR_NOT_SUPPORTED);
+
+    // 出错的包以间隙标记表示
+    long packets;
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 0), USB_SUCCESS);
+    long gaps = drain(handle, 500, &packets);
+    CHECK(packets > 0);
+    CHECK(gaps > 0);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 队列满时丢弃的包同样以间隙标记表示
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 256), USB_SUCCESS);
+    Sleep(300);
+    long overflow_packets;
+    long overflow_gaps = drain(handle, 300, &overflow_packets);
+    usb_stream_stats_t stats;
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK(stats.overflows > 0);
+    CHECK(overflow_gaps > 0);
+
+    // 按字节读取时间隙返回 USB_ERROR_DATA_LOST
+    int lost = 0;
+    for (int i = 0; i < 200 && !lost; i++) {
+        int n = USB_ReadStreamBytesEx(handle, packet, sizeof(packet), 50);
+        if (n == USB_ERROR_DATA_LOST) lost = 1;
+        else CHECK(n > 0 || n == USB_ERROR_TIMEOUT);
+    }
+    CHECK(lost);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 恢复默认端点时切回备用设置0
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 0), USB_SUCCESS);
+    CHECK_EQ(FAKE_COUNTER("fake_alt_sets"), alt_sets + 2);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    test_unload();
+    printf("iso: %ld packets, %ld gaps; after overflow %ld packets, %ld gaps\n",
+           packets, gaps, overflow_packets, overflow_gaps);
+    return 0;
+}
@@ -0,0 +1,75 @@
+// 传输和缓冲区池：打开时预分配，流式读取和启动/停止在配置不变时不再申请内存，关闭时全部归还
+#include "test_common.h"
+
+static usb_pool_stats_t pool_stats(int handle) {
+    usb_pool_stats_t stats;
+    CHECK_EQ(USB_GetPoolStatsEx(handle, &stats), USB_SUCCESS);
+    return stats;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "0");
+
+    static unsigned char buffer[1 << 20];
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    usb_pool_stats_t stats = pool_stats(handle);
+    CHECK(stats.reserved_bytes > 0);
+    CHECK(stats.reserved_transfers > 0);
+    CHECK_EQ(stats.in_use_bytes, 0);
+    CHECK_EQ(stats.in_use_transfers, 0);
+
+    // 批量流第一次启动时按新配置分配，之后数据路径不再申请
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_BULK, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+    stats = pool_stats(handle);
+    CHECK(stats.in_use_transfers > 0);
+    CHECK(stats.in_use_bytes > 0 && stats.in_use_bytes <= stats.reserved_bytes);
+    for (int i = 0; i < 100; i++) CHECK(USB_ReadStreamBytesEx(handle, buffer, sizeof(buffer), 1000) > 0);
+    unsigned long long allocations = pool_stats(handle).heap_allocations;
+    usb_stream_stats_t stream_stats;
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stream_stats), USB_SUCCESS);
+    unsigned long long packets = stream_stats.packets;
+    for (int i = 0; i < 1000; i++) CHECK(USB_ReadStreamBytesEx(handle, buffer, sizeof(buffer), 1000) > 0);
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stream_stats), USB_SUCCESS);
+    CHECK(stream_stats.packets > packets);
+    CHECK_EQ(pool_stats(handle).heap_allocations, allocations);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    stats = pool_stats(handle);
+    CHECK_EQ(stats.in_use_bytes, 0);
+    CHECK_EQ(stats.in_use_transfers, 0);
+
+    // 重复启动/停止和写入复用池中的对象
+    unsigned char data[64] = {1};
+    CHECK_EQ(USB_WriteDataEx(handle, data, sizeof(data)), 64);
+    CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    allocations = pool_stats(handle).heap_allocations;
+    for (int i = 0; i < 100; i++) {
+        CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+        CHECK(USB_ReadStreamBytesEx(handle, buffer, sizeof(buffer), 1000) > 0);
+        CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+        CHECK_EQ(USB_WriteDataEx(handle, data, sizeof(data)), 64);
+    }
+    CHECK_EQ(pool_stats(handle).heap_allocations, allocations);
+
+    // 更大的配置需要新的缓冲区，回到默认配置后仍可复用
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, USB_TRANSFER_BULK, 262144, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 16, 0), USB_SUCCESS);
+    CHECK(pool_stats(handle).heap_allocations > allocations);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 0), USB_SUCCESS);
+    allocations = pool_stats(handle).heap_allocations;
+    CHECK_EQ(USB_StartStreamEx(handle, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    CHECK_EQ(pool_stats(handle).heap_allocations, allocations);
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    usb_pool_stats_t closed;
+    CHECK_EQ(USB_GetPoolStatsEx(handle, &closed), USB_ERROR_NOT_FOUND);
+
+    test_unload();
+    printf("pool: %llu allocations, no growth while streaming or restarting\n", allocations);
+    return 0;
+}
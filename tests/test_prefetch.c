@@ -0,0 +1,61 @@
+// 预读：USB_ReadData 从流接收队列取数据，按配置的超时等待，开启前已启动的流在关闭预读时保留
+#include "test_common.h"
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    unsigned char packet[64], small[8];
+
+    // 开启时启动流，中断端点每次返回一个数据包，序号连续
+    CHECK_EQ(USB_SetPrefetchEx(handle, 1), USB_SUCCESS);
+    unsigned expected = 0;
+    for (int i = 0; i < 200; i++) {
+        CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+        unsigned value;
+        memcpy(&value, packet, sizeof(value));
+        CHECK(i == 0 || value == expected);
+        expected = value + 1;
+    }
+    CHECK_EQ(USB_ReadDataEx(handle, small, sizeof(small)), USB_ERROR_OVERFLOW);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 100), USB_ERROR_BUSY);
+
+    // 关闭预读时停止自己启动的流
+    CHECK_EQ(USB_SetPrefetchEx(handle, 0), USB_SUCCESS);
+    usb_stream_stats_t stats;
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stats), USB_ERROR_INVALID);
+
+    // 没有数据时按 USB_ConfigureDevice 设置的超时返回
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0, 0, 0, 100), USB_SUCCESS);
+    CHECK_EQ(USB_SetPrefetchEx(handle, 1), USB_SUCCESS);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+    fake_set_rate(0, 0);
+    for (int i = 0; i < 1000 && USB_ReadDataEx(handle, packet, sizeof(packet)) == 64; i++) {
+    }
+    double start = now_ms();
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), USB_ERROR_TIMEOUT);
+    double timeout_ms = now_ms() - start;
+    CHECK(timeout_ms >= 90 && timeout_ms < 1000);
+    fake_set_rate(0, 1000);
+    CHECK_EQ(USB_SetPrefetchEx(handle, 0), USB_SUCCESS);
+
+    // 已启动的流直接用于预读，关闭预读时保留
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 256), USB_SUCCESS);
+    CHECK_EQ(USB_SetPrefetchEx(handle, 1), USB_SUCCESS);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+    CHECK_EQ(USB_SetPrefetchEx(handle, 0), USB_SUCCESS);
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 等时端点不支持预读
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x83, 0, 0, 0), USB_SUCCESS);
+    CHECK_EQ(USB_SetPrefetchEx(handle, 1), USB_ERROR_NOT_SUPPORTED);
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    test_unload();
+    printf("prefetch: empty queue timed out after %.1f ms\n", timeout_ms);
+    return 0;
+}
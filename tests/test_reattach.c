@@ -0,0 +1,92 @@
+// 自动重连：设备重新插入后原句柄和流继续工作，旧句柄分配的设备内存归还后才关闭
+#include "test_common.h"
+
+static usb_reattach_stats_t reattach_stats(int handle) {
+    usb_reattach_stats_t stats;
+    CHECK_EQ(USB_GetReattachStatsEx(handle, &stats), USB_SUCCESS);
+    return stats;
+}
+
+// 等待流在重连后送来下一个数据包，返回等待的毫秒数
+static double wait_resume(int handle, unsigned char *packet, int length) {
+    double start = now_ms();
+    int result;
+    do {
+        result = USB_ReadStreamEx(handle, packet, length, 2000);
+    } while (result == USB_ERROR_TIMEOUT && now_ms() - start < 5000);
+    CHECK_EQ(result, length);
+    return now_ms() - start;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "1000");
+    fake_config("FAKE_DEVMEM", "1");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    unsigned char packet[64];
+    CHECK_EQ(USB_SetAutoReattachEx(handle, 1), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 0), USB_SUCCESS);
+    for (int i = 0; i < 100; i++) CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+
+    // 断开期间同步读取返回未找到，流等待重连
+    fake_set_connected(0, 0);
+    Sleep(50);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), USB_ERROR_NOT_FOUND);
+    usb_reattach_stats_t stats = reattach_stats(handle);
+    CHECK_EQ(stats.disconnects, 1);
+    CHECK_EQ(stats.attached, 0);
+    fake_set_connected(0, 1);
+    double resume_ms = wait_resume(handle, packet, sizeof(packet));
+    stats = reattach_stats(handle);
+    CHECK_EQ(stats.reattaches, 1);
+    CHECK_EQ(stats.attached, 1);
+    CHECK(stats.lost_transfers > 0);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+    CHECK_EQ(USB_WriteDataEx(handle, packet, 8), 8);
+
+    // 快速反复插拔
+    for (int i = 0; i < 20; i++) {
+        fake_set_connected(0, 0);
+        Sleep(i % 5);
+        fake_set_connected(0, 1);
+        double ms = wait_resume(handle, packet, sizeof(packet));
+        if (ms > resume_ms) resume_ms = ms;
+    }
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 关闭自动重连时设备已断开，流按设备断开终止
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 0), USB_SUCCESS);
+    CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+    fake_set_connected(0, 0);
+    Sleep(30);
+    CHECK_EQ(USB_SetAutoReattachEx(handle, 0), USB_SUCCESS);
+    int result;
+    do {
+        result = USB_ReadStreamEx(handle, packet, sizeof(packet), 1000);
+    } while (result > 0);
+    CHECK(result != USB_ERROR_TIMEOUT);
+    fake_set_connected(0, 1);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+
+    // 断开期间关闭设备
+    handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    CHECK_EQ(USB_SetAutoReattachEx(handle, 1), USB_SUCCESS);
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 0), USB_SUCCESS);
+    CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+    fake_set_connected(0, 0);
+    Sleep(30);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    fake_set_connected(0, 1);
+
+    // 旧句柄的设备内存全部归还，关闭后的句柄没有再被使用
+    CHECK_EQ(FAKE_COUNTER("fake_devmem_live"), 0);
+    CHECK_EQ(FAKE_COUNTER("fake_closed_use"), 0);
+
+    test_unload();
+    printf("reattach: worst resume %.1f ms over 21 replugs\n", resume_ms);
+    return 0;
+}
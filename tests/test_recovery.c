@@ -0,0 +1,76 @@
+// 错误恢复：同步读取和流在端点停止、瞬时错误后自动恢复，持续出错时终止，退避期间可以立即停止
+#include "test_common.h"
+
+int main(void) {
+    fake_config("FAKE_NDEV", "1");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    int handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    unsigned char packet[64];
+
+    // 同步读取：清除端点停止后重试，瞬时错误重试，持续出错返回错误
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+    fake_set_halt(0, 1);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+    fake_inject_errors(0, 2);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+    fake_inject_errors(0, 100);
+    int result = USB_ReadDataEx(handle, packet, sizeof(packet));
+    CHECK(result < 0 && result != USB_ERROR_TIMEOUT);
+    fake_inject_errors(0, 0);
+    CHECK_EQ(USB_ReadDataEx(handle, packet, sizeof(packet)), 64);
+
+    // 写入遇到端点停止时报告一次，之后的写入无需重新打开设备
+    fake_set_halt(0, 1);
+    CHECK_EQ(USB_WriteDataEx(handle, packet, 8), USB_ERROR_PIPE);
+    CHECK_EQ(USB_WriteDataEx(handle, packet, 8), 8);
+
+    // 流：每 50 ms 交替注入端点停止和瞬时错误，流不终止，恢复的传输计入统计
+    CHECK_EQ(USB_StartStreamEx(handle, 4, 0), USB_SUCCESS);
+    long packets = 0;
+    int faults = 0;
+    double start = now_ms(), next_fault = start + 50;
+    while (now_ms() - start < 1000) {
+        if (now_ms() >= next_fault) {
+            if (faults++ % 2) fake_set_halt(0, 1);
+            else fake_inject_errors(0, 3);
+            next_fault += 50;
+        }
+        CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+        packets++;
+    }
+    usb_stream_stats_t stats;
+    CHECK_EQ(USB_GetStreamStatsEx(handle, &stats), USB_SUCCESS);
+    CHECK(stats.recovered > 0);
+
+    // 持续出错时流终止，读取返回错误
+    fake_inject_errors(0, 100000);
+    do {
+        result = USB_ReadStreamEx(handle, packet, sizeof(packet), 1000);
+    } while (result > 0);
+    CHECK(result != USB_ERROR_TIMEOUT);
+    fake_inject_errors(0, 0);
+    CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+
+    // 退避期间停止流不等待退避结束
+    double worst_stop_ms = 0;
+    for (int i = 0; i < 20; i++) {
+        CHECK_EQ(USB_StartStreamEx(handle, 4, 0), USB_SUCCESS);
+        CHECK_EQ(USB_ReadStreamEx(handle, packet, sizeof(packet), 1000), 64);
+        fake_inject_errors(0, 5);
+        Sleep(i % 4);
+        start = now_ms();
+        CHECK_EQ(USB_StopStreamEx(handle), USB_SUCCESS);
+        double stop_ms = now_ms() - start;
+        if (stop_ms > worst_stop_ms) worst_stop_ms = stop_ms;
+    }
+    fake_inject_errors(0, 0);
+    CHECK(worst_stop_ms < 50);
+
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+    test_unload();
+    printf("recovery: %ld packets through %d faults, %llu transfers recovered, worst stop %.1f ms\n",
+           packets, faults, stats.recovered, worst_stop_ms);
+    return 0;
+}
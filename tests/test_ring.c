@@ -0,0 +1,50 @@
+// 流接收队列：读取者跟得上时不丢包，停止读取后队列满了按溢出计数丢弃
+#include "test_common.h"
+
+int main(void) {
+    fake_config("FAKE_NDEV", "2");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    CHECK_EQ(USB_OpenDevice("SN0001"), USB_SUCCESS);
+    CHECK_EQ(USB_StartStream("SN0001", 16, 64), USB_SUCCESS);
+
+    unsigned char packet[64];
+    unsigned last = 0;
+    int received = 0, gaps = 0;
+    double start = now_ms();
+    while (now_ms() - start < 500) {
+        CHECK_EQ(USB_ReadStream("SN0001", packet, sizeof(packet), 100), 64);
+        unsigned sequence;
+        memcpy(&sequence, packet, sizeof(sequence));
+        if (received && sequence != last + 1) gaps++;
+        last = sequence;
+        received++;
+    }
+    CHECK_EQ(gaps, 0);
+
+    usb_stream_stats_t stats;
+    CHECK_EQ(USB_GetStreamStats("SN0001", &stats), USB_SUCCESS);
+    CHECK_EQ(stats.overflows, 0);
+    CHECK(stats.capacity >= 64);
+    CHECK(stats.packets >= (unsigned long long)received);
+
+    // 不读取时队列在约 capacity 毫秒后填满，之后到达的数据包计入溢出
+    Sleep(stats.capacity + 200);
+    CHECK_EQ(USB_GetStreamStats("SN0001", &stats), USB_SUCCESS);
+    CHECK_EQ(stats.queued, stats.capacity);
+    CHECK(stats.overflows >= 100);
+
+    // 队列中的数据包仍可读出，缓冲区小于数据包时返回溢出而不丢弃
+    for (unsigned i = 0; i < stats.capacity; i++) {
+        CHECK_EQ(USB_ReadStream("SN0001", packet, sizeof(packet), 0), 64);
+    }
+    unsigned char small[8];
+    CHECK_EQ(USB_ReadStream("SN0001", small, sizeof(small), 100), USB_ERROR_OVERFLOW);
+
+    CHECK_EQ(USB_StopStream("SN0001"), USB_SUCCESS);
+    CHECK_EQ(USB_GetStreamStats("SN0001", &stats), USB_ERROR_INVALID);
+    CHECK_EQ(USB_CloseDevice("SN0001"), USB_SUCCESS);
+    test_unload();
+    printf("ring: %d packets read without gaps\n", received);
+    return 0;
+}
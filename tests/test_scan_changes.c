@@ -0,0 +1,75 @@
+// 增量扫描：游标之后的到达和离开，空闲时不枚举总线，数组不足与游标过旧的返回值
+#include "test_common.h"
+
+#define DEVICES 16
+
+static unsigned long long cursor;
+static device_info_t added[DEVICES], removed[DEVICES];
+static int num_added, num_removed;
+
+// 等待热插拔通知处理完成，直到游标之后出现预期数量的变化
+static void wait_changes(int expect_added, int expect_removed) {
+    double deadline = now_ms() + 2000;
+    unsigned long long start = cursor;
+    do {
+        cursor = start;
+        CHECK_EQ(USB_ScanChanges(&cursor, added, DEVICES, &num_added, removed, DEVICES, &num_removed), USB_SUCCESS);
+        if (num_added == expect_added && num_removed == expect_removed) return;
+        Sleep(1);
+    } while (now_ms() < deadline);
+    CHECK_EQ(num_added, expect_added);
+    CHECK_EQ(num_removed, expect_removed);
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "16");
+    fake_config("FAKE_HOTPLUG", "1");
+
+    // 首次调用返回全部设备
+    CHECK_EQ(USB_ScanChanges(&cursor, added, DEVICES, &num_added, removed, DEVICES, &num_removed), USB_SUCCESS);
+    CHECK_EQ(num_added, DEVICES);
+    CHECK_EQ(num_removed, 0);
+    CHECK(cursor != 0);
+
+    // 没有变化时只比较游标，不枚举总线
+    long long lists = FAKE_COUNTER("fake_list_calls");
+    double start = now_ms();
+    for (int i = 0; i < 100000; i++) {
+        CHECK_EQ(USB_ScanChanges(&cursor, added, DEVICES, &num_added, removed, DEVICES, &num_removed), USB_SUCCESS);
+        CHECK_EQ(num_added + num_removed, 0);
+    }
+    double idle_ns = (now_ms() - start) * 1e6 / 100000;
+    CHECK_EQ(FAKE_COUNTER("fake_list_calls"), lists);
+
+    fake_set_connected(5, 0);
+    fake_set_connected(7, 0);
+    wait_changes(0, 2);
+    CHECK(strcmp(removed[0].serial_number, "SN0005") == 0 || strcmp(removed[1].serial_number, "SN0005") == 0);
+
+    // 重新插入的设备地址改变，作为一次离开和一次到达
+    fake_set_connected(9, 0);
+    fake_set_connected(9, 1);
+    wait_changes(1, 1);
+    CHECK(strcmp(added[0].serial_number, "SN0009") == 0);
+    CHECK(strcmp(removed[0].serial_number, "SN0009") == 0);
+
+    // 数组不足时返回所需大小，游标不变
+    unsigned long long fresh = 0;
+    CHECK_EQ(USB_ScanChanges(&fresh, added, 4, &num_added, removed, 0, &num_removed), USB_ERROR_OVERFLOW);
+    CHECK_EQ(num_added, DEVICES - 2);
+    CHECK_EQ(fresh, 0);
+
+    // 变化记录被覆盖后旧游标失效
+    unsigned long long stale = cursor;
+    for (int i = 0; i < 300; i++) {
+        fake_set_connected(11, 0);
+        fake_set_connected(11, 1);
+        wait_changes(1, 1);
+    }
+    CHECK_EQ(USB_ScanChanges(&stale, added, DEVICES, &num_added, removed, DEVICES, &num_removed),
+             USB_ERROR_INTERRUPTED);
+
+    test_unload();
+    printf("scan changes: idle poll %.1f ns\n", idle_ns);
+    return 0;
+}
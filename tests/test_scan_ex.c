@@ -0,0 +1,51 @@
+// 扩展扫描：USB_SCAN_NO_OPEN 只读取描述符，不打开设备，序列号取自已有缓存
+#include "test_common.h"
+
+#define DEVICES 8
+
+int main(void) {
+    fake_config("FAKE_NDEV", "8");
+    fake_config("FAKE_RATE_HZ", "0");
+
+    device_info_ex_t devices[DEVICES];
+    CHECK_EQ(USB_ScanDeviceEx(devices, DEVICES, USB_SCAN_NO_OPEN), DEVICES);
+    CHECK_EQ(FAKE_COUNTER("fake_open_calls"), 0);
+    for (int i = 0; i < DEVICES; i++) {
+        device_info_ex_t *d = &devices[i];
+        CHECK_EQ(d->info.serial_number[0], 0);
+        CHECK_EQ(d->info.vid, VENDOR_ID);
+        CHECK_EQ(d->info.pid, PRODUCT_ID);
+        CHECK_EQ(d->port_depth, 2);
+        CHECK_EQ(d->port_numbers[0], 1 + (i / 10) % 10);
+        CHECK_EQ(d->port_numbers[1], 1 + i % 10);
+        CHECK_EQ(d->speed, USB_SPEED_FULL);
+        CHECK_EQ(d->bcd_usb, 0x0200);
+        CHECK_EQ(d->bcd_device, 0x0100);
+        CHECK_EQ(d->in_endpoint, 0x81);
+        CHECK_EQ(d->out_endpoint, 0x01);
+        CHECK_EQ(d->in_max_packet_size, 64);
+        CHECK_EQ(d->out_max_packet_size, 64);
+    }
+
+    // 完整扫描读取序列号，之后不打开设备的扫描也能返回它们
+    CHECK_EQ(USB_ScanDeviceEx(devices, DEVICES, 0), DEVICES);
+    long long opens = FAKE_COUNTER("fake_open_calls");
+    CHECK_EQ(opens, DEVICES);
+    CHECK(strcmp(devices[3].info.serial_number, "SN0003") == 0);
+    CHECK_EQ(USB_ScanDeviceEx(devices, DEVICES, USB_SCAN_NO_OPEN), DEVICES);
+    CHECK(strcmp(devices[3].info.serial_number, "SN0003") == 0);
+    CHECK_EQ(FAKE_COUNTER("fake_open_calls"), opens);
+
+    // 基本扫描返回相同的信息
+    device_info_t basic[DEVICES];
+    CHECK_EQ(USB_ScanDevice(basic, DEVICES), DEVICES);
+    CHECK(strcmp(basic[5].serial_number, "SN0005") == 0);
+    CHECK_EQ(basic[5].device_address, devices[5].info.device_address);
+
+    CHECK_EQ(USB_ScanDeviceEx(devices, DEVICES, 0x08), USB_ERROR_INVALID);
+    CHECK_EQ(USB_ScanDeviceEx(NULL, DEVICES, 0), USB_ERROR_INVALID);
+
+    test_unload();
+    printf("scan ex: %d devices described without opening\n", DEVICES);
+    return 0;
+}
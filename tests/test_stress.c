@@ -0,0 +1,93 @@
+// 并发：多个线程同时查找、读取，另有线程反复打开、启动流、关闭同一批设备
+#include "test_common.h"
+
+#define DEVICES 24
+#define READERS 8
+#define CHURNERS 4
+
+static volatile int stop;
+static volatile long lookups, reads, reads_with_data, cycles, unexpected;
+
+static void serial_of(int index, char *serial) {
+    snprintf(serial, 16, "SN%04d", index);
+}
+
+// 读取者看到的设备可能随时被关闭，只允许成功或表示设备已不存在/未启动流的错误
+static int expected_result(int result) {
+    return result >= 0 || result == USB_ERROR_NOT_FOUND || result == USB_ERROR_INVALID ||
+           result == USB_ERROR_TIMEOUT || result == USB_ERROR_BUSY || result == USB_ERROR_INTERRUPTED;
+}
+
+static DWORD WINAPI reader(LPVOID param) {
+    long id = (long)param;
+    unsigned char buffer[64 * 64];
+    int lengths[64];
+    char serial[16];
+    while (!stop) {
+        for (int i = id % 4; i < DEVICES; i += 4) {
+            serial_of(i, serial);
+            int handle = USB_GetDeviceHandle(serial);
+            __atomic_add_fetch(&lookups, 1, __ATOMIC_RELAXED);
+            if (handle <= 0) continue;
+            int result = (i & 1) ? USB_ReadBatchEx(handle, buffer, 64, 64, lengths, NULL, 2)
+                                 : USB_ReadStream(serial, buffer, 64, 2);
+            __atomic_add_fetch(&reads, 1, __ATOMIC_RELAXED);
+            if (result > 0) __atomic_add_fetch(&reads_with_data, 1, __ATOMIC_RELAXED);
+            usb_stream_stats_t stats;
+            int stats_result = USB_GetStreamStatsEx(handle, &stats);
+            if (!expected_result(result) || !expected_result(stats_result)) {
+                __atomic_add_fetch(&unexpected, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return 0;
+}
+
+static DWORD WINAPI churner(LPVOID param) {
+    unsigned seed = (unsigned)(long)param * 7919u + 1;
+    char serial[16];
+    while (!stop) {
+        seed = seed * 1103515245u + 12345u;
+        serial_of((seed >> 8) % DEVICES, serial);
+        int handle = USB_OpenDeviceEx(serial);
+        if (handle <= 0) continue;
+        USB_StartStreamEx(handle, 4, 256);
+        Sleep(seed % 5);
+        if (seed & 16) USB_StopStreamEx(handle);
+        CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+        __atomic_add_fetch(&cycles, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "24");
+    fake_config("FAKE_RATE_HZ", "1000");
+
+    HANDLE threads[READERS + CHURNERS];
+    int count = 0;
+    for (long i = 0; i < READERS; i++) threads[count++] = CreateThread(NULL, 0, reader, (LPVOID)i, 0, NULL);
+    for (long i = 0; i < CHURNERS; i++) threads[count++] = CreateThread(NULL, 0, churner, (LPVOID)i, 0, NULL);
+    Sleep(3000);
+    stop = 1;
+    for (int i = 0; i < count; i++) {
+        CHECK_EQ(WaitForSingleObject(threads[i], 10000), WAIT_OBJECT_0);
+        CloseHandle(threads[i]);
+    }
+
+    CHECK_EQ(unexpected, 0);
+    CHECK(cycles > 100);
+    CHECK(reads_with_data > 0);
+    CHECK_EQ(FAKE_COUNTER("fake_closed_use"), 0);
+
+    // 所有设备都已关闭
+    char serial[16];
+    for (int i = 0; i < DEVICES; i++) {
+        serial_of(i, serial);
+        CHECK_EQ(USB_GetDeviceHandle(serial), USB_ERROR_NOT_FOUND);
+    }
+    test_unload();
+    printf("stress: %ld lookups, %ld reads (%ld with data), %ld open/close cycles\n",
+           lookups, reads, reads_with_data, cycles);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// 异步写入：小块写入合并为少量传输，多线程写入不丢数据，超时为 0 时只检查一次
+#include "test_common.h"
+
+#define THREADS 4
+#define THREAD_WRITES 500
+
+static int g_handle;
+
+static DWORD WINAPI writer_thread(LPVOID param) {
+    unsigned char data[16];
+    memset(data, (int)(intptr_t)param, sizeof(data));
+    for (int i = 0; i < THREAD_WRITES; i++) CHECK_EQ(USB_WriteAsyncEx(g_handle, data, sizeof(data)), 16);
+    return 0;
+}
+
+int main(void) {
+    fake_config("FAKE_NDEV", "2");
+    fake_config("FAKE_RATE_HZ", "0");
+    fake_config("FAKE_OUT_LAT_US", "2000");
+
+    int handle = g_handle = USB_OpenDeviceEx("SN0000");
+    CHECK(handle > 0);
+    unsigned char command[16] = {1, 2, 3};
+
+    // 没有写入过时没有需要等待的数据
+    CHECK_EQ(USB_FlushWriteEx(handle, 0), USB_SUCCESS);
+
+    // 同步写入每次一个传输，异步写入合并
+    long long transfers = fake_device_counter("fake_out_transfers", 0);
+    for (int i = 0; i < 100; i++) CHECK_EQ(USB_WriteDataEx(handle, command, sizeof(command)), 16);
+    CHECK_EQ(fake_device_counter("fake_out_transfers", 0) - transfers, 100);
+    transfers = fake_device_counter("fake_out_transfers", 0);
+    long long bytes = fake_device_counter("fake_out_bytes", 0);
+    for (int i = 0; i < 1000; i++) CHECK_EQ(USB_WriteAsyncEx(handle, command, sizeof(command)), 16);
+
+    // 超时为 0 时不等待，传输尚在途时返回超时，数据不受影响
+    CHECK_EQ(USB_FlushWriteEx(handle, 0), USB_ERROR_TIMEOUT);
+    CHECK_EQ(USB_FlushWriteEx(handle, 5000), USB_SUCCESS);
+    CHECK_EQ(USB_FlushWriteEx(handle, 0), USB_SUCCESS);
+    CHECK_EQ(fake_device_counter("fake_out_bytes", 0) - bytes, 16000);
+    CHECK(fake_device_counter("fake_out_transfers", 0) - transfers < 1000);
+
+    // 有写入未完成时不能更改配置
+    CHECK_EQ(USB_WriteAsyncEx(handle, command, sizeof(command)), 16);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, 0, 0, 0), USB_ERROR_BUSY);
+    CHECK_EQ(USB_FlushWriteEx(handle, 1000), USB_SUCCESS);
+    CHECK_EQ(USB_ConfigureDeviceEx(handle, 0x82, 0, 0, 0), USB_SUCCESS);
+
+    // 多个线程同时写入批量端点
+    bytes = fake_device_counter("fake_out_bytes", 0);
+    HANDLE threads[THREADS];
+    for (intptr_t i = 0; i < THREADS; i++) threads[i] = CreateThread(NULL, 0, writer_thread, (LPVOID)(i + 1), 0, NULL);
+    for (int i = 0; i < THREADS; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    CHECK_EQ(USB_FlushWriteEx(handle, 5000), USB_SUCCESS);
+    CHECK_EQ(fake_device_counter("fake_out_bytes", 0) - bytes, THREADS * THREAD_WRITES * 16);
+
+    // 设备拔出后写入报告错误
+    fake_set_connected(0, 0);
+    int async = USB_WriteAsyncEx(handle, command, sizeof(command));
+    int flush = USB_FlushWriteEx(handle, 1000);
+    CHECK(async < 0 || flush < 0);
+    CHECK(USB_WriteDataEx(handle, command, sizeof(command)) < 0);
+    fake_set_connected(0, 1);
+    CHECK_EQ(USB_CloseDeviceEx(handle), USB_SUCCESS);
+
+    // 关闭设备时取消未完成的写入
+    int other = USB_OpenDeviceEx("SN0001");
+    CHECK(other > 0);
+    for (int i = 0; i < 100; i++) CHECK_EQ(USB_WriteAsyncEx(other, command, sizeof(command)), 16);
+    CHECK_EQ(USB_CloseDeviceEx(other), USB_SUCCESS);
+
+    test_unload();
+    printf("write: %d bytes from %d threads\n", THREADS * THREAD_WRITES * 16, THREADS);
+    return 0;
+}
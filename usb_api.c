@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include <windows.h>
 #include "usb_api.h"
 
@@ -23,15 +25,62 @@ enum libusb_transfer_status {
     LIBUSB_TRANSFER_OVERFLOW
 };
 
+enum libusb_error {
+    LIBUSB_SUCCESS = 0,
+    LIBUSB_ERROR_IO = -1,
+    LIBUSB_ERROR_INVALID_PARAM = -2,
+    LIBUSB_ERROR_ACCESS = -3,
+    LIBUSB_ERROR_NO_DEVICE = -4,
+    LIBUSB_ERROR_NOT_FOUND = -5,
+    LIBUSB_ERROR_BUSY = -6,
+    LIBUSB_ERROR_TIMEOUT = -7,
+    LIBUSB_ERROR_OVERFLOW = -8,
+    LIBUSB_ERROR_PIPE = -9,
+    LIBUSB_ERROR_INTERRUPTED = -10,
+    LIBUSB_ERROR_NO_MEM = -11,
+    LIBUSB_ERROR_NOT_SUPPORTED = -12,
+    LIBUSB_ERROR_OTHER = -99
+};
+
 enum libusb_option {
     LIBUSB_OPTION_LOG_LEVEL
 };
 
+enum libusb_transfer_type {
+    LIBUSB_TRANSFER_TYPE_CONTROL = 0,
+    LIBUSB_TRANSFER_TYPE_ISOCHRONOUS = 1,
+    LIBUSB_TRANSFER_TYPE_BULK = 2,
+    LIBUSB_TRANSFER_TYPE_INTERRUPT = 3
+};
+
+// USB 标准请求
+#define LIBUSB_ENDPOINT_IN             0x80
+#define LIBUSB_REQUEST_GET_DESCRIPTOR  0x06
+#define LIBUSB_DT_STRING               0x03
+
+// libusb 热插拔定义
+#define LIBUSB_CAP_HAS_HOTPLUG     0x0001
+#define LIBUSB_HOTPLUG_MATCH_ANY   -1
+typedef int libusb_hotplug_callback_handle;
+typedef enum {
+    LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED = 1,
+    LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT = 2
+} libusb_hotplug_event;
+
 // libusb 回调函数类型定义
 struct libusb_transfer;  // 前向声明
 typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+typedef int (LIBUSB_CALL *libusb_hotplug_callback_fn)(libusb_context *ctx, libusb_device *device,
+                                                      libusb_hotplug_event event, void *user_data);
 
 // libusb 传输结构
+// libusb 等时包描述符
+struct libusb_iso_packet_descriptor {
+    unsigned int length;
+    unsigned int actual_length;
+    enum libusb_transfer_status status;
+};
+
 struct libusb_transfer {
     libusb_device_handle *dev_handle;
     uint8_t flags;
@@ -44,6 +93,8 @@ struct libusb_transfer {
     libusb_transfer_cb_fn callback;
     void *user_data;
     unsigned char *buffer;
+    int num_iso_packets;
+    struct libusb_iso_packet_descriptor iso_packet_desc[];
 };
 
 // libusb 设备描述符
@@ -64,6 +115,54 @@ struct libusb_device_descriptor {
     uint8_t  bNumConfigurations;
 };
 
+// libusb 配置描述符，与libusb.h中的定义一致
+struct libusb_endpoint_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bEndpointAddress;
+    uint8_t  bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t  bInterval;
+    uint8_t  bRefresh;
+    uint8_t  bSynchAddress;
+    const unsigned char *extra;
+    int extra_length;
+};
+
+struct libusb_interface_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bInterfaceNumber;
+    uint8_t  bAlternateSetting;
+    uint8_t  bNumEndpoints;
+    uint8_t  bInterfaceClass;
+    uint8_t  bInterfaceSubClass;
+    uint8_t  bInterfaceProtocol;
+    uint8_t  iInterface;
+    const struct libusb_endpoint_descriptor *endpoint;
+    const unsigned char *extra;
+    int extra_length;
+};
+
+struct libusb_interface {
+    const struct libusb_interface_descriptor *altsetting;
+    int num_altsetting;
+};
+
+struct libusb_config_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint16_t wTotalLength;
+    uint8_t  bNumInterfaces;
+    uint8_t  bConfigurationValue;
+    uint8_t  iConfiguration;
+    uint8_t  bmAttributes;
+    uint8_t  MaxPower;
+    const struct libusb_interface *interface;
+    const unsigned char *extra;
+    int extra_length;
+};
+
 // 定义函数指针类型
 typedef int (LIBUSB_CALL *libusb_init_t)(libusb_context **ctx);
 typedef void (LIBUSB_CALL *libusb_exit_t)(libusb_context *ctx);
@@ -71,13 +170,35 @@ typedef ssize_t (LIBUSB_CALL *libusb_get_device_list_t)(libusb_context *ctx, lib
 typedef void (LIBUSB_CALL *libusb_free_device_list_t)(libusb_device **list, int unref_devices);
 typedef uint8_t (LIBUSB_CALL *libusb_get_bus_number_t)(libusb_device *dev);
 typedef uint8_t (LIBUSB_CALL *libusb_get_device_address_t)(libusb_device *dev);
+typedef int (LIBUSB_CALL *libusb_get_port_numbers_t)(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len);
 typedef int (LIBUSB_CALL *libusb_get_device_descriptor_t)(libusb_device *dev, struct libusb_device_descriptor *desc);
+typedef int (LIBUSB_CALL *libusb_get_config_descriptor_t)(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config);
+typedef void (LIBUSB_CALL *libusb_free_config_descriptor_t)(struct libusb_config_descriptor *config);
+typedef int (LIBUSB_CALL *libusb_get_device_speed_t)(libusb_device *dev);
 typedef int (LIBUSB_CALL *libusb_open_t)(libusb_device *dev, libusb_device_handle **dev_handle);
 typedef void (LIBUSB_CALL *libusb_close_t)(libusb_device_handle *dev_handle);
 typedef int (LIBUSB_CALL *libusb_claim_interface_t)(libusb_device_handle *dev_handle, int interface_number);
 typedef int (LIBUSB_CALL *libusb_release_interface_t)(libusb_device_handle *dev_handle, int interface_number);
-typedef int (LIBUSB_CALL *libusb_get_string_descriptor_ascii_t)(libusb_device_handle *dev_handle, uint8_t desc_index, unsigned char *data, int length);
+typedef int (LIBUSB_CALL *libusb_clear_halt_t)(libusb_device_handle *dev_handle, unsigned char endpoint);
+typedef int (LIBUSB_CALL *libusb_set_interface_alt_setting_t)(libusb_device_handle *dev_handle, int interface_number, int alternate_setting);
+typedef int (LIBUSB_CALL *libusb_control_transfer_t)(libusb_device_handle *dev_handle, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout);
+typedef int (LIBUSB_CALL *libusb_bulk_transfer_t)(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout);
+typedef libusb_device* (LIBUSB_CALL *libusb_get_device_t)(libusb_device_handle *dev_handle);
+typedef int (LIBUSB_CALL *libusb_get_active_config_descriptor_t)(libusb_device *dev, struct libusb_config_descriptor **config);
 typedef int (LIBUSB_CALL *libusb_interrupt_transfer_t)(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout);
+typedef struct libusb_transfer* (LIBUSB_CALL *libusb_alloc_transfer_t)(int iso_packets);
+typedef void (LIBUSB_CALL *libusb_free_transfer_t)(struct libusb_transfer *transfer);
+typedef int (LIBUSB_CALL *libusb_submit_transfer_t)(struct libusb_transfer *transfer);
+typedef int (LIBUSB_CALL *libusb_cancel_transfer_t)(struct libusb_transfer *transfer);
+typedef int (LIBUSB_CALL *libusb_handle_events_timeout_t)(libusb_context *ctx, struct timeval *tv);
+typedef void (LIBUSB_CALL *libusb_interrupt_event_handler_t)(libusb_context *ctx);
+typedef int (LIBUSB_CALL *libusb_has_capability_t)(uint32_t capability);
+typedef int (LIBUSB_CALL *libusb_hotplug_register_callback_t)(libusb_context *ctx, int events, int flags,
+    int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data,
+    libusb_hotplug_callback_handle *callback_handle);
+typedef void (LIBUSB_CALL *libusb_hotplug_deregister_callback_t)(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle);
+typedef unsigned char* (LIBUSB_CALL *libusb_dev_mem_alloc_t)(libusb_device_handle *dev_handle, size_t length);
+typedef int (LIBUSB_CALL *libusb_dev_mem_free_t)(libusb_device_handle *dev_handle, unsigned char *buffer, size_t length);
 
 // 全局变量
 static HMODULE g_hLib = NULL;
@@ -88,24 +209,462 @@ static libusb_get_device_list_t fn_get_device_list;
 static libusb_free_device_list_t fn_free_device_list;
 static libusb_get_bus_number_t fn_get_bus_number;
 static libusb_get_device_address_t fn_get_device_address;
+static libusb_get_port_numbers_t fn_get_port_numbers;  // 可选，libusb 1.0.16+
 static libusb_get_device_descriptor_t fn_get_device_descriptor;
+static libusb_get_config_descriptor_t fn_get_config_descriptor;
+static libusb_free_config_descriptor_t fn_free_config_descriptor;
+static libusb_get_device_speed_t fn_get_device_speed;  // 可选，libusb 1.0.9+
 static libusb_open_t fn_open;
 static libusb_close_t fn_close;
 static libusb_claim_interface_t fn_claim_interface;
 static libusb_release_interface_t fn_release_interface;
-static libusb_get_string_descriptor_ascii_t fn_get_string_descriptor_ascii;
+static libusb_set_interface_alt_setting_t fn_set_interface_alt_setting;
+static libusb_clear_halt_t fn_clear_halt;
+static libusb_control_transfer_t fn_control_transfer;
 static libusb_interrupt_transfer_t fn_interrupt_transfer;
+static libusb_bulk_transfer_t fn_bulk_transfer;
+static libusb_get_device_t fn_get_device;
+static libusb_get_active_config_descriptor_t fn_get_active_config_descriptor;
+static libusb_alloc_transfer_t fn_alloc_transfer;
+static libusb_free_transfer_t fn_free_transfer;
+static libusb_submit_transfer_t fn_submit_transfer;
+static libusb_cancel_transfer_t fn_cancel_transfer;
+static libusb_handle_events_timeout_t fn_handle_events_timeout;
+static libusb_interrupt_event_handler_t fn_interrupt_event_handler;  // 可选，libusb 1.0.21+
+static libusb_has_capability_t fn_has_capability;                    // 可选
+static libusb_hotplug_register_callback_t fn_hotplug_register_callback;      // 可选，libusb 1.0.16+
+static libusb_hotplug_deregister_callback_t fn_hotplug_deregister_callback;  // 可选，libusb 1.0.16+
+static libusb_dev_mem_alloc_t fn_dev_mem_alloc;  // 可选，libusb 1.0.21+，只有Linux usbfs后端能分配成功
+static libusb_dev_mem_free_t fn_dev_mem_free;    // 可选，libusb 1.0.21+
+
+// 事件处理线程
+#define EVENT_POLL_DEFAULT_MS  100
+#define EVENT_POLL_MAX_MS      1000
+static HANDLE g_event_thread = NULL;
+static HANDLE g_event_thread_exited = NULL;  // 线程退出事件循环时置位
+static volatile LONG g_event_thread_stop = 0;
+static volatile LONG g_event_thread_claimed = 0;  // 线程开始运行或停止时放弃了尚未运行的线程，只有一方能置位
+static volatile LONG g_unloading = 0;  // DllMain已开始卸载，持有加载器锁时新线程无法启动
+static volatile LONG g_event_poll_ms = EVENT_POLL_DEFAULT_MS;
+
+// 自动重连
+#define REATTACH_POLL_MS 20  // 有设备等待重连时事件线程查找的间隔，热插拔通知到达时立即查找
+static volatile LONG g_reattach_pending = 0;  // 已断开等待重连的设备数
+
+static int device_cache_refresh(void);
+static int stream_recovery_run(void);
+static void device_reattach_run(void);
+static unsigned short endpoint_max_packet_size(const struct libusb_endpoint_descriptor *endpoint);
+
+// 设备传输参数的默认值，打开设备时未能从配置描述符发现端点时使用
+#define DEFAULT_ENDPOINT         0x81
+#define DEFAULT_OUT_ENDPOINT     0x01
+#define DEFAULT_PACKET_SIZE      64
+#define DEFAULT_TIMEOUT_MS       1000
+#define BULK_DEFAULT_BUFFER_SIZE (64 * 1024)
+#define ISO_DEFAULT_PACKETS      32
+#define MAX_BUFFER_SIZE          (1 << 20)
+
+// 流式传输参数
+#define STREAM_MAX_QUEUE_BYTES   (256u << 20)
+#define STREAM_MAX_TRANSFERS     32
+#define STREAM_DEFAULT_TRANSFERS 4
+#define STREAM_BULK_DEFAULT_TRANSFERS 8
+#define STREAM_DEFAULT_QUEUE     1024
+#define STREAM_DEFAULT_QUEUE_BYTES (16u << 20)
+#define STREAM_MAX_QUEUE         (1 << 20)
+
+// 传输错误恢复参数
+#define RETRY_BACKOFF_MS         1     // 第一次重试立即进行，之后每次等待1、2、4...毫秒
+#define STREAM_MAX_RETRIES       5     // 流传输连续出错的恢复次数，超过后流终止
+#define READ_MAX_RETRIES         3     // 同步读取遇到瞬时错误的重试次数
+
+// 命令通道参数
+#define COMMAND_MAX_TAGS         1024
+#define COMMAND_MAX_LENGTH       4096
+
+// 异步写入参数
+#define WRITE_TRANSFERS          8
+#define WRITE_BULK_BUFFER_SIZE   (16 * 1024)
+
+// 传输和缓冲区池参数
+#define POOL_MAX_TRANSFERS       (STREAM_MAX_TRANSFERS + WRITE_TRANSFERS)
+#define POOL_MAX_BLOCKS          16
+#define POOL_MAX_IDLE_BYTES      (32u << 20)  // 空闲缓冲区超过此大小时释放最大的，默认配置的流可以完整保留
+#define DEVICE_MEMORY_ENV        "USB_API_DEVICE_MEMORY"
+
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED   __attribute__((aligned(CACHE_LINE_SIZE)))
+#define CACHE_LINE_ROUND(n) (((n) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1))
+#define ATOMIC_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// 每个设备的传输和缓冲区池，打开设备时按默认配置预分配，流和写入状态的创建/销毁只在池中取还
+// 池的内容在关闭设备时才释放，重启流、重新配置和重连不必重新向堆申请
+typedef struct {
+    struct libusb_transfer *transfer;
+    int iso_packets;               // 分配时的等时包容量，可用于不超过该数量的传输
+    int in_use;
+} pool_transfer_t;
+
+typedef struct {
+    unsigned char *data;           // 按缓存行对齐
+    size_t size;
+    int in_use;
+    int device_memory;             // 由libusb_dev_mem_alloc分配，内核直接对其DMA，不经过中转缓冲区复制
+    libusb_device_handle *handle;  // 分配设备内存的句柄，重连后旧句柄的块仍用旧句柄释放
+} pool_block_t;
+
+// pool_alloc的内存类型
+#define POOL_HEAP            0     // 普通对齐内存(接收队列等只由CPU访问的数据)
+#define POOL_DEVICE_MEMORY   1     // 传输缓冲区，优先使用设备内存，分配失败时退回对齐内存
+
+typedef struct {
+    SRWLOCK lock;                  // 流和写入状态可能在不同线程中同时创建
+    libusb_device_handle *handle;  // 分配设备内存，重连时换为新句柄，关闭设备前释放池
+    pool_transfer_t transfers[POOL_MAX_TRANSFERS];
+    int num_transfers;
+    pool_block_t blocks[POOL_MAX_BLOCKS];
+    int num_blocks;
+    size_t idle_bytes;             // 未被使用的缓冲区总大小
+    int device_memory_failed;      // 设备内存分配失败过，之后只用普通内存
+    unsigned long long heap_allocations;
+} usb_pool_t;
+
+// 环形缓冲区槽位头，后面紧跟slot_size字节的数据
+typedef struct {
+    unsigned int length;
+    unsigned int flags;             // RING_SLOT_*
+    unsigned long long timestamp_us;
+} ring_slot_t;
+
+#define RING_SLOT_GAP  0x01         // 间隙标记：此处有数据包丢失，标记本身没有数据
+
+// 单生产者/单消费者无锁环形缓冲区
+// 生产者是传输回调(事件线程)，消费者是读取线程，两端各自独占一个缓存行
+typedef struct {
+    // 生产者写
+    CACHE_ALIGNED volatile unsigned int head;
+    unsigned int cached_tail;               // 生产者缓存的tail，仅在看起来已满时重新读取
+    volatile unsigned long long packets;    // 已入队的数据包数
+    volatile unsigned long long overflows;  // 队列满而丢弃的数据包数
+    int gap_pending;                        // 有数据包丢失，下一个数据包入队前先写入间隙标记
+
+    // 消费者写
+    CACHE_ALIGNED volatile unsigned int tail;
+    unsigned int cached_head;               // 消费者缓存的head，仅在看起来为空时重新读取
+    unsigned int read_offset;               // 队首数据包已被字节流读取的字节数
+    volatile LONG waiting;                  // 消费者正在等待data_event
+
+    // 创建后只读
+    CACHE_ALIGNED unsigned int mask;
+    int mark_gaps;                          // 队列满丢弃数据包时写入间隙标记
+    unsigned int slot_size;
+    unsigned int slot_stride;
+    unsigned char *slots;
+} usb_ring_t;
+
+#define RING_SLOT(ring, index) \
+    ((ring_slot_t*)((ring)->slots + (size_t)((index) & (ring)->mask) * (ring)->slot_stride))
+
+// 命令通道：按标签把流上收到的响应交给等待中的命令
+#define COMMAND_FREE     0
+#define COMMAND_PENDING  1
+#define COMMAND_DONE     2
+
+typedef struct {
+    int state;                         // COMMAND_*
+    int result;                        // 响应长度或错误码
+    unsigned char *response;           // 同步等待者的缓冲区
+    int response_size;
+    usb_command_callback_t callback;   // 非NULL表示异步命令
+    void *user_data;
+} command_slot_t;
+
+typedef struct {
+    CRITICAL_SECTION lock;             // 保护槽位，传输回调中也会获取
+    CONDITION_VARIABLE done;           // 有同步命令完成或通道关闭时广播
+    int tag_offset;
+    int tag_size;                      // 1或2字节，小端
+    int num_tags;
+    int next_tag;                      // 轮转分配，超时的标签不会立刻被复用
+    int closing;
+    command_slot_t slots[];
+} usb_commands_t;
+
+struct usb_device;
+
+// 每个设备的流式传输状态
+typedef struct usb_stream {
+    struct libusb_transfer *transfers[STREAM_MAX_TRANSFERS];
+    struct usb_device *device;
+    usb_pool_t *pool;              // 传输、缓冲区和环形缓冲区取自设备的池
+    unsigned char *buffers;        // num_transfers * buffer_stride
+    int num_transfers;
+    int buffer_size;
+    int buffer_stride;             // buffer_size按缓存行取整，每个传输的缓冲区从缓存行边界开始
+    int packet_size;               // 等时传输每个包的大小，非等时为0
+    volatile LONG active;          // 仍在提交中的传输数量
+    volatile LONG refs;            // 在途传输数+1(创建者持有)，降为0时置位idle_event
+    volatile LONG stopping;        // 停止标志，回调中不再重新提交
+    volatile LONG last_error;      // 导致传输终止的错误码
+    volatile LONG reader_busy;     // 环形缓冲区只允许一个读取者
+    HANDLE data_event;             // 消费者等待时有新数据或流终止时置位(自动复位)
+    HANDLE idle_event;             // 所有传输回调都已返回且创建者已释放时置位(手动复位)
+    usb_ring_t *ring;
+    usb_commands_t * volatile commands;  // 命令通道，流销毁时释放
+    usb_data_callback_t data_callback;   // 非NULL时数据直接交给回调，不进入接收队列
+    void *data_user_data;
+    volatile LONG pending[STREAM_MAX_TRANSFERS];  // 回调中或被保持的传输的引用数，降为0时重新提交
+    volatile LONG holds[STREAM_MAX_TRANSFERS];    // 调用者尚未释放的USB_HoldBuffer次数
+    // 出错的传输挂起等待恢复，以下字段除retries外受g_recovery_lock保护
+    unsigned int halted;           // 挂起的传输位图，非0时流在恢复链表中
+    int stalled;                   // 挂起的传输中有端点停止(STALL)，恢复前先清除
+    int halt_error;                // 最近一次挂起的原因，放弃恢复时作为终止原因
+    unsigned int lost;             // 因设备断开挂起的传输位图，自动重连后以新句柄重新提交
+    ULONGLONG retry_at;            // 退避结束时间(GetTickCount64)
+    struct usb_stream *recovery_next;
+    volatile LONG retries;         // 连续恢复次数，有传输成功完成时清零
+    volatile unsigned long long recovered;  // 已自动恢复的出错传输数
+} usb_stream_t;
+
+// 每个设备的异步写入状态
+// 小块写入先合并到一个空闲传输的缓冲区，写满或流水线空闲时提交，其余在下一个传输完成时提交
+typedef struct {
+    struct libusb_transfer *transfers[WRITE_TRANSFERS];
+    struct usb_device *device;     // 每次提交时取设备当前的句柄，重连后自动使用新句柄
+    usb_pool_t *pool;
+    unsigned char *buffers;        // WRITE_TRANSFERS * buffer_stride
+    int buffer_size;               // 每个传输最多合并的字节数
+    int buffer_stride;             // buffer_size按缓存行取整
+    CRITICAL_SECTION lock;         // 保护以下字段，传输回调中也会获取
+    CONDITION_VARIABLE progress;   // 有传输完成或写入被关闭时广播
+    int free_slots[WRITE_TRANSFERS];
+    int num_free;
+    int staging;                   // 正在合并写入的传输下标，-1表示没有
+    int staged;                    // staging中已合并的字节数
+    int inflight;                  // 已提交未完成的传输数
+    unsigned long long queued;     // 已接受的字节总数
+    unsigned long long completed;  // 已完成(无论成功与否)的字节总数
+    int last_error;                // 尚未报告给调用者的传输错误
+    int closing;
+    volatile LONG refs;            // 在途传输数+1(创建者持有)，降为0时置位idle_event
+    HANDLE idle_event;
+} usb_writer_t;
+
+// 预读模式
+#define PREFETCH_OFF     0
+#define PREFETCH_SHARED  1         // 使用调用者已启动的流，关闭预读时保留
+#define PREFETCH_OWNED   2         // 开启预读时启动的流，关闭预读时停止
+
+// 设备的传输参数，由USB_ConfigureDevice设置
+typedef struct {
+    unsigned char endpoint;        // 读取和流式传输使用的IN端点
+    unsigned char type;            // LIBUSB_TRANSFER_TYPE_*
+    unsigned char alt_setting;     // 端点所在的接口0备用设置
+    int buffer_size;               // 流式传输每个传输的缓冲区大小
+    int packet_size;               // 等时传输每个包的大小，buffer_size是它的整数倍
+    unsigned int timeout_ms;       // 同步读取超时
+} device_config_t;
 
 // 设备句柄映射表
-#define MAX_DEVICES 16
-static struct {
+// 表项单独分配且在DLL卸载前不释放，关闭的表项放入空闲链表复用，因此表项指针始终有效
+//
+// 并发规则：
+// - 打开/关闭设备修改映射表时持有g_registry_lock，枚举设备等耗时操作不持锁
+// - 按句柄查找完全无锁；按序列号查找使用顺序锁(g_serial_seq)，写者只在插入/删除的瞬间持有
+// - 映射表和哈希表扩容后旧数组放入回收列表，DLL卸载时才释放，无锁读取者不会访问已释放内存
+// - 使用handle/stream的操作持有表项io_lock共享锁，关闭设备和替换stream时持独占锁
+typedef struct usb_device {
     char serial[64];
-    libusb_device_handle *handle;
-    int in_use;
-} g_device_map[MAX_DEVICES];
+    unsigned int serial_hash;
+    libusb_device_handle * volatile handle;  // 自动重连时在事件线程中替换，替换下的旧句柄放入retired
+    usb_stream_t *stream;
+    usb_stream_t *draining;            // 正在销毁的流，其中保持的缓冲区仍可释放
+    usb_writer_t * volatile writer;    // 第一次写入时创建
+    volatile unsigned int generation;  // 每次关闭后递增，使旧的整数句柄失效
+    volatile LONG in_use;
+    int closing;                       // 正在关闭，受g_registry_lock保护
+    int index;                         // 在映射表中的下标
+    int next_free;                     // 空闲链表中下一个表项的下标
+    SRWLOCK io_lock;
+    CRITICAL_SECTION control_lock;     // 串行化同一设备的启动/停止流、配置和关闭
+    CRITICAL_SECTION read_lock;        // 预读模式下串行化USB_ReadData，接收队列只允许一个读取者
+    usb_endpoint_info_t endpoints[USB_MAX_ENDPOINTS];  // 打开时从接口0各备用设置中发现的端点
+    int num_endpoints;
+    device_config_t config;            // 修改时同时持有control_lock和io_lock独占锁
+    unsigned char alt_setting;         // 接口0当前的备用设置，修改规则同config
+    usb_pool_t pool;                   // 流和写入状态使用的传输和缓冲区
+    volatile LONG prefetch;            // PREFETCH_*，USB_ReadData从流接收队列读取，修改时持有control_lock
+    usb_data_callback_t data_callback; // 流数据回调，启动流时复制到流中，受control_lock保护
+    void *data_user_data;
+    // 自动重连，开关和句柄替换受control_lock保护
+    volatile LONG reattach;            // 断开后等待同一序列号的设备重新出现
+    volatile LONG lost;                // 已断开，等待事件线程重连
+    unsigned long long lost_at_us;     // 检测到断开的时间
+    libusb_device_handle **retired;    // 重连替换下的旧句柄，同步读取可能仍在使用，持有io_lock独占锁时关闭
+    int num_retired;
+    volatile LONG disconnects;
+    volatile LONG reattaches;
+    unsigned long long downtime_us;
+    unsigned long long last_downtime_us;
+    volatile unsigned long long lost_transfers;
+    volatile unsigned long long lost_write_bytes;
+} usb_device_t;
+
+// 整数设备句柄：低16位为映射表下标+1，其上15位为代数，保证句柄总是正数
+#define DEVICE_HANDLE_INDEX_BITS 16
+#define DEVICE_HANDLE_INDEX_MASK ((1 << DEVICE_HANDLE_INDEX_BITS) - 1)
+#define DEVICE_HANDLE_GEN_MASK   0x7FFF
+#define MAX_DEVICES              DEVICE_HANDLE_INDEX_MASK
+
+static SRWLOCK g_registry_lock = SRWLOCK_INIT;
+static usb_device_t ** volatile g_device_map = NULL;  // 稠密数组，按句柄中的下标直接访问
+static volatile LONG g_device_count = 0;              // 已分配的表项数
+static int g_device_capacity = 0;
+static int g_device_live = 0;                         // 在用的表项数
+static int g_device_free = -1;                        // 空闲链表头
+
+// 序列号 -> 下标的开放寻址哈希表(线性探测)，供序列号接口使用
+#define SERIAL_SLOT_EMPTY    -1
+#define SERIAL_SLOT_DELETED  -2
+typedef struct {
+    unsigned int mask;
+    int used;                          // 包含已删除标记的占用槽位数
+    int slots[];
+} serial_index_t;
+static serial_index_t * volatile g_serial_index = NULL;
+static volatile LONG g_serial_seq = 0;  // 顺序锁，写者修改哈希表期间为奇数
+
+// 扩容后被替换的旧数组，DLL卸载时统一释放
+static void **g_retired = NULL;
+static int g_retired_count = 0;
+static int g_retired_capacity = 0;
+
+// 设备过滤表：USB_SetDeviceFilter设置的匹配条件编译成按键排序的数组，枚举时二分查找
+// 未设置时只匹配VENDOR_ID/PRODUCT_ID；替换后的旧表放入回收列表，读取者无锁
+#define FILTER_KIND_EXACT    0  // 指定VID和PID
+#define FILTER_KIND_VENDOR   1  // 指定VID，任意PID
+#define FILTER_KIND_PRODUCT  2  // 指定PID，任意VID
+#define FILTER_KIND_ANY      3  // 任意VID和PID
+#define MAX_DEVICE_FILTERS   4096
+
+typedef struct {
+    uint64_t key;          // (类型 << 32) | (VID << 16) | PID，通配部分为0
+    uint32_t classes[8];   // 允许的bDeviceClass位图
+} filter_entry_t;
+
+typedef struct {
+    int count;
+    unsigned int kinds;    // 表中出现的类型位图，查找时跳过不存在的类型
+    filter_entry_t entries[];
+} device_filter_t;
+
+static device_filter_t * volatile g_device_filter = NULL;
+
+// 设备位置缓存：序列号 -> 总线号/端口路径
+// 由USB_ScanDevice和打开设备时读到的序列号填充，打开已知设备时只需一次libusb_open
+typedef struct {
+    uint8_t bus;
+    uint8_t address;
+    uint8_t depth;                     // 端口路径长度，为0时libusb不支持端口路径，按设备地址匹配
+    uint8_t ports[USB_MAX_PORT_DEPTH];
+} device_location_t;
+
+typedef struct {
+    char serial[64];
+    device_location_t location;
+} location_entry_t;
+
+static SRWLOCK g_location_lock = SRWLOCK_INIT;
+static location_entry_t *g_locations = NULL;
+static int g_location_count = 0;
+static int g_location_capacity = 0;
+
+// 序列号磁盘缓存：进程冷启动时按端口路径和设备描述符直接得到序列号，不必打开设备
+// 文件由多个进程共享映射且不加锁，读取时用校验和检测并发写入造成的不一致，不一致时忽略整个文件
+// 路径可由环境变量USB_API_SERIAL_CACHE指定，设为空字符串时禁用
+#define DISK_CACHE_MAGIC    0x31435355  // "USC1"
+#define DISK_CACHE_ENTRIES  256
+#define DISK_CACHE_ENV      "USB_API_SERIAL_CACHE"
+#define DISK_CACHE_FILE     "usb_api_serials.bin"
+
+typedef struct {
+    uint8_t  bus;
+    uint8_t  depth;
+    uint8_t  ports[USB_MAX_PORT_DEPTH];
+    uint8_t  reserved;
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+    uint16_t reserved2;
+    char     serial[64];
+} disk_cache_entry_t;
+
+#define DISK_CACHE_KEY_SIZE offsetof(disk_cache_entry_t, serial)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t topology;   // 所有匹配设备键的哈希之和，拓扑变化时整个缓存作废
+    uint32_t checksum;   // 前count个表项的FNV-1a哈希
+    disk_cache_entry_t entries[DISK_CACHE_ENTRIES];
+} disk_cache_t;
+
+// 以下变量只由持有g_cache_refresh_lock的线程访问
+static HANDLE g_disk_cache_file = INVALID_HANDLE_VALUE;
+static HANDLE g_disk_cache_mapping = NULL;
+static disk_cache_t *g_disk_cache = NULL;     // 文件映射视图
+static int g_disk_cache_opened = 0;           // 已尝试打开文件
+static uint32_t g_disk_cache_topology = 0;    // 文件中记录的拓扑哈希
+
+// 读取序列号的参数：每个设备的描述符请求单独计时，慢设备不会拖住整个扫描
+#define SERIAL_READ_TIMEOUT_MS  500
+#define SERIAL_FETCH_WORKERS    8
+
+// 设备缓存：首次扫描时填充，之后由热插拔事件增量更新，扫描直接从内存返回
+// libusb不支持热插拔时(如Windows)，每次扫描只比较设备列表，仅打开新出现的设备读取序列号
+// 打不开的设备(如被其他进程占用的WinUSB设备)以空序列号加入缓存，之后每次有设备插拔时重试一次
+#define CACHE_POLL_MS 1000  // 不支持热插拔且注册了变化回调时，事件线程比较设备列表的间隔
+typedef struct {
+    device_info_ex_t info;
+    device_location_t location;
+    unsigned long long version;   // 到达时的拓扑版本
+} cached_device_t;
+
+// 离开设备的变化日志，供USB_ScanChanges增量返回
+#define CHANGE_LOG_SIZE 256
+typedef struct {
+    device_info_t info;
+    unsigned long long arrived;   // 到达时的拓扑版本
+    unsigned long long departed;  // 离开时的拓扑版本
+} change_log_entry_t;
+
+static SRWLOCK g_cache_lock = SRWLOCK_INIT;          // 保护缓存内容
+static SRWLOCK g_cache_refresh_lock = SRWLOCK_INIT;  // 同一时刻只有一个线程刷新缓存
+static cached_device_t *g_cache = NULL;
+static int g_cache_count = 0;
+static int g_cache_capacity = 0;
+static volatile LONG g_cache_valid = 0;       // 已完成首次填充
+static volatile LONG g_cache_dirty = 0;       // 收到热插拔事件，缓存需要刷新
+static uint32_t g_cache_enumeration = 0;      // 上次刷新时目标设备位置(含地址)的哈希，只由持有g_cache_refresh_lock的线程访问
+static volatile LONG g_hotplug_registered = 0;
+static libusb_hotplug_callback_handle g_hotplug_handle;
+static volatile LONG g_cache_tracking = 0;    // 有调用者跟踪变化，不支持热插拔时由事件线程定期刷新
+
+// 拓扑版本：每个设备到达或离开时加1，受g_cache_lock保护
+static unsigned long long g_topology_version = 0;
+static change_log_entry_t g_change_log[CHANGE_LOG_SIZE];
+static unsigned long long g_change_log_count = 0;  // 累计写入的日志条数
+static unsigned long long g_change_log_floor = 0;  // 早于此版本的离开记录已被覆盖
+
+// 设备变化通知回调
+static SRWLOCK g_notify_lock = SRWLOCK_INIT;
+static usb_device_change_callback_t volatile g_change_callback = NULL;
+static void *g_change_user_data = NULL;
 
 // 初始化标志
-static int g_initialized = 0;
+static volatile LONG g_initialized = 0;
 
 // 内部函数：加载USB函数
 static int load_usb_functions(void) {
@@ -127,175 +686,3713 @@ static int load_usb_functions(void) {
     LOAD_FUNC(fn_get_bus_number, "libusb_get_bus_number");
     LOAD_FUNC(fn_get_device_address, "libusb_get_device_address");
     LOAD_FUNC(fn_get_device_descriptor, "libusb_get_device_descriptor");
+    LOAD_FUNC(fn_get_config_descriptor, "libusb_get_config_descriptor");
+    LOAD_FUNC(fn_free_config_descriptor, "libusb_free_config_descriptor");
     LOAD_FUNC(fn_open, "libusb_open");
     LOAD_FUNC(fn_close, "libusb_close");
     LOAD_FUNC(fn_claim_interface, "libusb_claim_interface");
     LOAD_FUNC(fn_release_interface, "libusb_release_interface");
-    LOAD_FUNC(fn_get_string_descriptor_ascii, "libusb_get_string_descriptor_ascii");
+    LOAD_FUNC(fn_control_transfer, "libusb_control_transfer");
     LOAD_FUNC(fn_interrupt_transfer, "libusb_interrupt_transfer");
+    LOAD_FUNC(fn_set_interface_alt_setting, "libusb_set_interface_alt_setting");
+    LOAD_FUNC(fn_clear_halt, "libusb_clear_halt");
+    LOAD_FUNC(fn_bulk_transfer, "libusb_bulk_transfer");
+    LOAD_FUNC(fn_get_device, "libusb_get_device");
+    LOAD_FUNC(fn_get_active_config_descriptor, "libusb_get_active_config_descriptor");
+    LOAD_FUNC(fn_alloc_transfer, "libusb_alloc_transfer");
+    LOAD_FUNC(fn_free_transfer, "libusb_free_transfer");
+    LOAD_FUNC(fn_submit_transfer, "libusb_submit_transfer");
+    LOAD_FUNC(fn_cancel_transfer, "libusb_cancel_transfer");
+    LOAD_FUNC(fn_handle_events_timeout, "libusb_handle_events_timeout");
+
+    // 可选函数，旧版本libusb中不存在时保持为NULL
+    fn_interrupt_event_handler = (typeof(fn_interrupt_event_handler))GetProcAddress(g_hLib, "libusb_interrupt_event_handler");
+    fn_get_port_numbers = (typeof(fn_get_port_numbers))GetProcAddress(g_hLib, "libusb_get_port_numbers");
+    fn_get_device_speed = (typeof(fn_get_device_speed))GetProcAddress(g_hLib, "libusb_get_device_speed");
+    fn_has_capability = (typeof(fn_has_capability))GetProcAddress(g_hLib, "libusb_has_capability");
+    fn_hotplug_register_callback = (typeof(fn_hotplug_register_callback))GetProcAddress(g_hLib, "libusb_hotplug_register_callback");
+    fn_hotplug_deregister_callback = (typeof(fn_hotplug_deregister_callback))GetProcAddress(g_hLib, "libusb_hotplug_deregister_callback");
+    fn_dev_mem_alloc = (typeof(fn_dev_mem_alloc))GetProcAddress(g_hLib, "libusb_dev_mem_alloc");
+    fn_dev_mem_free = (typeof(fn_dev_mem_free))GetProcAddress(g_hLib, "libusb_dev_mem_free");
+
+    // 环境变量为0时不使用设备内存，便于对比两种缓冲区的CPU占用
+    const char *device_memory = getenv(DEVICE_MEMORY_ENV);
+    if (!fn_dev_mem_free || (device_memory && strcmp(device_memory, "0") == 0)) fn_dev_mem_alloc = NULL;
 
     return USB_SUCCESS;
 }
 
+// 内部函数：把API的timeout_ms参数换算为截止时间，0(或负数)表示不等待，只检查一次当前状态
+static ULONGLONG timeout_deadline(int timeout_ms) {
+    return GetTickCount64() + (timeout_ms > 0 ? timeout_ms : 0);
+}
+
+// 内部函数：处理一次libusb事件，最多等待timeout_ms毫秒
+// 传输回调中挂起的出错流传输在这里恢复，等待退避的流使等待提前结束
+static void pump_usb_events(int timeout_ms) {
+    int due = stream_recovery_run();
+    if (due < timeout_ms) timeout_ms = due;
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    fn_handle_events_timeout(g_ctx, &tv);
+    stream_recovery_run();
+}
+
+// 内部函数：获取单调递增的微秒时间戳
+static unsigned long long usb_timestamp_us(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER counter;
+
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)(counter.QuadPart / freq.QuadPart) * 1000000ULL +
+           (unsigned long long)(counter.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart;
+}
+
+// 内部函数：事件处理线程，使异步传输无需调用者驱动即可完成
+static DWORD WINAPI event_thread_proc(LPVOID param) {
+    (void)param;
+    // 卸载时线程可能还在等待加载器锁，此时已被放弃，libusb状态可能已经释放
+    if (InterlockedExchange(&g_event_thread_claimed, 1) != 0) return 0;
+
+    ULONGLONG next_poll = 0;
+    ULONGLONG next_reattach = 0;
+    while (!g_event_thread_stop) {
+        int poll_ms = g_event_poll_ms;
+        if (g_reattach_pending && poll_ms > REATTACH_POLL_MS) poll_ms = REATTACH_POLL_MS;
+        pump_usb_events(poll_ms);
+
+        // 在刷新缓存清除标记之前查看热插拔通知，设备重新出现时立即重连
+        if (g_reattach_pending && !g_event_thread_stop && (g_cache_dirty || GetTickCount64() >= next_reattach)) {
+            device_reattach_run();
+            next_reattach = GetTickCount64() + REATTACH_POLL_MS;
+        }
+
+        // 热插拔回调中不能进行同步IO，只标记缓存过期，在这里读取新设备的序列号
+        int poll = !g_hotplug_registered && (g_change_callback || g_cache_tracking) && GetTickCount64() >= next_poll;
+        if ((g_cache_dirty || poll) && !g_event_thread_stop) {
+            device_cache_refresh();
+            next_poll = GetTickCount64() + CACHE_POLL_MS;
+        }
+    }
+    SetEvent(g_event_thread_exited);
+    return 0;
+}
+
+// 内部函数：启动事件处理线程
+static void start_event_thread(void) {
+    if (g_event_thread) return;
+
+    g_event_thread_stop = 0;
+    g_event_thread_claimed = 0;
+    g_event_thread_exited = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!g_event_thread_exited) return;
+
+    g_event_thread = CreateThread(NULL, 0, event_thread_proc, NULL, 0, NULL);
+    if (!g_event_thread) {
+        CloseHandle(g_event_thread_exited);
+        g_event_thread_exited = NULL;
+    }
+}
+
+// 内部函数：停止事件处理线程
+// 等待的是线程自己置位的退出事件而不是线程句柄，因为在DllMain中线程真正结束需要加载器锁
+// 线程退出前不能释放libusb状态，因此不设超时；每轮重新打断一次，避免错过线程进入事件处理的时机
+// 线程尚未开始运行时(创建后立即卸载，线程在等待加载器锁)直接放弃它，它开始运行后立即返回
+static void stop_event_thread(int process_terminating) {
+    if (!g_event_thread) return;
+
+    InterlockedExchange(&g_event_thread_stop, 1);
+    if (!process_terminating && InterlockedExchange(&g_event_thread_claimed, 1) != 0) {
+        do {
+            if (fn_interrupt_event_handler) fn_interrupt_event_handler(g_ctx);
+        } while (WaitForSingleObject(g_event_thread_exited, EVENT_POLL_MAX_MS) != WAIT_OBJECT_0);
+    }
+
+    CloseHandle(g_event_thread);
+    CloseHandle(g_event_thread_exited);
+    g_event_thread = NULL;
+    g_event_thread_exited = NULL;
+}
+
+// 内部函数：热插拔回调，在事件线程中调用
+static int LIBUSB_CALL hotplug_callback(libusb_context *ctx, libusb_device *device,
+                                        libusb_hotplug_event event, void *user_data) {
+    (void)ctx; (void)device; (void)event; (void)user_data;
+    InterlockedExchange(&g_cache_dirty, 1);
+    return 0;
+}
+
 // 内部函数：初始化USB系统
 static int initialize_usb(void) {
-    if (g_initialized) return USB_SUCCESS;
+    if (ATOMIC_LOAD(&g_initialized)) return USB_SUCCESS;
 
-    int result = load_usb_functions();
-    if (result != USB_SUCCESS) return result;
+    AcquireSRWLockExclusive(&g_registry_lock);
+    int result = USB_SUCCESS;
+    if (!g_initialized) {
+        result = load_usb_functions();
+        if (result == USB_SUCCESS && fn_init(&g_ctx) < 0) result = USB_ERROR_IO;
+        if (result == USB_SUCCESS) {
+            start_event_thread();
+            // 热插拔回调只在处理事件时调用，必须有事件线程才能及时更新缓存
+            // 设备过滤表可在运行时改变，因此接收所有设备的事件，由刷新缓存时的过滤表筛选
+            if (g_event_thread && fn_has_capability && fn_hotplug_register_callback &&
+                fn_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+                fn_hotplug_register_callback(g_ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                             0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                             hotplug_callback, NULL, &g_hotplug_handle) == 0) {
+                g_hotplug_registered = 1;
+            }
+            ATOMIC_STORE(&g_initialized, 1);
+        }
+    }
+    ReleaseSRWLockExclusive(&g_registry_lock);
+
+    return result;
+}
+
+// 内部函数：计算序列号的FNV-1a哈希
+static unsigned int serial_hash(const char* serial) {
+    unsigned int hash = 2166136261u;
+    while (*serial) {
+        hash ^= (unsigned char)*serial++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 内部函数(写者)：把扩容前的旧数组放入回收列表，申请失败时宁可泄漏也不释放
+static void retire_memory(void *ptr) {
+    if (!ptr) return;
+    if (g_retired_count == g_retired_capacity) {
+        int capacity = g_retired_capacity ? g_retired_capacity * 2 : 8;
+        void **list = (void**)realloc(g_retired, sizeof(void*) * capacity);
+        if (!list) return;
+        g_retired = list;
+        g_retired_capacity = capacity;
+    }
+    g_retired[g_retired_count++] = ptr;
+}
+
+// 内部函数(写者)：开始/结束修改序列号哈希表
+static void serial_write_begin(void) {
+    __atomic_store_n(&g_serial_seq, g_serial_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void serial_write_end(void) {
+    __atomic_store_n(&g_serial_seq, g_serial_seq + 1, __ATOMIC_RELEASE);
+}
+
+// 内部函数：在哈希表中探测序列号，结果需由调用者用顺序锁验证
+static int serial_index_probe(const char* serial, unsigned int hash) {
+    serial_index_t *table = ATOMIC_LOAD(&g_serial_index);
+    if (!table) return -1;
+    LONG count = ATOMIC_LOAD(&g_device_count);
+    usb_device_t **map = ATOMIC_LOAD(&g_device_map);
+
+    unsigned int i = hash & table->mask;
+    for (unsigned int n = 0; n <= table->mask; n++, i = (i + 1) & table->mask) {
+        int index = __atomic_load_n(&table->slots[i], __ATOMIC_RELAXED);
+        if (index == SERIAL_SLOT_EMPTY) return -1;
+        if (index >= 0 && index < count && map[index]->serial_hash == hash &&
+            strcmp(map[index]->serial, serial) == 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// 内部函数：查找设备映射表项，不加锁，与写者冲突时重试
+static int find_device_index(const char* serial) {
+    unsigned int hash = serial_hash(serial);
+
+    for (;;) {
+        LONG seq = ATOMIC_LOAD(&g_serial_seq);
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+        int index = serial_index_probe(serial, hash);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g_serial_seq, __ATOMIC_RELAXED) == seq) return index;
+    }
+}
 
-    result = fn_init(&g_ctx);
-    if (result < 0) return USB_ERROR_IO;
+// 内部函数(写者)：重建序列号哈希表，容量保持为在用表项数的4倍以上，同时清除删除标记
+static int serial_index_rebuild(int live) {
+    unsigned int size = 16;
+    while (size < (unsigned int)live * 4) size <<= 1;
 
-    memset(g_device_map, 0, sizeof(g_device_map));
-    g_initialized = 1;
+    serial_index_t *table = (serial_index_t*)malloc(sizeof(serial_index_t) + sizeof(int) * size);
+    if (!table) return USB_ERROR_NO_MEM;
+    table->mask = size - 1;
+    table->used = 0;
+    for (unsigned int i = 0; i < size; i++) table->slots[i] = SERIAL_SLOT_EMPTY;
+
+    for (int index = 0; index < g_device_count; index++) {
+        usb_device_t *device = g_device_map[index];
+        if (!device->in_use || device->closing) continue;
+        unsigned int i = device->serial_hash & table->mask;
+        while (table->slots[i] != SERIAL_SLOT_EMPTY) i = (i + 1) & table->mask;
+        table->slots[i] = index;
+        table->used++;
+    }
 
+    retire_memory(g_serial_index);
+    ATOMIC_STORE(&g_serial_index, table);
     return USB_SUCCESS;
 }
 
-// 内部函数：查找设备映射
-static libusb_device_handle* find_device_handle(const char* serial) {
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_device_map[i].in_use && strcmp(g_device_map[i].serial, serial) == 0) {
-            return g_device_map[i].handle;
+// 内部函数(写者)：从序列号哈希表中删除表项
+static void serial_index_remove(usb_device_t *device) {
+    serial_index_t *table = g_serial_index;
+
+    for (unsigned int i = device->serial_hash & table->mask; ; i = (i + 1) & table->mask) {
+        if (table->slots[i] == device->index) {
+            __atomic_store_n(&table->slots[i], SERIAL_SLOT_DELETED, __ATOMIC_RELAXED);
+            return;
         }
     }
+}
+
+// 内部函数(写者)：获取一个空闲表项，必要时扩充映射表
+static int device_table_alloc(void) {
+    if (g_device_free >= 0) {
+        int index = g_device_free;
+        g_device_free = g_device_map[index]->next_free;
+        return index;
+    }
+    if (g_device_count >= MAX_DEVICES) return USB_ERROR_NO_MEM;
+
+    if (g_device_count == g_device_capacity) {
+        int capacity = g_device_capacity ? g_device_capacity * 2 : 16;
+        usb_device_t **map = (usb_device_t**)malloc(sizeof(usb_device_t*) * capacity);
+        if (!map) return USB_ERROR_NO_MEM;
+        if (g_device_count) memcpy(map, g_device_map, sizeof(usb_device_t*) * g_device_count);
+        retire_memory(g_device_map);
+        ATOMIC_STORE(&g_device_map, map);
+        g_device_capacity = capacity;
+    }
+
+    usb_device_t *device = (usb_device_t*)calloc(1, sizeof(usb_device_t));
+    if (!device) return USB_ERROR_NO_MEM;
+    device->index = g_device_count;
+    InitializeSRWLock(&device->io_lock);
+    InitializeCriticalSection(&device->control_lock);
+    InitializeCriticalSection(&device->read_lock);
+
+    // 先写入表项再发布新的数量，无锁读取者看到的下标总是有效的
+    g_device_map[g_device_count] = device;
+    ATOMIC_STORE(&g_device_count, g_device_count + 1);
+    return device->index;
+}
+
+// 内部函数：释放整个映射表
+static void device_table_free(void) {
+    for (int i = 0; i < g_device_count; i++) {
+        DeleteCriticalSection(&g_device_map[i]->control_lock);
+        DeleteCriticalSection(&g_device_map[i]->read_lock);
+        free(g_device_map[i]);
+    }
+    for (int i = 0; i < g_retired_count; i++) free(g_retired[i]);
+    free(g_retired);
+    free(g_device_map);
+    free(g_serial_index);
+    g_retired = NULL;
+    g_retired_count = 0;
+    g_retired_capacity = 0;
+    g_device_map = NULL;
+    g_serial_index = NULL;
+    g_device_capacity = 0;
+    g_device_count = 0;
+    g_device_live = 0;
+    g_device_free = -1;
+}
+
+// 内部函数：由映射表下标生成整数句柄
+static int make_device_handle(usb_device_t *device) {
+    return (int)((device->generation & DEVICE_HANDLE_GEN_MASK) << DEVICE_HANDLE_INDEX_BITS) | (device->index + 1);
+}
+
+// 内部函数：按序列号查找已打开设备的整数句柄，未找到返回0
+static int find_device_handle(const char* serial) {
+    int index = find_device_index(serial);
+    return index >= 0 ? make_device_handle(ATOMIC_LOAD(&g_device_map)[index]) : 0;
+}
+
+// 内部函数：解析整数句柄，不加锁，句柄无效或已过期返回NULL
+static usb_device_t* resolve_device(int handle) {
+    int index = (handle & DEVICE_HANDLE_INDEX_MASK) - 1;
+    if (handle <= 0 || index < 0 || index >= ATOMIC_LOAD(&g_device_count)) return NULL;
+
+    usb_device_t *device = ATOMIC_LOAD(&g_device_map)[index];
+    if (!ATOMIC_LOAD(&device->in_use)) return NULL;
+    if ((ATOMIC_LOAD(&device->generation) & DEVICE_HANDLE_GEN_MASK) != ((unsigned int)handle >> DEVICE_HANDLE_INDEX_BITS)) return NULL;
+    return device;
+}
+
+// 内部函数：解析句柄并持有io_lock共享锁，保证使用期间设备不会被关闭，成功后须调用device_release
+static usb_device_t* device_acquire(int handle) {
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return NULL;
+
+    AcquireSRWLockShared(&device->io_lock);
+    if (resolve_device(handle) != device) {
+        ReleaseSRWLockShared(&device->io_lock);
+        return NULL;
+    }
+    return device;
+}
+
+static void device_release(usb_device_t *device) {
+    ReleaseSRWLockShared(&device->io_lock);
+}
+
+// 内部函数：查找已发现的端点
+static const usb_endpoint_info_t* find_endpoint(const usb_device_t *device, unsigned char address) {
+    for (int i = 0; i < device->num_endpoints; i++) {
+        if (device->endpoints[i].address == address) return &device->endpoints[i];
+    }
     return NULL;
 }
 
-// 内部函数：添加设备映射
-static int add_device_mapping(const char* serial, libusb_device_handle* handle) {
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (!g_device_map[i].in_use) {
-            strncpy(g_device_map[i].serial, serial, sizeof(g_device_map[i].serial) - 1);
-            g_device_map[i].handle = handle;
-            g_device_map[i].in_use = 1;
-            return USB_SUCCESS;
+// 内部函数：端点的默认传输大小，批量端点使用大缓冲区以减少每个传输的开销
+static int default_buffer_size(const usb_endpoint_info_t *endpoint) {
+    if (endpoint->transfer_type == LIBUSB_TRANSFER_TYPE_BULK) return BULK_DEFAULT_BUFFER_SIZE;
+    if (endpoint->transfer_type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) return ISO_DEFAULT_PACKETS * endpoint->max_packet_size;
+    return endpoint->max_packet_size ? endpoint->max_packet_size : DEFAULT_PACKET_SIZE;
+}
+
+// 内部函数：默认使用第一个中断或批量IN端点，没有发现端点时使用0x81上64字节的中断传输
+static void device_default_config(const usb_device_t *device, device_config_t *config) {
+    config->endpoint = DEFAULT_ENDPOINT;
+    config->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+    config->alt_setting = 0;
+    config->buffer_size = DEFAULT_PACKET_SIZE;
+    config->packet_size = 0;
+    config->timeout_ms = DEFAULT_TIMEOUT_MS;
+    for (int i = 0; i < device->num_endpoints; i++) {
+        const usb_endpoint_info_t *endpoint = &device->endpoints[i];
+        if ((endpoint->address & LIBUSB_ENDPOINT_IN) && endpoint->alt_setting == 0 &&
+            (endpoint->transfer_type == LIBUSB_TRANSFER_TYPE_INTERRUPT || endpoint->transfer_type == LIBUSB_TRANSFER_TYPE_BULK)) {
+            config->endpoint = endpoint->address;
+            config->type = endpoint->transfer_type;
+            config->buffer_size = default_buffer_size(endpoint);
+            break;
         }
     }
-    return USB_ERROR_NO_MEM;
 }
 
-// 内部函数：移除设备映射
-static void remove_device_mapping(const char* serial) {
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_device_map[i].in_use && strcmp(g_device_map[i].serial, serial) == 0) {
-            g_device_map[i].in_use = 0;
-            break;
+// 内部函数：从活动配置中解析接口0所有备用设置的端点，等时端点通常只出现在非0的备用设置中
+static int discover_endpoints(libusb_device_handle *handle, usb_endpoint_info_t *endpoints) {
+    libusb_device *device = fn_get_device(handle);
+    struct libusb_config_descriptor *config;
+    if (fn_get_active_config_descriptor(device, &config) != 0 &&
+        fn_get_config_descriptor(device, 0, &config) != 0) {
+        return 0;
+    }
+
+    int count = 0;
+    for (int a = 0; config->bNumInterfaces > 0 && a < config->interface[0].num_altsetting; a++) {
+        const struct libusb_interface_descriptor *altsetting = &config->interface[0].altsetting[a];
+        for (int i = 0; i < altsetting->bNumEndpoints && count < USB_MAX_ENDPOINTS; i++) {
+            const struct libusb_endpoint_descriptor *endpoint = &altsetting->endpoint[i];
+            endpoints[count].address = endpoint->bEndpointAddress;
+            endpoints[count].transfer_type = endpoint->bmAttributes & 0x03;
+            endpoints[count].max_packet_size = endpoint_max_packet_size(endpoint);
+            endpoints[count].interval = endpoint->bInterval;
+            endpoints[count].alt_setting = altsetting->bAlternateSetting;
+            count++;
         }
     }
+    fn_free_config_descriptor(config);
+    return count;
 }
 
-// 导出函数实现
-USB_API int USB_ScanDevice(device_info_t* devices, int max_devices) {
-    if (!devices || max_devices <= 0) return USB_ERROR_INVALID;
+// 内部函数：添加设备映射，成功返回整数句柄，序列号已被打开返回USB_ERROR_BUSY
+static int add_device_mapping(const char* serial, libusb_device_handle* handle,
+                              const usb_endpoint_info_t *endpoints, int num_endpoints) {
+    int result;
 
-    int result = initialize_usb();
-    if (result != USB_SUCCESS) return result;
+    AcquireSRWLockExclusive(&g_registry_lock);
+    if (find_device_index(serial) >= 0) {
+        result = USB_ERROR_BUSY;
+        goto out;
+    }
 
-    libusb_device **list;
-    ssize_t count = fn_get_device_list(g_ctx, &list);
-    if (count < 0) return USB_ERROR_IO;
+    // 占用率(含删除标记)超过一半时重建哈希表
+    serial_index_t *table = g_serial_index;
+    if (!table || (unsigned int)(table->used + 1) * 2 > table->mask + 1) {
+        if (serial_index_rebuild(g_device_live + 1) != USB_SUCCESS) {
+            result = USB_ERROR_NO_MEM;
+            goto out;
+        }
+        table = g_serial_index;
+    }
 
-    int found = 0;
-    for (ssize_t i = 0; i < count && found < max_devices; i++) {
-        libusb_device *device = list[i];
-        struct libusb_device_descriptor desc;
-        
-        if (fn_get_device_descriptor(device, &desc) < 0) continue;
-
-        // 只处理指定 VID/PID 的设备
-        if (desc.idVendor != VENDOR_ID || desc.idProduct != PRODUCT_ID) continue;
-
-        // 获取设备基本信息
-        devices[found].vid = desc.idVendor;
-        devices[found].pid = desc.idProduct;
-        devices[found].bus_number = fn_get_bus_number(device);
-        devices[found].device_address = fn_get_device_address(device);
-
-        // 获取序列号
-        libusb_device_handle *handle;
-        if (fn_open(device, &handle) == 0) {
-            unsigned char serial[64];
-            if (fn_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial)) > 0) {
-                strncpy(devices[found].serial_number, (char*)serial, sizeof(devices[found].serial_number) - 1);
+    int index = device_table_alloc();
+    if (index < 0) {
+        result = index;
+        goto out;
+    }
+
+    usb_device_t *device = g_device_map[index];
+    device->handle = handle;
+    device->pool.handle = handle;
+    device->stream = NULL;
+    device->closing = 0;
+    memcpy(device->endpoints, endpoints, num_endpoints * sizeof(usb_endpoint_info_t));
+    device->num_endpoints = num_endpoints;
+    device_default_config(device, &device->config);
+    device->alt_setting = 0;
+    device->prefetch = PREFETCH_OFF;
+    device->data_callback = NULL;
+    device->data_user_data = NULL;
+    device->reattach = 0;
+    device->lost = 0;
+    device->disconnects = 0;
+    device->reattaches = 0;
+    device->downtime_us = 0;
+    device->last_downtime_us = 0;
+    device->lost_transfers = 0;
+    device->lost_write_bytes = 0;
+
+    serial_write_begin();
+    strncpy(device->serial, serial, sizeof(device->serial) - 1);
+    device->serial[sizeof(device->serial) - 1] = '\0';
+    device->serial_hash = serial_hash(device->serial);
+    unsigned int i = device->serial_hash & table->mask;
+    while (table->slots[i] >= 0) i = (i + 1) & table->mask;
+    if (table->slots[i] == SERIAL_SLOT_EMPTY) table->used++;
+    __atomic_store_n(&table->slots[i], index, __ATOMIC_RELAXED);
+    serial_write_end();
+
+    g_device_live++;
+    ATOMIC_STORE(&device->in_use, 1);
+    result = make_device_handle(device);
+
+out:
+    ReleaseSRWLockExclusive(&g_registry_lock);
+    return result;
+}
+
+// 内部函数：开始关闭，从序列号索引中移除，返回NULL表示句柄无效或已在关闭中
+static usb_device_t* begin_remove_device(int handle) {
+    AcquireSRWLockExclusive(&g_registry_lock);
+    usb_device_t *device = resolve_device(handle);
+    if (device && !device->closing) {
+        device->closing = 1;
+        serial_write_begin();
+        serial_index_remove(device);
+        serial_write_end();
+    } else {
+        device = NULL;
+    }
+    ReleaseSRWLockExclusive(&g_registry_lock);
+    return device;
+}
+
+// 内部函数：使所有句柄失效，等待持有io_lock的读取者全部退出
+static void invalidate_device(usb_device_t *device) {
+    AcquireSRWLockExclusive(&device->io_lock);
+    ATOMIC_STORE(&device->in_use, 0);
+    ATOMIC_STORE(&device->generation, device->generation + 1);
+    ReleaseSRWLockExclusive(&device->io_lock);
+}
+
+// 内部函数：完成关闭，把表项放回空闲链表
+static void finish_remove_device(usb_device_t *device) {
+    AcquireSRWLockExclusive(&g_registry_lock);
+    device->closing = 0;
+    device->next_free = g_device_free;
+    g_device_free = device->index;
+    g_device_live--;
+    ReleaseSRWLockExclusive(&g_registry_lock);
+}
+
+// 内部函数：获取设备在总线上的位置
+static void get_device_location(libusb_device *device, device_location_t *location) {
+    memset(location, 0, sizeof(*location));
+    location->bus = fn_get_bus_number(device);
+    location->address = fn_get_device_address(device);
+    if (fn_get_port_numbers) {
+        int depth = fn_get_port_numbers(device, location->ports, USB_MAX_PORT_DEPTH);
+        if (depth > 0) location->depth = (uint8_t)depth;
+    }
+}
+
+// 内部函数：端点每个服务周期的最大字节数，高速高带宽端点的第11~12位是每微帧的额外事务数
+static unsigned short endpoint_max_packet_size(const struct libusb_endpoint_descriptor *endpoint) {
+    unsigned int size = endpoint->wMaxPacketSize & 0x7FF;
+    unsigned int type = endpoint->bmAttributes & 0x03;
+    if (type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS || type == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+        size *= 1 + ((endpoint->wMaxPacketSize >> 11) & 0x03);
+    }
+    return (unsigned short)size;
+}
+
+// 内部函数：由libusb已缓存的描述符填充扩展设备信息，不打开设备，序列号不在此填充
+static void fill_device_info_ex(libusb_device *device, const struct libusb_device_descriptor *desc,
+                                const device_location_t *location, device_info_ex_t *info) {
+    memset(info, 0, sizeof(*info));
+    info->info.vid = desc->idVendor;
+    info->info.pid = desc->idProduct;
+    info->info.bus_number = location->bus;
+    info->info.device_address = location->address;
+    info->port_depth = location->depth;
+    memcpy(info->port_numbers, location->ports, location->depth);
+    info->speed = fn_get_device_speed ? (unsigned char)fn_get_device_speed(device) : USB_SPEED_UNKNOWN;
+    info->device_class = desc->bDeviceClass;
+    info->bcd_usb = desc->bcdUSB;
+    info->bcd_device = desc->bcdDevice;
+
+    // 取第一个配置中接口0默认设置的第一个IN和OUT端点
+    struct libusb_config_descriptor *config;
+    if (fn_get_config_descriptor(device, 0, &config) != 0) return;
+    if (config->bNumInterfaces > 0 && config->interface[0].num_altsetting > 0) {
+        const struct libusb_interface_descriptor *altsetting = &config->interface[0].altsetting[0];
+        for (int i = 0; i < altsetting->bNumEndpoints; i++) {
+            const struct libusb_endpoint_descriptor *endpoint = &altsetting->endpoint[i];
+            if ((endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN) && !info->in_endpoint) {
+                info->in_endpoint = endpoint->bEndpointAddress;
+                info->in_max_packet_size = endpoint_max_packet_size(endpoint);
+            } else if (!(endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN) && !info->out_endpoint) {
+                info->out_endpoint = endpoint->bEndpointAddress;
+                info->out_max_packet_size = endpoint_max_packet_size(endpoint);
             }
-            fn_close(handle);
         }
+    }
+    fn_free_config_descriptor(config);
+}
+
+// 内部函数：比较两个设备位置，端口路径在重新枚举后保持不变，优先使用
+static int location_equal(const device_location_t *a, const device_location_t *b) {
+    if (a->bus != b->bus || a->depth != b->depth) return 0;
+    if (a->depth == 0) return a->address == b->address;
+    return memcmp(a->ports, b->ports, a->depth) == 0;
+}
 
-        found++;
+// 内部函数：记录序列号所在位置，同一位置上的旧序列号一并移除
+static void location_remember(const char* serial, const device_location_t *location) {
+    AcquireSRWLockExclusive(&g_location_lock);
+    int slot = -1;
+    for (int i = 0; i < g_location_count; ) {
+        location_entry_t *entry = &g_locations[i];
+        if (strcmp(entry->serial, serial) == 0) {
+            slot = i++;
+        } else if (location_equal(&entry->location, location)) {
+            g_locations[i] = g_locations[--g_location_count];
+            if (slot == g_location_count) slot = i;
+        } else {
+            i++;
+        }
+    }
+    if (slot < 0 && g_location_count == g_location_capacity) {
+        int capacity = g_location_capacity ? g_location_capacity * 2 : 16;
+        location_entry_t *locations = (location_entry_t*)realloc(g_locations, capacity * sizeof(location_entry_t));
+        if (locations) {
+            g_locations = locations;
+            g_location_capacity = capacity;
+        }
     }
+    if (slot < 0 && g_location_count < g_location_capacity) {
+        slot = g_location_count++;
+        strncpy(g_locations[slot].serial, serial, sizeof(g_locations[slot].serial) - 1);
+        g_locations[slot].serial[sizeof(g_locations[slot].serial) - 1] = '\0';
+    }
+    if (slot >= 0) g_locations[slot].location = *location;
+    ReleaseSRWLockExclusive(&g_location_lock);
+}
 
-    fn_free_device_list(list, 1);
+// 内部函数：查找序列号上次出现的位置
+static int location_lookup(const char* serial, device_location_t *location) {
+    int found = 0;
+    AcquireSRWLockShared(&g_location_lock);
+    for (int i = 0; i < g_location_count; i++) {
+        if (strcmp(g_locations[i].serial, serial) == 0) {
+            *location = g_locations[i].location;
+            found = 1;
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&g_location_lock);
     return found;
 }
 
-USB_API int USB_OpenDevice(const char* target_serial) {
-    if (!target_serial) return USB_ERROR_INVALID;
-    if (find_device_handle(target_serial)) return USB_ERROR_BUSY;
-
-    int result = initialize_usb();
-    if (result != USB_SUCCESS) return result;
+// 内部函数：查找某位置上已知的设备是否已被本进程打开，打开设备时不再打扰它
+static int location_in_use(const device_location_t *location) {
+    char serial[64] = {0};
+    AcquireSRWLockShared(&g_location_lock);
+    for (int i = 0; i < g_location_count; i++) {
+        if (location_equal(&g_locations[i].location, location)) {
+            memcpy(serial, g_locations[i].serial, sizeof(serial));
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&g_location_lock);
+    return serial[0] && find_device_handle(serial) != 0;
+}
 
-    libusb_device **list;
-    ssize_t count = fn_get_device_list(g_ctx, &list);
-    if (count < 0) return USB_ERROR_IO;
+// 内部函数：移除失效的位置记录
+static void location_forget(const char* serial) {
+    AcquireSRWLockExclusive(&g_location_lock);
+    for (int i = 0; i < g_location_count; i++) {
+        if (strcmp(g_locations[i].serial, serial) == 0) {
+            g_locations[i] = g_locations[--g_location_count];
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_location_lock);
+}
 
-    int found = 0;
-    for (ssize_t i = 0; i < count; i++) {
-        libusb_device *device = list[i];
-        struct libusb_device_descriptor desc;
-        
-        if (fn_get_device_descriptor(device, &desc) < 0) continue;
-
-        libusb_device_handle *handle;
-        if (fn_open(device, &handle) == 0) {
-            unsigned char serial[64];
-            if (fn_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial)) > 0) {
-                if (strcmp(target_serial, (char*)serial) == 0) {
-                    // 找到目标设备
-                    if (fn_claim_interface(handle, 0) == 0) {
-                        result = add_device_mapping(target_serial, handle);
-                        if (result == USB_SUCCESS) {
-                            found = 1;
-                            break;
-                        }
-                        fn_release_interface(handle, 0);
-                    }
-                }
-            }
-            if (!found) fn_close(handle);
+// 内部函数：在过滤表中二分查找键
+static const filter_entry_t* filter_find(const device_filter_t *filter, uint64_t key) {
+    int low = 0, high = filter->count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (filter->entries[mid].key == key) return &filter->entries[mid];
+        if (filter->entries[mid].key < key) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
         }
     }
+    return NULL;
+}
 
-    fn_free_device_list(list, 1);
-    return found ? USB_SUCCESS : USB_ERROR_NOT_FOUND;
+static int filter_entry_compare(const void *a, const void *b) {
+    uint64_t ka = ((const filter_entry_t*)a)->key, kb = ((const filter_entry_t*)b)->key;
+    return ka < kb ? -1 : ka > kb;
 }
 
-USB_API int USB_CloseDevice(const char* target_serial) {
-    if (!target_serial) return USB_ERROR_INVALID;
+// 内部函数：把匹配条件编译成过滤表，相同VID/PID的条件合并其设备类位图
+static int filter_compile(const usb_device_filter_t* filters, int count, device_filter_t **out) {
+    device_filter_t *filter = (device_filter_t*)calloc(1, sizeof(device_filter_t) + count * sizeof(filter_entry_t));
+    if (!filter) return USB_ERROR_NO_MEM;
 
-    libusb_device_handle* handle = find_device_handle(target_serial);
-    if (!handle) return USB_ERROR_NOT_FOUND;
+    for (int i = 0; i < count; i++) {
+        const usb_device_filter_t *f = &filters[i];
+        if (f->vid < USB_MATCH_ANY || f->vid > 0xFFFF || f->pid < USB_MATCH_ANY || f->pid > 0xFFFF ||
+            f->device_class < USB_MATCH_ANY || f->device_class > 0xFF) {
+            free(filter);
+            return USB_ERROR_INVALID;
+        }
 
-    fn_release_interface(handle, 0);
-    fn_close(handle);
-    remove_device_mapping(target_serial);
+        unsigned int kind = f->vid == USB_MATCH_ANY ? (f->pid == USB_MATCH_ANY ? FILTER_KIND_ANY : FILTER_KIND_PRODUCT)
+                                                     : (f->pid == USB_MATCH_ANY ? FILTER_KIND_VENDOR : FILTER_KIND_EXACT);
+        filter_entry_t *entry = &filter->entries[filter->count++];
+        entry->key = ((uint64_t)kind << 32) |
+                     ((uint64_t)(f->vid == USB_MATCH_ANY ? 0 : f->vid) << 16) |
+                     (uint64_t)(f->pid == USB_MATCH_ANY ? 0 : f->pid);
+        if (f->device_class == USB_MATCH_ANY) {
+            memset(entry->classes, 0xFF, sizeof(entry->classes));
+        } else {
+            entry->classes[f->device_class >> 5] |= 1u << (f->device_class & 31);
+        }
+        filter->kinds |= 1u << kind;
+    }
 
+    // 排序后合并重复的键
+    qsort(filter->entries, filter->count, sizeof(filter_entry_t), filter_entry_compare);
+    int merged = 0;
+    for (int i = 0; i < filter->count; i++) {
+        if (merged > 0 && filter->entries[merged - 1].key == filter->entries[i].key) {
+            for (int w = 0; w < 8; w++) filter->entries[merged - 1].classes[w] |= filter->entries[i].classes[w];
+        } else {
+            filter->entries[merged++] = filter->entries[i];
+        }
+    }
+    filter->count = merged;
+
+    *out = filter;
     return USB_SUCCESS;
 }
 
-USB_API int USB_ReadData(const char* target_serial, unsigned char* data, int length) {
-    if (!target_serial || !data || length <= 0) return USB_ERROR_INVALID;
+// 内部函数：判断是否为本库支持的设备型号
+static int is_target_device(libusb_device *device, struct libusb_device_descriptor *desc) {
+    if (fn_get_device_descriptor(device, desc) < 0) return 0;
 
-    libusb_device_handle* handle = find_device_handle(target_serial);
-    if (!handle) return USB_ERROR_NOT_FOUND;
+    device_filter_t *filter = ATOMIC_LOAD(&g_device_filter);
+    if (!filter) return desc->idVendor == VENDOR_ID && desc->idProduct == PRODUCT_ID;
 
-    int actual_length;
-    int result = fn_interrupt_transfer(handle, 0x81, data, length, &actual_length, 1000);
-    
-    if (result == 0) return actual_length;
-    return USB_ERROR_IO;
+    uint64_t keys[4];
+    keys[FILTER_KIND_EXACT] = ((uint64_t)desc->idVendor << 16) | desc->idProduct;
+    keys[FILTER_KIND_VENDOR] = ((uint64_t)FILTER_KIND_VENDOR << 32) | ((uint64_t)desc->idVendor << 16);
+    keys[FILTER_KIND_PRODUCT] = ((uint64_t)FILTER_KIND_PRODUCT << 32) | desc->idProduct;
+    keys[FILTER_KIND_ANY] = (uint64_t)FILTER_KIND_ANY << 32;
+    for (int kind = 0; kind < 4; kind++) {
+        if (!(filter->kinds & (1u << kind))) continue;
+        const filter_entry_t *entry = filter_find(filter, keys[kind]);
+        if (entry && (entry->classes[desc->bDeviceClass >> 5] & (1u << (desc->bDeviceClass & 31)))) return 1;
+    }
+    return 0;
+}
+
+// 内部函数：读取序列号字符串描述符并转换为ASCII，非ASCII字符替换为'?'
+// 与libusb_get_string_descriptor_ascii相同，但使用较短的超时
+static int read_serial_descriptor(libusb_device_handle *handle, uint8_t index, char *serial, int size) {
+    unsigned char buffer[255];
+    serial[0] = '\0';
+    if (index == 0) return USB_ERROR_NOT_FOUND;
+
+    // 字符串描述符0是语言ID列表，使用第一种语言
+    int result = fn_control_transfer(handle, LIBUSB_ENDPOINT_IN, LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_STRING << 8,
+                                     0, buffer, sizeof(buffer), SERIAL_READ_TIMEOUT_MS);
+    if (result < 4) return USB_ERROR_IO;
+    uint16_t langid = buffer[2] | (buffer[3] << 8);
+
+    result = fn_control_transfer(handle, LIBUSB_ENDPOINT_IN, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_STRING << 8) | index,
+                                 langid, buffer, sizeof(buffer), SERIAL_READ_TIMEOUT_MS);
+    if (result < 2 || buffer[1] != LIBUSB_DT_STRING || buffer[0] > result) return USB_ERROR_IO;
+
+    int length = 0;
+    for (int i = 2; i + 1 < buffer[0] && length < size - 1; i += 2) {
+        serial[length++] = (buffer[i + 1] || (buffer[i] & 0x80)) ? '?' : (char)buffer[i];
+    }
+    serial[length] = '\0';
+    return length;
+}
+
+// 内部函数：打开设备并读取序列号，序列号与target_serial一致时保持打开并返回1
+static int open_if_serial(libusb_device *device, const struct libusb_device_descriptor *desc,
+                          const char* target_serial, libusb_device_handle **out) {
+    libusb_device_handle *handle;
+    if (fn_open(device, &handle) != 0) return 0;
+
+    char serial[64];
+    if (read_serial_descriptor(handle, desc->iSerialNumber, serial, sizeof(serial)) > 0) {
+        device_location_t location;
+        get_device_location(device, &location);
+        location_remember(serial, &location);
+        if (strcmp(target_serial, serial) == 0) {
+            *out = handle;
+            return 1;
+        }
+    }
+    fn_close(handle);
+    return 0;
+}
+
+// 内部函数：在设备列表中打开指定序列号的设备，未找到返回NULL，have_cached输出是否有记录的位置
+// 先按上次记录的位置直接打开，已知设备只需一次libusb_open；
+// 位置未知或已失效时，只打开VID/PID匹配且未被本进程占用的设备逐个比较序列号
+static libusb_device_handle* open_serial_in_list(libusb_device **list, ssize_t count, const char* target_serial,
+                                                 int *have_cached) {
+    libusb_device_handle *handle = NULL;
+    struct libusb_device_descriptor desc;
+    device_location_t cached, location;
+    *have_cached = location_lookup(target_serial, &cached);
+
+    if (*have_cached) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (!is_target_device(list[i], &desc)) continue;
+            get_device_location(list[i], &location);
+            if (location_equal(&location, &cached)) {
+                open_if_serial(list[i], &desc, target_serial, &handle);
+                break;
+            }
+        }
+    }
+
+    if (!handle) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (!is_target_device(list[i], &desc)) continue;
+            get_device_location(list[i], &location);
+            if (*have_cached && location_equal(&location, &cached)) continue;
+            if (location_in_use(&location)) continue;
+            if (open_if_serial(list[i], &desc, target_serial, &handle)) break;
+        }
+    }
+    return handle;
+}
+
+// 内部函数：判断两个位置是否为同一次枚举的同一设备，重新枚举后设备地址会改变
+static int same_enumeration(const device_location_t *a, const device_location_t *b) {
+    return a->address == b->address && location_equal(a, b);
+}
+
+// 内部函数：计算FNV-1a哈希
+static uint32_t fnv1a(const void *data, size_t size, uint32_t hash) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 内部函数：读取新出现设备的序列号
+// 本进程已打开的设备不能再次打开，直接使用打开时记录的序列号
+static int read_device_serial(libusb_device *device, const struct libusb_device_descriptor *desc,
+                              const device_location_t *location, char *serial, int size) {
+    AcquireSRWLockShared(&g_location_lock);
+    serial[0] = '\0';
+    for (int i = 0; i < g_location_count; i++) {
+        if (location_equal(&g_locations[i].location, location)) {
+            strncpy(serial, g_locations[i].serial, size - 1);
+            serial[size - 1] = '\0';
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&g_location_lock);
+    if (serial[0] && find_device_handle(serial)) return 1;
+
+    libusb_device_handle *handle;
+    if (fn_open(device, &handle) != 0) return 0;
+    int length = read_serial_descriptor(handle, desc->iSerialNumber, serial, size);
+    fn_close(handle);
+    if (length <= 0) return 0;
+
+    location_remember(serial, location);
+    return 1;
+}
+
+// 内部函数：由设备位置和描述符生成磁盘缓存的键，libusb不支持端口路径时返回0
+static int disk_cache_key(const device_location_t *location, const struct libusb_device_descriptor *desc,
+                          disk_cache_entry_t *entry) {
+    memset(entry, 0, sizeof(*entry));
+    if (location->depth == 0) return 0;  // 设备地址在重新枚举后会改变，不能作为键
+    entry->bus = location->bus;
+    entry->depth = location->depth;
+    memcpy(entry->ports, location->ports, location->depth);
+    entry->vid = desc->idVendor;
+    entry->pid = desc->idProduct;
+    entry->bcd_device = desc->bcdDevice;
+    return 1;
+}
+
+// 内部函数：计算一个设备键的哈希，各设备之和即为拓扑哈希，与枚举顺序无关
+static uint32_t disk_cache_key_hash(const device_location_t *location, const struct libusb_device_descriptor *desc) {
+    disk_cache_entry_t key;
+    if (!disk_cache_key(location, desc, &key)) return 0;
+    return fnv1a(&key, DISK_CACHE_KEY_SIZE, 2166136261u);
+}
+
+// 内部函数：映射磁盘缓存文件，只尝试一次
+static void disk_cache_open(void) {
+    if (g_disk_cache_opened) return;
+    g_disk_cache_opened = 1;
+
+    char path[MAX_PATH];
+    DWORD length = GetEnvironmentVariableA(DISK_CACHE_ENV, path, sizeof(path));
+    if (length >= sizeof(path)) return;
+    if (length == 0) {
+        // 环境变量存在但为空时禁用
+        if (getenv(DISK_CACHE_ENV)) return;
+        length = GetTempPathA(sizeof(path), path);
+        if (length == 0 || length + sizeof(DISK_CACHE_FILE) > sizeof(path)) return;
+        strcpy(path + length, DISK_CACHE_FILE);
+    }
+
+    g_disk_cache_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                    NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_disk_cache_file == INVALID_HANDLE_VALUE) return;
+    g_disk_cache_mapping = CreateFileMappingA(g_disk_cache_file, NULL, PAGE_READWRITE, 0, sizeof(disk_cache_t), NULL);
+    if (g_disk_cache_mapping) {
+        g_disk_cache = (disk_cache_t*)MapViewOfFile(g_disk_cache_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(disk_cache_t));
+    }
+    if (!g_disk_cache) {
+        if (g_disk_cache_mapping) CloseHandle(g_disk_cache_mapping);
+        CloseHandle(g_disk_cache_file);
+        g_disk_cache_mapping = NULL;
+        g_disk_cache_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+// 内部函数：关闭磁盘缓存文件
+static void disk_cache_close(void) {
+    if (g_disk_cache) UnmapViewOfFile(g_disk_cache);
+    if (g_disk_cache_mapping) CloseHandle(g_disk_cache_mapping);
+    if (g_disk_cache_file != INVALID_HANDLE_VALUE) CloseHandle(g_disk_cache_file);
+    g_disk_cache = NULL;
+    g_disk_cache_mapping = NULL;
+    g_disk_cache_file = INVALID_HANDLE_VALUE;
+    g_disk_cache_opened = 0;
+    g_disk_cache_topology = 0;
+}
+
+// 读取一个新设备序列号的任务
+typedef struct {
+    libusb_device *device;
+    struct libusb_device_descriptor desc;
+    cached_device_t entry;
+    int resolved;
+    int cached_index;  // 重试缓存中序列号为空的设备时为其下标，新设备为-1
+} serial_fetch_t;
+
+// 队列由调用线程和工作线程共同引用，最后一个使用者释放
+// 工作线程可能在调用线程返回之后才开始运行，那时只会发现任务已被取完
+typedef struct {
+    serial_fetch_t *jobs;
+    int count;
+    volatile LONG next;      // 下一个未领取的任务
+    volatile LONG finished;  // 已完成的任务数，达到count时置位done_event
+    volatile LONG refs;
+    HANDLE done_event;
+} serial_fetch_queue_t;
+
+// 内部函数：释放队列的一个引用
+static void serial_fetch_queue_unref(serial_fetch_queue_t *queue) {
+    if (InterlockedDecrement(&queue->refs) != 0) return;
+    CloseHandle(queue->done_event);
+    free(queue);
+}
+
+// 内部函数：读取一个任务的序列号
+static void serial_fetch_run(serial_fetch_t *job) {
+    if (job->resolved) return;
+    job->resolved = read_device_serial(job->device, &job->desc, &job->entry.location,
+                                       job->entry.info.info.serial_number, sizeof(job->entry.info.info.serial_number));
+}
+
+// 内部函数：从队列中取任务直到取完
+static void serial_fetch_drain(serial_fetch_queue_t *queue) {
+    for (;;) {
+        LONG index = InterlockedIncrement(&queue->next) - 1;
+        if (index >= queue->count) break;
+        serial_fetch_run(&queue->jobs[index]);
+        if (InterlockedIncrement(&queue->finished) == queue->count) SetEvent(queue->done_event);
+    }
+}
+
+// 内部函数：读取序列号的工作线程
+static DWORD WINAPI serial_fetch_worker(LPVOID param) {
+    serial_fetch_queue_t *queue = (serial_fetch_queue_t*)param;
+    serial_fetch_drain(queue);
+    serial_fetch_queue_unref(queue);
+    return 0;
+}
+
+// 内部函数：在最多SERIAL_FETCH_WORKERS个线程上并行读取序列号，调用线程也参与
+// 新设备只在首次扫描和插入时出现，因此按需创建线程而不常驻
+// 只等待已被领取的任务完成而不等待线程本身：卸载时新线程要等加载器锁才能启动，
+// 未启动的线程领取不到任务，调用线程会把剩下的任务全部做完；卸载开始后不再创建线程
+static void fetch_serials(serial_fetch_t *jobs, int count) {
+    int todo = 0;
+    for (int i = 0; i < count; i++) {
+        if (!jobs[i].resolved) todo++;
+    }
+    if (todo == 0) return;
+
+    serial_fetch_queue_t *queue = NULL;
+    if (todo > 1 && !ATOMIC_LOAD(&g_unloading)) {
+        queue = (serial_fetch_queue_t*)calloc(1, sizeof(serial_fetch_queue_t));
+        if (queue) queue->done_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (queue && !queue->done_event) {
+            free(queue);
+            queue = NULL;
+        }
+    }
+    if (!queue) {
+        for (int i = 0; i < count; i++) serial_fetch_run(&jobs[i]);
+        return;
+    }
+    queue->jobs = jobs;
+    queue->count = count;
+    queue->refs = 1;
+
+    int workers = todo < SERIAL_FETCH_WORKERS ? todo : SERIAL_FETCH_WORKERS;
+    for (int i = 0; i < workers - 1 && !ATOMIC_LOAD(&g_unloading); i++) {
+        InterlockedIncrement(&queue->refs);
+        HANDLE thread = CreateThread(NULL, 0, serial_fetch_worker, queue, 0, NULL);
+        if (!thread) {
+            InterlockedDecrement(&queue->refs);
+            break;
+        }
+        CloseHandle(thread);
+    }
+
+    serial_fetch_drain(queue);
+    WaitForSingleObject(queue->done_event, INFINITE);
+    serial_fetch_queue_unref(queue);
+}
+
+// 内部函数：拓扑与磁盘缓存记录一致时，直接从缓存得到新设备的序列号
+static void disk_cache_resolve(serial_fetch_t *jobs, int count, uint32_t topology) {
+    disk_cache_open();
+    if (!g_disk_cache || count == 0) return;
+
+    // 先复制再校验，其他进程可能正在写入
+    disk_cache_t *copy = (disk_cache_t*)malloc(sizeof(disk_cache_t));
+    if (!copy) return;
+    memcpy(copy, g_disk_cache, sizeof(disk_cache_t));
+    if (copy->magic != DISK_CACHE_MAGIC || copy->count > DISK_CACHE_ENTRIES ||
+        copy->checksum != fnv1a(copy->entries, copy->count * sizeof(disk_cache_entry_t), 2166136261u)) {
+        free(copy);
+        return;
+    }
+    g_disk_cache_topology = copy->topology;
+    if (copy->topology != topology) {
+        free(copy);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        disk_cache_entry_t key;
+        if (!disk_cache_key(&jobs[i].entry.location, &jobs[i].desc, &key)) continue;
+        for (uint32_t j = 0; j < copy->count; j++) {
+            disk_cache_entry_t *entry = &copy->entries[j];
+            if (memcmp(entry, &key, DISK_CACHE_KEY_SIZE) != 0 || !entry->serial[0]) continue;
+            char *serial = jobs[i].entry.info.info.serial_number;
+            memcpy(serial, entry->serial, sizeof(jobs[i].entry.info.info.serial_number) - 1);
+            serial[sizeof(jobs[i].entry.info.info.serial_number) - 1] = '\0';
+            location_remember(serial, &jobs[i].entry.location);
+            jobs[i].resolved = 1;
+            break;
+        }
+    }
+    free(copy);
+}
+
+// 内部函数：把当前设备缓存写入磁盘缓存
+static void disk_cache_store(uint32_t topology) {
+    disk_cache_open();
+    if (!g_disk_cache) return;
+
+    disk_cache_t *copy = (disk_cache_t*)calloc(1, sizeof(disk_cache_t));
+    if (!copy) return;
+    for (int i = 0; i < g_cache_count && copy->count < DISK_CACHE_ENTRIES; i++) {
+        cached_device_t *cached = &g_cache[i];
+        struct libusb_device_descriptor desc;
+        desc.idVendor = cached->info.info.vid;
+        desc.idProduct = cached->info.info.pid;
+        desc.bcdDevice = cached->info.bcd_device;
+        disk_cache_entry_t *entry = &copy->entries[copy->count];
+        if (!cached->info.info.serial_number[0]) continue;
+        if (!disk_cache_key(&cached->location, &desc, entry)) continue;
+        memcpy(entry->serial, cached->info.info.serial_number, sizeof(entry->serial));
+        copy->count++;
+    }
+    copy->magic = DISK_CACHE_MAGIC;
+    copy->topology = topology;
+    copy->checksum = fnv1a(copy->entries, copy->count * sizeof(disk_cache_entry_t), 2166136261u);
+
+    memcpy(g_disk_cache, copy, sizeof(disk_cache_t));
+    g_disk_cache_topology = topology;
+    free(copy);
+}
+
+// 内部函数：通知调用者设备到达或离开
+static void notify_device_change(const device_info_t *info, int arrived) {
+    AcquireSRWLockShared(&g_notify_lock);
+    if (g_change_callback) g_change_callback(info, arrived, g_change_user_data);
+    ReleaseSRWLockShared(&g_notify_lock);
+}
+
+// 内部函数：比较设备列表和缓存，只打开新出现的设备，并通知变化
+static int device_cache_refresh(void) {
+    AcquireSRWLockExclusive(&g_cache_refresh_lock);
+    // 先清除标记再枚举，枚举期间到来的热插拔事件会触发下一次刷新
+    InterlockedExchange(&g_cache_dirty, 0);
+
+    libusb_device **list;
+    ssize_t count = fn_get_device_list(g_ctx, &list);
+    if (count < 0) {
+        InterlockedExchange(&g_cache_dirty, 1);
+        ReleaseSRWLockExclusive(&g_cache_refresh_lock);
+        return USB_ERROR_IO;
+    }
+
+    // 只有持有g_cache_refresh_lock的线程修改缓存，因此这里读取缓存不需要g_cache_lock
+    int cached = g_cache_count;
+    char *seen = (char*)calloc(cached + 1, 1);
+    cached_device_t *arrivals = (cached_device_t*)malloc((count + 1) * sizeof(cached_device_t));
+    serial_fetch_t *jobs = (serial_fetch_t*)malloc((count + 1) * sizeof(serial_fetch_t));
+    if (!seen || !arrivals || !jobs) {
+        free(seen);
+        free(arrivals);
+        free(jobs);
+        fn_free_device_list(list, 1);
+        InterlockedExchange(&g_cache_dirty, 1);
+        ReleaseSRWLockExclusive(&g_cache_refresh_lock);
+        return USB_ERROR_NO_MEM;
+    }
+
+    int arrived = 0, pending = 0;
+    uint32_t topology = 0, enumeration = 0;
+    for (ssize_t i = 0; i < count; i++) {
+        struct libusb_device_descriptor desc;
+        if (!is_target_device(list[i], &desc)) continue;
+
+        device_location_t location;
+        get_device_location(list[i], &location);
+        topology += disk_cache_key_hash(&location, &desc);
+        enumeration += fnv1a(&location, sizeof(location), 2166136261u);
+        int known = -1;
+        for (int j = 0; j < cached; j++) {
+            if (same_enumeration(&g_cache[j].location, &location)) {
+                seen[j] = 1;
+                known = j;
+                break;
+            }
+        }
+        if (known >= 0 && g_cache[known].info.info.serial_number[0]) continue;
+
+        serial_fetch_t *job = &jobs[pending++];
+        memset(job, 0, sizeof(*job));
+        job->device = list[i];
+        job->desc = desc;
+        job->cached_index = known;
+        job->entry.location = location;
+        fill_device_info_ex(list[i], &desc, &location, &job->entry.info);
+    }
+
+    // 序列号为空的已知设备只在有设备插拔或重新枚举后重试，否则每次扫描都会重新打开它们
+    if (enumeration == g_cache_enumeration) {
+        int kept_jobs = 0;
+        for (int j = 0; j < pending; j++) {
+            if (jobs[j].cached_index < 0) jobs[kept_jobs++] = jobs[j];
+        }
+        pending = kept_jobs;
+    }
+
+    // 冷启动时先按磁盘缓存填充序列号，其余设备并行读取
+    if (!g_cache_valid) disk_cache_resolve(jobs, pending, topology);
+    fetch_serials(jobs, pending);
+    fn_free_device_list(list, 1);
+    for (int j = 0; j < pending; j++) {
+        if (jobs[j].cached_index < 0) {
+            // 读不到序列号的设备(可能被其他进程占用)以空序列号加入缓存
+            if (!jobs[j].resolved) jobs[j].entry.info.info.serial_number[0] = '\0';
+            arrivals[arrived++] = jobs[j].entry;
+        } else if (jobs[j].resolved) {
+            // 重试成功：空序列号的记录离开，带序列号的记录到达
+            seen[jobs[j].cached_index] = 0;
+            arrivals[arrived++] = jobs[j].entry;
+        }
+    }
+
+    // 离开的设备复制出来在释放锁后通知，到达的设备追加到缓存末尾
+    cached_device_t *departures = NULL;
+    int departed = 0;
+    AcquireSRWLockExclusive(&g_cache_lock);
+    int needed = cached + arrived;
+    if (needed > g_cache_capacity) {
+        int capacity = g_cache_capacity ? g_cache_capacity : 16;
+        while (capacity < needed) capacity *= 2;
+        cached_device_t *grown = (cached_device_t*)realloc(g_cache, capacity * sizeof(cached_device_t));
+        if (grown) {
+            g_cache = grown;
+            g_cache_capacity = capacity;
+        } else {
+            // 到达的设备留到下次刷新，重试成功的设备保留原来的记录
+            for (int j = 0; j < pending; j++) {
+                if (jobs[j].cached_index >= 0) seen[jobs[j].cached_index] = 1;
+            }
+            arrived = 0;
+            InterlockedExchange(&g_cache_dirty, 1);
+        }
+    }
+    departures = (cached_device_t*)malloc((cached + 1) * sizeof(cached_device_t));
+    int kept = 0;
+    for (int j = 0; j < cached; j++) {
+        if (seen[j]) {
+            g_cache[kept++] = g_cache[j];
+            continue;
+        }
+        change_log_entry_t *log = &g_change_log[g_change_log_count++ % CHANGE_LOG_SIZE];
+        if (g_change_log_count > CHANGE_LOG_SIZE) g_change_log_floor = log->departed;
+        log->info = g_cache[j].info.info;
+        log->arrived = g_cache[j].version;
+        log->departed = ++g_topology_version;
+        if (departures) departures[departed++] = g_cache[j];
+    }
+    for (int j = 0; j < arrived; j++) {
+        arrivals[j].version = ++g_topology_version;
+    }
+    memcpy(g_cache + kept, arrivals, arrived * sizeof(cached_device_t));
+    g_cache_count = kept + arrived;
+    g_cache_valid = 1;
+    ReleaseSRWLockExclusive(&g_cache_lock);
+
+    // 只有持有g_cache_refresh_lock的线程修改缓存，写文件时读取缓存不需要g_cache_lock
+    if (arrived || departed || topology != g_disk_cache_topology) disk_cache_store(topology);
+    g_cache_enumeration = enumeration;
+    ReleaseSRWLockExclusive(&g_cache_refresh_lock);
+    free(jobs);
+
+    for (int j = 0; j < departed; j++) notify_device_change(&departures[j].info.info, 0);
+    for (int j = 0; j < arrived; j++) notify_device_change(&arrivals[j].info.info, 1);
+
+    free(departures);
+    free(arrivals);
+    free(seen);
+    return USB_SUCCESS;
+}
+
+// 内部函数：从池中取一个至少有iso_packets个等时包描述符的传输，优先取容量最小的
+static struct libusb_transfer* pool_get_transfer(usb_pool_t *pool, int iso_packets) {
+    AcquireSRWLockExclusive(&pool->lock);
+    pool_transfer_t *best = NULL;
+    for (int i = 0; i < pool->num_transfers; i++) {
+        pool_transfer_t *entry = &pool->transfers[i];
+        if (!entry->in_use && entry->iso_packets >= iso_packets &&
+            (!best || entry->iso_packets < best->iso_packets)) best = entry;
+    }
+
+    if (!best) {
+        // 表满时替换一个容量不够的空闲传输
+        if (pool->num_transfers < POOL_MAX_TRANSFERS) {
+            best = &pool->transfers[pool->num_transfers++];
+        } else {
+            for (int i = 0; i < pool->num_transfers && !best; i++) {
+                if (!pool->transfers[i].in_use) best = &pool->transfers[i];
+            }
+            if (best) fn_free_transfer(best->transfer);
+        }
+        if (best) {
+            best->transfer = fn_alloc_transfer(iso_packets);
+            best->iso_packets = iso_packets;
+            pool->heap_allocations++;
+            if (!best->transfer) {
+                *best = pool->transfers[--pool->num_transfers];
+                best = NULL;
+            }
+        }
+    }
+
+    struct libusb_transfer *transfer = NULL;
+    if (best) {
+        best->in_use = 1;
+        transfer = best->transfer;
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+    return transfer;
+}
+
+// 内部函数：把传输还给池，调用者须保证传输已不在途
+static void pool_put_transfer(usb_pool_t *pool, struct libusb_transfer *transfer) {
+    if (!transfer) return;
+    AcquireSRWLockExclusive(&pool->lock);
+    for (int i = 0; i < pool->num_transfers; i++) {
+        if (pool->transfers[i].transfer == transfer) {
+            pool->transfers[i].in_use = 0;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+// 内部函数：释放缓冲区块的内存
+static void pool_free_block(const pool_block_t *block) {
+    if (block->device_memory) {
+        fn_dev_mem_free(block->handle, block->data, block->size);
+    } else {
+        _aligned_free(block->data);
+    }
+}
+
+// 内部函数：释放一个空闲缓冲区块(调用者持有pool->lock)
+static void pool_drop_block(usb_pool_t *pool, int index) {
+    pool->idle_bytes -= pool->blocks[index].size;
+    pool_free_block(&pool->blocks[index]);
+    pool->blocks[index] = pool->blocks[--pool->num_blocks];
+}
+
+// 内部函数：在空闲块中找不超过所需大小两倍的最小块(调用者持有pool->lock)
+static int pool_find_block(const usb_pool_t *pool, size_t size, int device_memory) {
+    int best = -1;
+    for (int i = 0; i < pool->num_blocks; i++) {
+        const pool_block_t *block = &pool->blocks[i];
+        if (!block->in_use && block->device_memory == device_memory && block->size >= size && block->size / 2 <= size &&
+            (best < 0 || block->size < pool->blocks[best].size)) best = i;
+    }
+    return best;
+}
+
+// 内部函数：从池中取一块按缓存行对齐的缓冲区，kind为POOL_*
+// 传输缓冲区依次尝试空闲的设备内存块、新分配设备内存、空闲的普通块、新分配普通内存；
+// 设备内存分配失败一次后(如非Linux后端)不再尝试
+static void* pool_alloc(usb_pool_t *pool, size_t size, int kind) {
+    AcquireSRWLockExclusive(&pool->lock);
+    int use_device_memory = kind == POOL_DEVICE_MEMORY && fn_dev_mem_alloc && !pool->device_memory_failed;
+    int best = use_device_memory ? pool_find_block(pool, size, 1) : -1;
+    unsigned char *data = NULL;
+    int device_memory = 0;
+    if (best < 0 && use_device_memory) {
+        data = fn_dev_mem_alloc(pool->handle, size);
+        if (data) {
+            device_memory = 1;
+        } else {
+            pool->device_memory_failed = 1;
+        }
+    }
+    if (best < 0 && !data) best = pool_find_block(pool, size, 0);
+
+    if (best < 0) {
+        if (pool->num_blocks == POOL_MAX_BLOCKS) {
+            for (int i = 0; i < pool->num_blocks; i++) {
+                if (!pool->blocks[i].in_use) {
+                    pool_drop_block(pool, i);
+                    break;
+                }
+            }
+        }
+        if (pool->num_blocks == POOL_MAX_BLOCKS) {
+            if (device_memory) fn_dev_mem_free(pool->handle, data, size);
+            data = NULL;
+        } else if (!data) {
+            data = (unsigned char*)_aligned_malloc(size, CACHE_LINE_SIZE);
+        }
+        if (data) {
+            best = pool->num_blocks++;
+            pool->blocks[best].data = data;
+            pool->blocks[best].size = size;
+            pool->blocks[best].in_use = 0;
+            pool->blocks[best].device_memory = device_memory;
+            pool->blocks[best].handle = device_memory ? pool->handle : NULL;
+            pool->idle_bytes += size;
+            pool->heap_allocations++;
+        }
+    }
+
+    void *result = NULL;
+    if (best >= 0) {
+        pool->blocks[best].in_use = 1;
+        pool->idle_bytes -= pool->blocks[best].size;
+        result = pool->blocks[best].data;
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+    return result;
+}
+
+// 内部函数：把缓冲区还给池，空闲总量超过上限时释放最大的空闲块
+static void pool_free(usb_pool_t *pool, void *data) {
+    if (!data) return;
+    AcquireSRWLockExclusive(&pool->lock);
+    for (int i = 0; i < pool->num_blocks; i++) {
+        if (pool->blocks[i].data == data) {
+            pool->blocks[i].in_use = 0;
+            pool->idle_bytes += pool->blocks[i].size;
+            break;
+        }
+    }
+    while (pool->idle_bytes > POOL_MAX_IDLE_BYTES) {
+        int largest = -1;
+        for (int i = 0; i < pool->num_blocks; i++) {
+            if (!pool->blocks[i].in_use && (largest < 0 || pool->blocks[i].size > pool->blocks[largest].size)) largest = i;
+        }
+        pool_drop_block(pool, largest);
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+// 内部函数：缓冲区是否位于设备内存
+static int pool_is_device_memory(usb_pool_t *pool, const void *data) {
+    int device_memory = 0;
+    AcquireSRWLockShared(&pool->lock);
+    for (int i = 0; i < pool->num_blocks; i++) {
+        if (pool->blocks[i].data == data) device_memory = pool->blocks[i].device_memory;
+    }
+    ReleaseSRWLockShared(&pool->lock);
+    return device_memory;
+}
+
+// 内部函数：释放池中所有传输和缓冲区(调用者保证流和写入状态都已销毁，且设备尚未关闭)
+static void pool_release(usb_pool_t *pool) {
+    AcquireSRWLockExclusive(&pool->lock);
+    for (int i = 0; i < pool->num_transfers; i++) fn_free_transfer(pool->transfers[i].transfer);
+    for (int i = 0; i < pool->num_blocks; i++) pool_free_block(&pool->blocks[i]);
+    pool->num_transfers = 0;
+    pool->num_blocks = 0;
+    pool->idle_bytes = 0;
+    pool->device_memory_failed = 0;
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+// 内部函数：创建环形缓冲区，容量向上取整为2的幂
+static usb_ring_t* ring_create(usb_pool_t *pool, unsigned int capacity, unsigned int slot_size) {
+    unsigned int size = 1;
+    while (size < capacity) size <<= 1;
+
+    usb_ring_t *ring = (usb_ring_t*)pool_alloc(pool, sizeof(usb_ring_t), POOL_HEAP);
+    if (!ring) return NULL;
+    memset(ring, 0, sizeof(usb_ring_t));
+
+    ring->mask = size - 1;
+    ring->slot_size = slot_size;
+    ring->slot_stride = (sizeof(ring_slot_t) + slot_size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    ring->slots = (unsigned char*)pool_alloc(pool, (size_t)ring->slot_stride * size, POOL_HEAP);
+    if (!ring->slots) {
+        pool_free(pool, ring);
+        return NULL;
+    }
+    return ring;
+}
+
+// 内部函数：释放环形缓冲区
+static void ring_destroy(usb_pool_t *pool, usb_ring_t *ring) {
+    if (!ring) return;
+    pool_free(pool, ring->slots);
+    pool_free(pool, ring);
+}
+
+// 内部函数(生产者)：检查是否至少有count个空闲槽位
+static int ring_has_space(usb_ring_t *ring, unsigned int count) {
+    unsigned int head = ring->head;
+
+    if (head + count - ring->cached_tail > ring->mask + 1) {
+        ring->cached_tail = ATOMIC_LOAD(&ring->tail);
+        if (head + count - ring->cached_tail > ring->mask + 1) return 0;
+    }
+    return 1;
+}
+
+// 内部函数(生产者)：写入一个数据包，队列满时丢弃并计数，返回是否需要唤醒消费者
+// 之前有数据包丢失时先写入间隙标记，标记和数据包必须同时有空间
+static int ring_push(usb_ring_t *ring, const unsigned char *data, unsigned int length, unsigned long long timestamp_us) {
+    unsigned int head = ring->head;
+
+    if (!ring_has_space(ring, ring->gap_pending ? 2 : 1)) {
+        ATOMIC_STORE(&ring->overflows, ring->overflows + 1);
+        if (ring->mark_gaps) ring->gap_pending = 1;
+        return 0;
+    }
+
+    ring_slot_t *slot;
+    if (ring->gap_pending) {
+        slot = RING_SLOT(ring, head);
+        slot->length = 0;
+        slot->flags = RING_SLOT_GAP;
+        slot->timestamp_us = timestamp_us;
+        ring->gap_pending = 0;
+        head++;
+    }
+
+    slot = RING_SLOT(ring, head);
+    slot->length = length;
+    slot->flags = 0;
+    slot->timestamp_us = timestamp_us;
+    memcpy(slot + 1, data, length);
+
+    // head与waiting都使用顺序一致性访问，和消费者一侧配对，保证不会丢失唤醒
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    ATOMIC_STORE(&ring->packets, ring->packets + 1);
+    return __atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) != 0;
+}
+
+// 内部函数(消费者)：查看队首数据包，队列为空返回NULL
+static ring_slot_t* ring_peek(usb_ring_t *ring) {
+    unsigned int tail = ring->tail;
+
+    if (tail == ring->cached_head) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        if (tail == ring->cached_head) return NULL;
+    }
+    return RING_SLOT(ring, tail);
+}
+
+// 内部函数(消费者)：释放队首槽位给生产者
+static void ring_advance(usb_ring_t *ring) {
+    ring->read_offset = 0;
+    ATOMIC_STORE(&ring->tail, ring->tail + 1);
+}
+
+// 内部函数(消费者)：按字节流读取，跨数据包边界连续拷贝，读完的槽位最后统一释放
+static int ring_read_bytes(usb_ring_t *ring, unsigned char *buf, int length) {
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    unsigned int offset = ring->read_offset;
+    int copied = 0;
+
+    ring->cached_head = head;
+    while (tail != head && copied < length) {
+        ring_slot_t *slot = RING_SLOT(ring, tail);
+        if (slot->flags & RING_SLOT_GAP) {
+            // 字节流无法表示间隙，在标记处截断，标记单独作为一次读取的结果返回
+            if (copied > 0) break;
+            ATOMIC_STORE(&ring->tail, tail + 1);
+            return USB_ERROR_DATA_LOST;
+        }
+        unsigned int n = slot->length - offset;
+        if (n > (unsigned int)(length - copied)) n = length - copied;
+
+        memcpy(buf + copied, (unsigned char*)(slot + 1) + offset, n);
+        copied += n;
+        offset += n;
+        if (offset == slot->length) {
+            offset = 0;
+            tail++;
+        }
+    }
+
+    ring->read_offset = offset;
+    if (tail != ring->tail) ATOMIC_STORE(&ring->tail, tail);
+    return copied;
+}
+
+// 内部函数(消费者)：一次取出多个数据包到连续的缓冲区，最后统一释放槽位
+static int ring_read_batch(usb_ring_t *ring, unsigned char *buf, int slot_size, int max_packets,
+                           int *lengths, unsigned long long *timestamps) {
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    unsigned int offset = ring->read_offset;  // 只有第一个数据包可能已被字节流部分读取
+    int count = 0;
+
+    ring->cached_head = head;
+    while (tail != head && count < max_packets) {
+        ring_slot_t *slot = RING_SLOT(ring, tail);
+        unsigned int length = slot->length - offset;
+        if ((int)length > slot_size) break;
+
+        memcpy(buf + (size_t)count * slot_size, (unsigned char*)(slot + 1) + offset, length);
+        lengths[count] = (slot->flags & RING_SLOT_GAP) ? USB_ERROR_DATA_LOST : (int)length;
+        if (timestamps) timestamps[count] = slot->timestamp_us;
+        offset = 0;
+        count++;
+        tail++;
+    }
+
+    if (count > 0) {
+        ring->read_offset = 0;
+        ATOMIC_STORE(&ring->tail, tail);
+    }
+    return count;
+}
+
+// 内部函数：创建命令通道
+static usb_commands_t* commands_create(int tag_offset, int tag_size) {
+    int num_tags = tag_size == 1 ? 256 : COMMAND_MAX_TAGS;
+    usb_commands_t *commands = (usb_commands_t*)calloc(1, sizeof(usb_commands_t) + num_tags * sizeof(command_slot_t));
+    if (!commands) return NULL;
+    InitializeCriticalSection(&commands->lock);
+    InitializeConditionVariable(&commands->done);
+    commands->tag_offset = tag_offset;
+    commands->tag_size = tag_size;
+    commands->num_tags = num_tags;
+    return commands;
+}
+
+// 内部函数：读取/写入消息中的标签
+static int command_get_tag(const usb_commands_t *commands, const unsigned char *data) {
+    const unsigned char *p = data + commands->tag_offset;
+    return commands->tag_size == 1 ? p[0] : (p[0] | (p[1] << 8));
+}
+
+static void command_set_tag(const usb_commands_t *commands, unsigned char *data, int tag) {
+    unsigned char *p = data + commands->tag_offset;
+    p[0] = (unsigned char)tag;
+    if (commands->tag_size == 2) p[1] = (unsigned char)(tag >> 8);
+}
+
+// 内部函数：分配标签并登记等待者，没有空闲标签返回USB_ERROR_BUSY
+static int commands_begin(usb_commands_t *commands, unsigned char *response, int response_size,
+                          usb_command_callback_t callback, void *user_data) {
+    EnterCriticalSection(&commands->lock);
+    int tag = USB_ERROR_BUSY;
+    if (commands->closing) {
+        tag = USB_ERROR_INTERRUPTED;
+    } else {
+        for (int i = 0; i < commands->num_tags; i++) {
+            int candidate = (commands->next_tag + i) % commands->num_tags;
+            if (commands->slots[candidate].state == COMMAND_FREE) {
+                tag = candidate;
+                break;
+            }
+        }
+    }
+    if (tag >= 0) {
+        command_slot_t *slot = &commands->slots[tag];
+        slot->state = COMMAND_PENDING;
+        slot->result = 0;
+        slot->response = response;
+        slot->response_size = response_size;
+        slot->callback = callback;
+        slot->user_data = user_data;
+        commands->next_tag = (tag + 1) % commands->num_tags;
+    }
+    LeaveCriticalSection(&commands->lock);
+    return tag;
+}
+
+// 内部函数：放弃一个尚未完成的命令，之后到达的响应按未请求的数据处理
+// 返回0表示命令已经完成(异步回调已经或正在被调用，同步结果留给等待者取走)
+static int commands_abandon(usb_commands_t *commands, int tag) {
+    EnterCriticalSection(&commands->lock);
+    int abandoned = commands->slots[tag].state == COMMAND_PENDING;
+    if (abandoned) commands->slots[tag].state = COMMAND_FREE;
+    LeaveCriticalSection(&commands->lock);
+    return abandoned;
+}
+
+// 内部函数(传输回调)：把响应交给对应标签的命令，返回0表示不是等待中的响应
+static int commands_dispatch(usb_commands_t *commands, const unsigned char *data, int length) {
+    if (length < commands->tag_offset + commands->tag_size) return 0;
+    int tag = command_get_tag(commands, data);
+    if (tag >= commands->num_tags) return 0;
+
+    EnterCriticalSection(&commands->lock);
+    command_slot_t *slot = &commands->slots[tag];
+    if (commands->closing || slot->state != COMMAND_PENDING) {
+        LeaveCriticalSection(&commands->lock);
+        return 0;
+    }
+
+    if (slot->callback) {
+        // 先释放标签再回调，回调中可以立即发送下一个命令
+        usb_command_callback_t callback = slot->callback;
+        void *user_data = slot->user_data;
+        slot->state = COMMAND_FREE;
+        LeaveCriticalSection(&commands->lock);
+        callback(tag, length, data, user_data);
+        return 1;
+    }
+
+    if (length > slot->response_size) {
+        slot->result = USB_ERROR_OVERFLOW;
+    } else {
+        memcpy(slot->response, data, length);
+        slot->result = length;
+    }
+    slot->state = COMMAND_DONE;
+    WakeAllConditionVariable(&commands->done);
+    LeaveCriticalSection(&commands->lock);
+    return 1;
+}
+
+// 内部函数：等待同步命令完成，超时后放弃该标签
+static int commands_wait(usb_commands_t *commands, int tag, ULONGLONG deadline) {
+    command_slot_t *slot = &commands->slots[tag];
+    int result;
+
+    EnterCriticalSection(&commands->lock);
+    for (;;) {
+        if (slot->state == COMMAND_DONE) {
+            result = slot->result;
+            break;
+        }
+        if (commands->closing) {
+            result = USB_ERROR_INTERRUPTED;
+            break;
+        }
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline) {
+            result = USB_ERROR_TIMEOUT;
+            break;
+        }
+        ULONGLONG remaining = deadline - now;
+        if (g_event_thread) {
+            SleepConditionVariableCS(&commands->done, &commands->lock, (DWORD)remaining);
+        } else {
+            LeaveCriticalSection(&commands->lock);
+            pump_usb_events(remaining < 100 ? (int)remaining : 100);
+            EnterCriticalSection(&commands->lock);
+        }
+    }
+    slot->state = COMMAND_FREE;
+    LeaveCriticalSection(&commands->lock);
+    return result;
+}
+
+// 内部函数：关闭命令通道，唤醒同步等待者，以USB_ERROR_INTERRUPTED完成所有异步命令
+static void commands_shutdown(usb_commands_t *commands) {
+    EnterCriticalSection(&commands->lock);
+    commands->closing = 1;
+    WakeAllConditionVariable(&commands->done);
+    LeaveCriticalSection(&commands->lock);
+
+    // closing置位后不会再有新的命令和分发，逐个认领剩余的异步命令并在锁外回调
+    for (int tag = 0; tag < commands->num_tags; tag++) {
+        command_slot_t *slot = &commands->slots[tag];
+        usb_command_callback_t callback = NULL;
+        void *user_data = NULL;
+        EnterCriticalSection(&commands->lock);
+        if (slot->state == COMMAND_PENDING && slot->callback) {
+            callback = slot->callback;
+            user_data = slot->user_data;
+            slot->state = COMMAND_FREE;
+        }
+        LeaveCriticalSection(&commands->lock);
+        if (callback) callback(tag, USB_ERROR_INTERRUPTED, NULL, user_data);
+    }
+}
+
+static void commands_destroy(usb_commands_t *commands) {
+    if (!commands) return;
+    DeleteCriticalSection(&commands->lock);
+    free(commands);
+}
+
+// 内部函数：libusb传输状态对应的错误码
+static int transfer_status_error(enum libusb_transfer_status status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED: return USB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT: return USB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_CANCELLED: return USB_ERROR_INTERRUPTED;
+        case LIBUSB_TRANSFER_STALL:     return USB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE: return USB_ERROR_NOT_FOUND;
+        case LIBUSB_TRANSFER_OVERFLOW:  return USB_ERROR_OVERFLOW;
+        default:                        return USB_ERROR_IO;
+    }
+}
+
+// 内部函数：libusb函数返回的错误对应的错误码
+static int libusb_error_to_usb(int error) {
+    switch (error) {
+        case LIBUSB_SUCCESS:               return USB_SUCCESS;
+        case LIBUSB_ERROR_INVALID_PARAM:   return USB_ERROR_INVALID;
+        case LIBUSB_ERROR_ACCESS:          return USB_ERROR_ACCESS;
+        case LIBUSB_ERROR_NO_DEVICE:       return USB_ERROR_NOT_FOUND;
+        case LIBUSB_ERROR_NOT_FOUND:       return USB_ERROR_NOT_FOUND;
+        case LIBUSB_ERROR_BUSY:            return USB_ERROR_BUSY;
+        case LIBUSB_ERROR_TIMEOUT:         return USB_ERROR_TIMEOUT;
+        case LIBUSB_ERROR_OVERFLOW:        return USB_ERROR_OVERFLOW;
+        case LIBUSB_ERROR_PIPE:            return USB_ERROR_PIPE;
+        case LIBUSB_ERROR_INTERRUPTED:     return USB_ERROR_INTERRUPTED;
+        case LIBUSB_ERROR_NO_MEM:          return USB_ERROR_NO_MEM;
+        case LIBUSB_ERROR_NOT_SUPPORTED:   return USB_ERROR_NOT_SUPPORTED;
+        default:                           return USB_ERROR_IO;
+    }
+}
+
+// 流传输错误恢复
+// 回调中不能进行同步IO，出错的传输挂起在链表中，由处理事件的线程在回调之外清除端点停止后重新提交
+static SRWLOCK g_recovery_lock = SRWLOCK_INIT;
+static usb_stream_t *g_recovery_head = NULL;
+
+// 内部函数：记录设备已断开，由事件线程等待同一序列号的设备重新出现(可在libusb回调中调用)
+// 只有当前句柄上的错误才表示断开，重连后旧句柄上残留的错误忽略
+static void device_mark_lost(usb_device_t *device, libusb_device_handle *handle) {
+    if (!device->reattach || handle != ATOMIC_LOAD(&device->handle)) return;
+    if (InterlockedCompareExchange(&device->lost, 1, 0) != 0) return;
+    device->lost_at_us = usb_timestamp_us();
+    InterlockedIncrement(&device->disconnects);
+    InterlockedIncrement(&g_reattach_pending);
+}
+
+// 内部函数：设备断开且开启了自动重连时挂起传输，重连后以新句柄重新提交，返回0表示应结束该传输
+// 与stream_destroy以g_recovery_lock互斥：置停止标志之后不再挂起
+static int stream_park_lost(usb_stream_t *stream, struct libusb_transfer *transfer) {
+    usb_device_t *device = stream->device;
+    if (!device->reattach) return 0;
+
+    int index = (int)((transfer->buffer - stream->buffers) / stream->buffer_stride);
+    int parked = 0;
+    AcquireSRWLockExclusive(&g_recovery_lock);
+    if (!stream->stopping) {
+        stream->lost |= 1u << index;
+        parked = 1;
+    }
+    ReleaseSRWLockExclusive(&g_recovery_lock);
+    if (!parked) return 0;
+
+    if (transfer->num_iso_packets > 0) stream->ring->gap_pending = 1;
+    __atomic_fetch_add(&device->lost_transfers, 1, __ATOMIC_RELAXED);
+    device_mark_lost(device, transfer->dev_handle);
+    return 1;
+}
+
+// 内部函数：释放流的一个引用，idle_event是最后一个引用对流的最后一次访问
+static void stream_unref(usb_stream_t *stream) {
+    HANDLE idle_event = stream->idle_event;
+    if (InterlockedDecrement(&stream->refs) == 0) SetEvent(idle_event);
+}
+
+// 内部函数：一个流传输不再提交，最后一个结束时唤醒读取者并结束所有等待响应的命令
+// 回调模式下以终止原因调用一次数据回调
+static void stream_transfer_finished(usb_stream_t *stream) {
+    if (InterlockedDecrement(&stream->active) == 0) {
+        if (stream->commands) commands_shutdown(stream->commands);
+        if (stream->data_callback) {
+            int reason = stream->last_error ? stream->last_error : USB_ERROR_INTERRUPTED;
+            stream->data_callback(NULL, reason, stream->data_user_data);
+        }
+        SetEvent(stream->data_event);
+    }
+    stream_unref(stream);
+}
+
+// 内部函数：重新提交流传输，已停止或提交失败时结束该传输
+static void stream_resubmit(usb_stream_t *stream, struct libusb_transfer *transfer) {
+    if (!stream->stopping) {
+        int result = fn_submit_transfer(transfer);
+        if (result == 0) return;
+        if (result == LIBUSB_ERROR_NO_DEVICE && stream_park_lost(stream, transfer)) return;
+        InterlockedExchange(&stream->last_error, libusb_error_to_usb(result));
+    }
+    stream_transfer_finished(stream);
+}
+
+// 内部函数：结束因设备断开挂起的传输(调用者持有control_lock)，流停止或关闭自动重连时调用
+static void stream_finish_lost(usb_stream_t *stream, int error) {
+    AcquireSRWLockExclusive(&g_recovery_lock);
+    unsigned int lost = stream->lost;
+    stream->lost = 0;
+    ReleaseSRWLockExclusive(&g_recovery_lock);
+    if (!lost) return;
+
+    if (error != USB_SUCCESS) InterlockedExchange(&stream->last_error, error);
+    for (int i = 0; i < stream->num_transfers; i++) {
+        if (lost & (1u << i)) stream_transfer_finished(stream);
+    }
+}
+
+// 内部函数：出错的传输挂起等待恢复(libusb回调中调用)
+// 第一次出错立即恢复，之后连续出错按指数退避，超过STREAM_MAX_RETRIES次后放弃
+static void stream_defer_recovery(usb_stream_t *stream, struct libusb_transfer *transfer) {
+    int index = (int)((transfer->buffer - stream->buffers) / stream->buffer_stride);
+    if (transfer->num_iso_packets > 0) stream->ring->gap_pending = 1;  // 整个传输的包都已丢失
+
+    AcquireSRWLockExclusive(&g_recovery_lock);
+    if (!stream->halted) {
+        LONG retries = InterlockedIncrement(&stream->retries);
+        ULONGLONG backoff = retries > 1 && retries <= STREAM_MAX_RETRIES ? (ULONGLONG)RETRY_BACKOFF_MS << (retries - 2) : 0;
+        stream->retry_at = GetTickCount64() + backoff;
+        stream->recovery_next = g_recovery_head;
+        ATOMIC_STORE(&g_recovery_head, stream);
+    }
+    stream->halted |= 1u << index;
+    if (transfer->status == LIBUSB_TRANSFER_STALL) stream->stalled = 1;
+    stream->halt_error = transfer_status_error(transfer->status);
+    ReleaseSRWLockExclusive(&g_recovery_lock);
+}
+
+// 内部函数：恢复一批挂起的传输(libusb回调之外调用)
+// 端点停止时先清除停止状态再重新提交；流正在停止、清除失败或放弃恢复(error非0)时结束这些传输
+static void stream_recover(usb_stream_t *stream, unsigned int halted, int stalled, int error) {
+    struct libusb_transfer *transfers[STREAM_MAX_TRANSFERS];
+    int count = 0;
+    for (int i = 0; i < stream->num_transfers; i++) {
+        if (halted & (1u << i)) transfers[count++] = stream->transfers[i];
+    }
+
+    InterlockedIncrement(&stream->refs);  // 最后一个传输结束后仍要访问流
+    if (error == USB_SUCCESS && stalled && !stream->stopping) {
+        // 设备已断开时照常重新提交，提交失败后按断开处理
+        int result = fn_clear_halt(transfers[0]->dev_handle, transfers[0]->endpoint);
+        if (result != 0 && result != LIBUSB_ERROR_NO_DEVICE) error = libusb_error_to_usb(result);
+    }
+    if (error != USB_SUCCESS) {
+        if (!stream->stopping) InterlockedExchange(&stream->last_error, error);
+        for (int i = 0; i < count; i++) stream_transfer_finished(stream);
+    } else {
+        if (!stream->stopping) __atomic_fetch_add(&stream->recovered, count, __ATOMIC_RELAXED);
+        for (int i = 0; i < count; i++) stream_resubmit(stream, transfers[i]);
+        // 不在回调中提交，可能与stream_destroy的取消交错，这里补上取消
+        if (stream->stopping) {
+            for (int i = 0; i < count; i++) fn_cancel_transfer(transfers[i]);
+        }
+    }
+    stream_unref(stream);
+}
+
+// 内部函数：恢复退避已到期的流传输，在处理事件的线程中、libusb回调之外调用
+// 返回距下一次退避到期的毫秒数，没有挂起的传输时返回INT_MAX
+static int stream_recovery_run(void) {
+    if (!ATOMIC_LOAD(&g_recovery_head)) return INT_MAX;
+
+    for (;;) {
+        ULONGLONG now = GetTickCount64();
+        ULONGLONG next = ULLONG_MAX;
+        usb_stream_t *stream = NULL;
+        unsigned int halted = 0;
+        int stalled = 0;
+        int error = USB_SUCCESS;
+
+        AcquireSRWLockExclusive(&g_recovery_lock);
+        for (usb_stream_t **link = &g_recovery_head; *link; link = &(*link)->recovery_next) {
+            usb_stream_t *candidate = *link;
+            if (candidate->stopping || candidate->retry_at <= now) {
+                stream = candidate;
+                ATOMIC_STORE(link, stream->recovery_next);
+                halted = stream->halted;
+                stalled = stream->stalled;
+                if (stream->retries > STREAM_MAX_RETRIES) error = stream->halt_error;
+                stream->halted = 0;
+                stream->stalled = 0;
+                break;
+            }
+            if (candidate->retry_at < next) next = candidate->retry_at;
+        }
+        ReleaseSRWLockExclusive(&g_recovery_lock);
+
+        if (!stream) return next == ULLONG_MAX ? INT_MAX : (int)(next - now);
+        stream_recover(stream, halted, stalled, error);
+    }
+}
+
+// 内部函数：数据回调收到的指针所属的流传输下标，不属于该流返回-1
+static int stream_buffer_index(const usb_stream_t *stream, const unsigned char *data) {
+    if (!stream || !stream->data_callback || data < stream->buffers) return -1;
+    size_t offset = (size_t)(data - stream->buffers);
+    if (offset >= (size_t)stream->buffer_stride * stream->num_transfers) return -1;
+    return (int)(offset / stream->buffer_stride);
+}
+
+// 内部函数：释放传输缓冲区的一个引用，回调已返回且没有保持时重新提交
+static void stream_buffer_unref(usb_stream_t *stream, int index) {
+    if (InterlockedDecrement(&stream->pending[index]) == 0) stream_resubmit(stream, stream->transfers[index]);
+}
+
+// 内部函数：放弃调用者尚未释放的保持(流停止后调用)，与USB_ReleaseBuffer竞争时每次保持只释放一次
+static void stream_drop_holds(usb_stream_t *stream) {
+    for (int i = 0; i < stream->num_transfers; i++) {
+        LONG holds = InterlockedExchange(&stream->holds[i], 0);
+        while (holds-- > 0) stream_buffer_unref(stream, i);
+    }
+}
+
+// 内部函数：把完成的传输直接交给数据回调，不复制数据
+// 回调期间传输持有一个引用，USB_HoldBuffer每次再加一个，全部释放后才重新提交
+static void stream_deliver(usb_stream_t *stream, struct libusb_transfer *transfer) {
+    usb_ring_t *ring = stream->ring;
+    int index = (int)((transfer->buffer - stream->buffers) / stream->buffer_stride);
+    InterlockedExchange(&stream->pending[index], 1);
+
+    if (transfer->num_iso_packets > 0) {
+        // 与接收队列相同：连续丢失的包只报告一次间隙，零长度包不报告
+        for (int i = 0; i < transfer->num_iso_packets; i++) {
+            const struct libusb_iso_packet_descriptor *packet = &transfer->iso_packet_desc[i];
+            if (packet->status != LIBUSB_TRANSFER_COMPLETED) {
+                ring->gap_pending = 1;
+            } else if (packet->actual_length > 0) {
+                if (ring->gap_pending) {
+                    ring->gap_pending = 0;
+                    stream->data_callback(NULL, USB_ERROR_DATA_LOST, stream->data_user_data);
+                }
+                ATOMIC_STORE(&ring->packets, ring->packets + 1);
+                stream->data_callback(transfer->buffer + (size_t)i * stream->packet_size,
+                                      packet->actual_length, stream->data_user_data);
+            }
+        }
+    } else {
+        ATOMIC_STORE(&ring->packets, ring->packets + 1);
+        stream->data_callback(transfer->buffer, transfer->actual_length, stream->data_user_data);
+    }
+
+    stream_buffer_unref(stream, index);
+}
+
+// 内部函数：等时传输的各个包按顺序入队，出错的包记为间隙，连续丢失只产生一个标记
+// 零长度包表示设备在该服务周期没有数据，不入队
+static int stream_push_iso(usb_stream_t *stream, struct libusb_transfer *transfer, unsigned long long timestamp_us) {
+    int wake = 0;
+    for (int i = 0; i < transfer->num_iso_packets; i++) {
+        const struct libusb_iso_packet_descriptor *packet = &transfer->iso_packet_desc[i];
+        if (packet->status != LIBUSB_TRANSFER_COMPLETED) {
+            stream->ring->gap_pending = 1;
+        } else if (packet->actual_length > 0) {
+            wake |= ring_push(stream->ring, transfer->buffer + (size_t)i * stream->packet_size,
+                              packet->actual_length, timestamp_us);
+        }
+    }
+    return wake;
+}
+
+// 内部函数：流式传输回调，数据入队后立即重新提交，保证端点上始终有传输在等待
+static void LIBUSB_CALL stream_transfer_callback(struct libusb_transfer *transfer) {
+    usb_stream_t *stream = (usb_stream_t*)transfer->user_data;
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        if (stream->retries) InterlockedExchange(&stream->retries, 0);
+        usb_commands_t *commands = ATOMIC_LOAD(&stream->commands);
+        int wake;
+        if (commands && commands_dispatch(commands, transfer->buffer, transfer->actual_length)) {
+            wake = 0;  // 命令的响应不进入接收队列(等时流没有命令通道)
+        } else if (stream->data_callback) {
+            stream_deliver(stream, transfer);
+            return;  // 回调返回且没有保持缓冲区时由stream_deliver重新提交
+        } else if (transfer->num_iso_packets > 0) {
+            wake = stream_push_iso(stream, transfer, usb_timestamp_us());
+        } else {
+            wake = ring_push(stream->ring, transfer->buffer, transfer->actual_length, usb_timestamp_us());
+        }
+        if (wake) SetEvent(stream->data_event);
+    } else if (transfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+        // 开启了自动重连时，设备断开的传输挂起到设备重新出现
+        if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE && stream_park_lost(stream, transfer)) return;
+
+        if (transfer->status == LIBUSB_TRANSFER_CANCELLED || transfer->status == LIBUSB_TRANSFER_NO_DEVICE ||
+            stream->stopping) {
+            if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+                InterlockedExchange(&stream->last_error, transfer_status_error(transfer->status));
+            }
+            stream_transfer_finished(stream);
+        } else {
+            // 端点停止和瞬时错误不终止流，挂起后由事件线程恢复
+            stream_defer_recovery(stream, transfer);
+        }
+        return;
+    }
+
+    stream_resubmit(stream, transfer);
+}
+
+// 内部函数(消费者)：等待环形缓冲区中有数据
+// 返回USB_SUCCESS表示有数据，超时返回USB_ERROR_TIMEOUT，流已终止且队列为空返回终止原因
+static int stream_wait(usb_stream_t *stream, ULONGLONG deadline) {
+    usb_ring_t *ring = stream->ring;
+    if (stream->data_callback) return USB_ERROR_NOT_SUPPORTED;  // 数据不经过接收队列
+
+    for (;;) {
+        if (ring_peek(ring)) return USB_SUCCESS;
+        if (stream->stopping) return USB_ERROR_INTERRUPTED;
+        if (stream->active == 0) return stream->last_error ? stream->last_error : USB_ERROR_IO;
+
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline) return USB_ERROR_TIMEOUT;
+        ULONGLONG remaining = deadline - now;
+
+        if (g_event_thread) {
+            __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+            if (!ring_peek(ring) && stream->active > 0 && !stream->stopping) {
+                WaitForSingleObject(stream->data_event, (DWORD)remaining);
+            }
+            __atomic_store_n(&ring->waiting, 0, __ATOMIC_SEQ_CST);
+        } else {
+            pump_usb_events(remaining < 100 ? (int)remaining : 100);
+        }
+    }
+}
+
+// 内部函数：进入/离开读取者临界区，保证环形缓冲区只有一个消费者
+static int stream_reader_enter(usb_stream_t *stream) {
+    return InterlockedCompareExchange(&stream->reader_busy, 1, 0) == 0;
+}
+
+static void stream_reader_leave(usb_stream_t *stream) {
+    InterlockedExchange(&stream->reader_busy, 0);
+}
+
+// 内部函数：取消所有传输，等待回调全部返回后释放流资源
+static void stream_destroy(usb_stream_t *stream) {
+    stream->stopping = 1;
+    for (int i = 0; i < stream->num_transfers; i++) {
+        if (stream->transfers[i]) fn_cancel_transfer(stream->transfers[i]);
+    }
+    stream_finish_lost(stream, USB_SUCCESS);
+
+    // 创建失败时idle_event可能不存在，此时尚未提交任何传输
+    // 挂起等待恢复的传输不会产生事件，直接在这里结束，不等事件线程下一轮
+    // 被保持的缓冲区不等调用者释放：保持者可能就是当前线程，或者永远不会释放(卸载时)；
+    // 停止前最后一次回调仍可能保持缓冲区，因此每轮等待前都重新放弃
+    stream_unref(stream);
+    stream_recovery_run();
+    while (stream->idle_event) {
+        stream_drop_holds(stream);
+        if (WaitForSingleObject(stream->idle_event, g_event_thread ? EVENT_POLL_MAX_MS : 0) == WAIT_OBJECT_0) break;
+        if (!g_event_thread) pump_usb_events(100);
+    }
+
+    for (int i = 0; i < stream->num_transfers; i++) pool_put_transfer(stream->pool, stream->transfers[i]);
+    pool_free(stream->pool, stream->buffers);
+    ring_destroy(stream->pool, stream->ring);
+    if (stream->commands) {
+        commands_shutdown(stream->commands);
+        commands_destroy(stream->commands);
+    }
+    if (stream->data_event) CloseHandle(stream->data_event);
+    if (stream->idle_event) CloseHandle(stream->idle_event);
+    free(stream);
+}
+
+// 内部函数：关闭重连替换下的旧句柄(调用者持有control_lock和io_lock独占锁，或设备已失效)
+// 旧句柄分配的空闲设备内存先释放；仍有缓冲区在使用时保留该句柄，待流或写入状态归还缓冲区后再关闭
+static void device_close_retired(usb_device_t *device) {
+    usb_pool_t *pool = &device->pool;
+    int kept = 0;
+    for (int r = 0; r < device->num_retired; r++) {
+        libusb_device_handle *handle = device->retired[r];
+        int in_use = 0;
+        AcquireSRWLockExclusive(&pool->lock);
+        for (int i = pool->num_blocks - 1; i >= 0; i--) {
+            if (pool->blocks[i].handle != handle) continue;
+            if (pool->blocks[i].in_use) {
+                in_use = 1;
+            } else {
+                pool_drop_block(pool, i);
+            }
+        }
+        ReleaseSRWLockExclusive(&pool->lock);
+        if (in_use) {
+            device->retired[kept++] = handle;
+        } else {
+            fn_close(handle);
+        }
+    }
+    device->num_retired = kept;
+}
+
+// 内部函数：从设备上摘下流(调用者持有control_lock)
+// 先置停止标志并唤醒阻塞中的读取者，再取独占锁等待其退出，之后流可以安全销毁
+static usb_stream_t* device_detach_stream(usb_device_t *device) {
+    usb_stream_t *stream = device->stream;
+    if (!stream) return NULL;
+
+    InterlockedExchange(&stream->stopping, 1);
+    SetEvent(stream->data_event);
+    if (stream->commands) commands_shutdown(stream->commands);
+
+    AcquireSRWLockExclusive(&device->io_lock);
+    device->stream = NULL;
+    device->draining = stream;
+    ReleaseSRWLockExclusive(&device->io_lock);
+    return stream;
+}
+
+// 内部函数：停止并销毁设备的流(调用者持有control_lock)，没有流返回0
+// 销毁会等待保持的缓冲区全部释放，期间仍可通过draining找到该流
+static int device_stop_stream(usb_device_t *device) {
+    usb_stream_t *stream = device_detach_stream(device);
+    if (!stream) return 0;
+
+    // 预读依附于流，流停止后USB_ReadData恢复为同步传输
+    InterlockedExchange(&device->prefetch, PREFETCH_OFF);
+    stream_destroy(stream);
+    AcquireSRWLockExclusive(&device->io_lock);
+    device->draining = NULL;
+    device_close_retired(device);  // 流的缓冲区已归还，旧句柄不再被引用
+    ReleaseSRWLockExclusive(&device->io_lock);
+    return 1;
+}
+
+// 内部函数：流接收队列每个槽位的大小
+static int config_slot_size(const device_config_t *config) {
+    return config->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS ? config->packet_size : config->buffer_size;
+}
+
+// 内部函数：按设备当前配置从池中取出传输和缓冲区并提交
+static int stream_create(usb_device_t *device, int num_transfers, int queue_packets, usb_stream_t **out) {
+    const device_config_t *config = &device->config;
+    usb_stream_t *stream = (usb_stream_t*)calloc(1, sizeof(usb_stream_t));
+    if (!stream) return USB_ERROR_NO_MEM;
+
+    // 等时传输的每个包占一个队列槽位
+    int iso_packets = config->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS ? config->buffer_size / config->packet_size : 0;
+    stream->device = device;
+    stream->pool = &device->pool;
+    stream->num_transfers = num_transfers;
+    stream->buffer_size = config->buffer_size;
+    stream->buffer_stride = (int)CACHE_LINE_ROUND(config->buffer_size);
+    stream->packet_size = iso_packets ? config->packet_size : 0;
+    stream->refs = 1;
+    stream->data_callback = device->data_callback;
+    stream->data_user_data = device->data_user_data;
+    stream->ring = ring_create(stream->pool, queue_packets, config_slot_size(config));
+    if (stream->ring) stream->ring->mark_gaps = iso_packets > 0;
+    stream->buffers = (unsigned char*)pool_alloc(stream->pool, (size_t)stream->buffer_stride * num_transfers, POOL_DEVICE_MEMORY);
+    stream->data_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    stream->idle_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!stream->ring || !stream->buffers || !stream->data_event || !stream->idle_event) {
+        stream_destroy(stream);
+        return USB_ERROR_NO_MEM;
+    }
+
+    for (int i = 0; i < num_transfers; i++) {
+        struct libusb_transfer *transfer = pool_get_transfer(stream->pool, iso_packets);
+        if (!transfer) {
+            stream_destroy(stream);
+            return USB_ERROR_NO_MEM;
+        }
+        transfer->num_iso_packets = iso_packets;
+        for (int k = 0; k < iso_packets; k++) transfer->iso_packet_desc[k].length = config->packet_size;
+        transfer->dev_handle = device->handle;
+        transfer->flags = 0;
+        transfer->endpoint = config->endpoint;
+        transfer->type = config->type;
+        transfer->timeout = 0;
+        transfer->buffer = stream->buffers + (size_t)i * stream->buffer_stride;
+        transfer->length = config->buffer_size;
+        transfer->callback = stream_transfer_callback;
+        transfer->user_data = stream;
+        stream->transfers[i] = transfer;
+    }
+
+    for (int i = 0; i < num_transfers; i++) {
+        InterlockedIncrement(&stream->active);
+        InterlockedIncrement(&stream->refs);
+        int result = fn_submit_transfer(stream->transfers[i]);
+        if (result != 0) {
+            InterlockedDecrement(&stream->refs);
+            InterlockedDecrement(&stream->active);
+            stream_destroy(stream);
+            return libusb_error_to_usb(result);
+        }
+    }
+
+    *out = stream;
+    return USB_SUCCESS;
+}
+
+// 内部函数：流式传输默认同时提交的传输数量
+static int stream_default_transfers(const device_config_t *config) {
+    return config->type == LIBUSB_TRANSFER_TYPE_BULK ? STREAM_BULK_DEFAULT_TRANSFERS : STREAM_DEFAULT_TRANSFERS;
+}
+
+// 内部函数：按设备当前配置启动流式读取(调用者持有control_lock且已确认句柄有效)
+static int device_start_stream(usb_device_t *device, int num_transfers, int queue_packets) {
+    int result;
+    usb_stream_t *stream = NULL;
+    if (num_transfers <= 0) num_transfers = stream_default_transfers(&device->config);
+    int slot_size = config_slot_size(&device->config);
+    if (queue_packets <= 0) {
+        // 默认队列按字节数限制，大缓冲区的批量流不会默认占用过多内存，但至少能容纳两轮传输
+        int packets_per_transfer = device->config.buffer_size / slot_size;
+        queue_packets = STREAM_DEFAULT_QUEUE_BYTES / slot_size;
+        if (queue_packets > STREAM_DEFAULT_QUEUE) queue_packets = STREAM_DEFAULT_QUEUE;
+        if (queue_packets < num_transfers * packets_per_transfer * 2) queue_packets = num_transfers * packets_per_transfer * 2;
+        if (queue_packets > STREAM_MAX_QUEUE) queue_packets = STREAM_MAX_QUEUE;
+    }
+    if (device->data_callback) queue_packets = 1;  // 回调模式不使用接收队列，只保留间隙状态和统计
+    if (device->stream) {
+        result = USB_ERROR_BUSY;
+    } else if ((unsigned long long)queue_packets * (slot_size + sizeof(ring_slot_t)) > STREAM_MAX_QUEUE_BYTES) {
+        result = USB_ERROR_INVALID;
+    } else {
+        result = stream_create(device, num_transfers, queue_packets, &stream);
+        if (result == USB_SUCCESS) {
+            AcquireSRWLockExclusive(&device->io_lock);
+            device->stream = stream;
+            ReleaseSRWLockExclusive(&device->io_lock);
+        }
+    }
+    return result;
+}
+
+// 内部函数：选择写入使用的OUT端点，优先取与读取端点编号相同的，否则取当前备用设置中第一个中断或批量OUT端点
+static void device_out_endpoint(const usb_device_t *device, usb_endpoint_info_t *out) {
+    const usb_endpoint_info_t *match = NULL;
+    for (int i = 0; i < device->num_endpoints; i++) {
+        const usb_endpoint_info_t *endpoint = &device->endpoints[i];
+        if ((endpoint->address & LIBUSB_ENDPOINT_IN) || endpoint->alt_setting != device->alt_setting) continue;
+        if (endpoint->transfer_type != LIBUSB_TRANSFER_TYPE_INTERRUPT && endpoint->transfer_type != LIBUSB_TRANSFER_TYPE_BULK) continue;
+        if (!match) match = endpoint;
+        if ((endpoint->address & 0x0F) == (device->config.endpoint & 0x0F)) {
+            match = endpoint;
+            break;
+        }
+    }
+
+    if (match) {
+        *out = *match;
+    } else {
+        memset(out, 0, sizeof(*out));
+        out->address = DEFAULT_OUT_ENDPOINT;
+        out->transfer_type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+        out->max_packet_size = DEFAULT_PACKET_SIZE;
+    }
+}
+
+// 内部函数：释放一个写入引用，置位idle_event是最后一次访问写入对象
+static void writer_unref(usb_writer_t *writer) {
+    HANDLE idle_event = writer->idle_event;
+    if (InterlockedDecrement(&writer->refs) == 0) SetEvent(idle_event);
+}
+
+// 内部函数：提交正在合并的传输(调用者持有writer->lock)
+static int writer_submit_staging(usb_writer_t *writer) {
+    if (writer->staging < 0 || writer->staged == 0) return USB_SUCCESS;
+
+    struct libusb_transfer *transfer = writer->transfers[writer->staging];
+    transfer->dev_handle = ATOMIC_LOAD(&writer->device->handle);
+    transfer->length = writer->staged;
+    writer->inflight++;
+    InterlockedIncrement(&writer->refs);
+    int result = fn_submit_transfer(transfer);
+    if (result != 0) {
+        InterlockedDecrement(&writer->refs);
+        writer->inflight--;
+        writer->completed += writer->staged;
+        writer->free_slots[writer->num_free++] = writer->staging;
+        if (result == LIBUSB_ERROR_NO_DEVICE) {
+            __atomic_fetch_add(&writer->device->lost_write_bytes, writer->staged, __ATOMIC_RELAXED);
+            device_mark_lost(writer->device, transfer->dev_handle);
+        }
+        result = libusb_error_to_usb(result);
+    }
+    writer->staging = -1;
+    writer->staged = 0;
+    return result;
+}
+
+// 内部函数：写入传输回调，释放传输并趁流水线有空位提交正在合并的数据
+static void LIBUSB_CALL writer_transfer_callback(struct libusb_transfer *transfer) {
+    usb_writer_t *writer = (usb_writer_t*)transfer->user_data;
+
+    EnterCriticalSection(&writer->lock);
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED && !writer->last_error) {
+        writer->last_error = transfer_status_error(transfer->status);
+    }
+    if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+        __atomic_fetch_add(&writer->device->lost_write_bytes, transfer->length, __ATOMIC_RELAXED);
+        device_mark_lost(writer->device, transfer->dev_handle);
+    }
+    writer->completed += transfer->length;
+    writer->inflight--;
+    writer->free_slots[writer->num_free++] = (int)((transfer->buffer - writer->buffers) / writer->buffer_stride);
+    if (!writer->closing) {
+        int result = writer_submit_staging(writer);
+        if (result != USB_SUCCESS && !writer->last_error) writer->last_error = result;
+    }
+    WakeAllConditionVariable(&writer->progress);
+    LeaveCriticalSection(&writer->lock);
+
+    writer_unref(writer);
+}
+
+// 内部函数：等待有传输完成(调用者持有writer->lock)，已超时返回0
+static int writer_wait(usb_writer_t *writer, ULONGLONG deadline) {
+    ULONGLONG now = GetTickCount64();
+    if (now >= deadline) return 0;
+    ULONGLONG remaining = deadline - now;
+
+    if (g_event_thread) {
+        SleepConditionVariableCS(&writer->progress, &writer->lock, (DWORD)remaining);
+    } else {
+        LeaveCriticalSection(&writer->lock);
+        pump_usb_events(remaining < 100 ? (int)remaining : 100);
+        EnterCriticalSection(&writer->lock);
+    }
+    return 1;
+}
+
+// 内部函数：取出尚未报告的传输错误(调用者持有writer->lock)
+static int writer_take_error(usb_writer_t *writer) {
+    int result = writer->last_error;
+    writer->last_error = USB_SUCCESS;
+    return result;
+}
+
+// 内部函数：报告端点停止后清除OUT端点的停止状态，之后的写入无需重新打开设备(不能持有writer->lock)
+// 出错的数据可能已部分发送，不自动重发
+static void writer_recover(usb_writer_t *writer, int result) {
+    if (result == USB_ERROR_PIPE) fn_clear_halt(ATOMIC_LOAD(&writer->device->handle), writer->transfers[0]->endpoint);
+}
+
+// 内部函数：把数据合并进写入队列，所有传输都在途时等待，返回接受的字节数或错误码
+// message非0时数据单独占用传输并立即提交，不与前后的写入合并，长度不能超过一个传输
+static int writer_write(usb_writer_t *writer, const unsigned char *data, int length, ULONGLONG deadline, int message) {
+    if (message && length > writer->buffer_size) return USB_ERROR_INVALID;
+
+    EnterCriticalSection(&writer->lock);
+    int result = writer_take_error(writer);
+    int written = 0;
+    while (result == USB_SUCCESS && written < length) {
+        if (writer->closing) {
+            result = USB_ERROR_INTERRUPTED;
+            break;
+        }
+        // 等待期间其他线程可能开始合并新的数据，取传输之前每次都先提交
+        if (message) {
+            result = writer_submit_staging(writer);
+            if (result != USB_SUCCESS) break;
+        }
+        if (writer->staging < 0) {
+            if (writer->num_free == 0) {
+                if (!writer_wait(writer, deadline)) result = USB_ERROR_TIMEOUT;
+                continue;
+            }
+            writer->staging = writer->free_slots[--writer->num_free];
+            writer->staged = 0;
+        }
+
+        int n = writer->buffer_size - writer->staged;
+        if (n > length - written) n = length - written;
+        memcpy(writer->buffers + (size_t)writer->staging * writer->buffer_stride + writer->staged, data + written, n);
+        writer->staged += n;
+        writer->queued += n;
+        written += n;
+
+        // 合并满一个传输或流水线空闲时立即提交，否则等下一个传输完成时再提交
+        if (writer->staged == writer->buffer_size || writer->inflight == 0 || (message && written == length)) {
+            result = writer_submit_staging(writer);
+        }
+    }
+    LeaveCriticalSection(&writer->lock);
+
+    writer_recover(writer, result);
+    return result == USB_SUCCESS ? written : result;
+}
+
+// 内部函数：提交正在合并的数据并等待此前接受的数据全部完成，返回第一个未报告的错误
+static int writer_flush(usb_writer_t *writer, ULONGLONG deadline) {
+    EnterCriticalSection(&writer->lock);
+    unsigned long long target = writer->queued;
+    int result = writer_submit_staging(writer);
+    while (result == USB_SUCCESS && writer->completed < target) {
+        if (writer->closing) {
+            result = USB_ERROR_INTERRUPTED;
+        } else if (!writer_wait(writer, deadline)) {
+            result = USB_ERROR_TIMEOUT;
+        }
+    }
+    if (result == USB_SUCCESS) result = writer_take_error(writer);
+    LeaveCriticalSection(&writer->lock);
+
+    writer_recover(writer, result);
+    return result;
+}
+
+// 内部函数：取消在途的写入，等待回调全部返回后释放资源
+static void writer_destroy(usb_writer_t *writer) {
+    EnterCriticalSection(&writer->lock);
+    writer->closing = 1;
+    WakeAllConditionVariable(&writer->progress);
+    LeaveCriticalSection(&writer->lock);
+
+    for (int i = 0; i < WRITE_TRANSFERS; i++) {
+        if (writer->transfers[i]) fn_cancel_transfer(writer->transfers[i]);
+    }
+    writer_unref(writer);
+    while (writer->idle_event &&
+           WaitForSingleObject(writer->idle_event, g_event_thread ? EVENT_POLL_MAX_MS : 0) != WAIT_OBJECT_0) {
+        if (!g_event_thread) pump_usb_events(100);
+    }
+
+    for (int i = 0; i < WRITE_TRANSFERS; i++) pool_put_transfer(writer->pool, writer->transfers[i]);
+    pool_free(writer->pool, writer->buffers);
+    if (writer->idle_event) CloseHandle(writer->idle_event);
+    DeleteCriticalSection(&writer->lock);
+    free(writer);
+}
+
+// 内部函数：写入传输的缓冲区大小，中断端点每个传输合并一个包，批量端点合并多个包
+static int writer_buffer_size(const usb_endpoint_info_t *endpoint) {
+    int size = endpoint->max_packet_size ? endpoint->max_packet_size : DEFAULT_PACKET_SIZE;
+    if (endpoint->transfer_type == LIBUSB_TRANSFER_TYPE_BULK) size = WRITE_BULK_BUFFER_SIZE - WRITE_BULK_BUFFER_SIZE % size;
+    return size;
+}
+
+// 内部函数：为设备当前配置创建写入状态，传输和缓冲区取自设备的池
+static usb_writer_t* writer_create(usb_device_t *device) {
+    usb_endpoint_info_t endpoint;
+    device_out_endpoint(device, &endpoint);
+
+    usb_writer_t *writer = (usb_writer_t*)calloc(1, sizeof(usb_writer_t));
+    if (!writer) return NULL;
+    InitializeCriticalSection(&writer->lock);
+    InitializeConditionVariable(&writer->progress);
+    writer->device = device;
+    writer->pool = &device->pool;
+    writer->refs = 1;
+    writer->staging = -1;
+    writer->buffer_size = writer_buffer_size(&endpoint);
+    writer->buffer_stride = (int)CACHE_LINE_ROUND(writer->buffer_size);
+    writer->buffers = (unsigned char*)pool_alloc(writer->pool, (size_t)writer->buffer_stride * WRITE_TRANSFERS, POOL_DEVICE_MEMORY);
+    writer->idle_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!writer->buffers || !writer->idle_event) {
+        writer_destroy(writer);
+        return NULL;
+    }
+
+    for (int i = 0; i < WRITE_TRANSFERS; i++) {
+        struct libusb_transfer *transfer = pool_get_transfer(writer->pool, 0);
+        if (!transfer) {
+            writer_destroy(writer);
+            return NULL;
+        }
+        transfer->flags = 0;
+        transfer->endpoint = endpoint.address;
+        transfer->type = endpoint.transfer_type;
+        transfer->timeout = device->config.timeout_ms;
+        transfer->buffer = writer->buffers + (size_t)i * writer->buffer_stride;
+        transfer->length = 0;
+        transfer->callback = writer_transfer_callback;
+        transfer->user_data = writer;
+        writer->transfers[i] = transfer;
+        writer->free_slots[writer->num_free++] = i;
+    }
+    return writer;
+}
+
+// 内部函数：获取设备的写入状态，不存在时创建(调用者持有io_lock共享锁)
+// 并发创建时只有一个能发布，其余的尚未提交任何传输，直接销毁
+static usb_writer_t* device_get_writer(usb_device_t *device) {
+    usb_writer_t *writer = device->writer;
+    if (writer) return writer;
+
+    writer = writer_create(device);
+    if (!writer) return NULL;
+    usb_writer_t *existing = (usb_writer_t*)InterlockedCompareExchangePointer((void* volatile*)&device->writer, writer, NULL);
+    if (existing) {
+        writer_destroy(writer);
+        return existing;
+    }
+    return writer;
+}
+
+// 内部函数：按默认配置预分配流和写入使用的传输和缓冲区(接收队列较大，第一次启动流时才分配)
+// 预分配失败不影响打开设备，之后按需分配
+static void pool_prefill(usb_device_t *device) {
+    usb_pool_t *pool = &device->pool;
+    const device_config_t *config = &device->config;
+    int num_transfers = stream_default_transfers(config);
+    int iso_packets = config->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS ? config->buffer_size / config->packet_size : 0;
+    usb_endpoint_info_t endpoint;
+    device_out_endpoint(device, &endpoint);
+
+    struct libusb_transfer *transfers[STREAM_MAX_TRANSFERS + WRITE_TRANSFERS];
+    for (int i = 0; i < num_transfers + WRITE_TRANSFERS; i++) {
+        transfers[i] = pool_get_transfer(pool, i < num_transfers ? iso_packets : 0);
+    }
+    void *stream_buffers = pool_alloc(pool, CACHE_LINE_ROUND(config->buffer_size) * num_transfers, POOL_DEVICE_MEMORY);
+    void *writer_buffers = pool_alloc(pool, CACHE_LINE_ROUND(writer_buffer_size(&endpoint)) * WRITE_TRANSFERS, POOL_DEVICE_MEMORY);
+
+    for (int i = 0; i < num_transfers + WRITE_TRANSFERS; i++) pool_put_transfer(pool, transfers[i]);
+    pool_free(pool, stream_buffers);
+    pool_free(pool, writer_buffers);
+}
+
+// 内部函数：从设备上摘下写入状态(调用者持有control_lock)，先唤醒等待中的写入者再取独占锁
+static usb_writer_t* device_detach_writer(usb_device_t *device) {
+    usb_writer_t *writer = device->writer;
+    if (!writer) return NULL;
+
+    EnterCriticalSection(&writer->lock);
+    writer->closing = 1;
+    WakeAllConditionVariable(&writer->progress);
+    LeaveCriticalSection(&writer->lock);
+
+    AcquireSRWLockExclusive(&device->io_lock);
+    device->writer = NULL;
+    ReleaseSRWLockExclusive(&device->io_lock);
+    return writer;
+}
+
+// 内部函数：清除断开标志(调用者持有control_lock)
+static void device_clear_lost(usb_device_t *device) {
+    if (InterlockedExchange(&device->lost, 0) != 0) InterlockedDecrement(&g_reattach_pending);
+}
+
+// 内部函数：把重新出现的设备换上新句柄(调用者持有control_lock，新句柄已声明接口0)
+// 流的传输全部因断开挂起后才能替换，仍有传输在途或等待恢复时返回USB_ERROR_BUSY，事件线程稍后重试
+// 挂起的传输改用新句柄重新提交，流对象、接收队列和回调保持不变；写入状态每次提交时取当前句柄
+static int device_rebind(usb_device_t *device, libusb_device_handle *handle) {
+    usb_stream_t *stream = device->stream;
+    if (stream) {
+        AcquireSRWLockShared(&g_recovery_lock);
+        int parked = __builtin_popcount(stream->lost) == stream->active;
+        ReleaseSRWLockShared(&g_recovery_lock);
+        if (!parked) return USB_ERROR_BUSY;
+    }
+    if (device->alt_setting != 0) {
+        int result = fn_set_interface_alt_setting(handle, 0, device->alt_setting);
+        if (result != 0) return libusb_error_to_usb(result);
+    }
+    libusb_device_handle **retired = (libusb_device_handle**)realloc(device->retired,
+                                                                     (device->num_retired + 1) * sizeof(*retired));
+    if (!retired) return USB_ERROR_NO_MEM;
+    device->retired = retired;
+    device->retired[device->num_retired++] = device->handle;
+
+    AcquireSRWLockExclusive(&device->pool.lock);
+    device->pool.handle = handle;
+    ReleaseSRWLockExclusive(&device->pool.lock);
+    ATOMIC_STORE(&device->handle, handle);
+
+    if (stream) {
+        AcquireSRWLockExclusive(&g_recovery_lock);
+        unsigned int lost = stream->lost;
+        stream->lost = 0;
+        ReleaseSRWLockExclusive(&g_recovery_lock);
+        for (int i = 0; i < stream->num_transfers; i++) stream->transfers[i]->dev_handle = handle;
+        for (int i = 0; i < stream->num_transfers; i++) {
+            if (lost & (1u << i)) stream_resubmit(stream, stream->transfers[i]);
+        }
+    }
+
+    unsigned long long downtime = usb_timestamp_us() - device->lost_at_us;
+    device->last_downtime_us = downtime;
+    device->downtime_us += downtime;
+    InterlockedIncrement(&device->reattaches);
+    device_clear_lost(device);
+
+    // 同步读取可能仍在使用旧句柄，不等待，关闭不了的留到下次持有独占锁时
+    if (TryAcquireSRWLockExclusive(&device->io_lock)) {
+        device_close_retired(device);
+        ReleaseSRWLockExclusive(&device->io_lock);
+    }
+    return USB_SUCCESS;
+}
+
+// 内部函数：在设备列表中查找已断开设备的序列号，找到后声明接口0并替换句柄(事件线程中调用)
+// 打开设备不持有control_lock，替换前再确认设备仍在等待重连
+static void device_reattach(usb_device_t *device, libusb_device **list, ssize_t count) {
+    char serial[sizeof(device->serial)];
+    int handle_id = make_device_handle(device);
+    memcpy(serial, device->serial, sizeof(serial));
+    if (resolve_device(handle_id) != device) return;
+
+    int have_cached;
+    libusb_device_handle *handle = open_serial_in_list(list, count, serial, &have_cached);
+    if (!handle) return;
+    if (fn_claim_interface(handle, 0) != 0) {
+        fn_close(handle);
+        return;
+    }
+
+    int result = USB_ERROR_NOT_FOUND;
+    EnterCriticalSection(&device->control_lock);
+    if (resolve_device(handle_id) == device && device->lost && device->reattach) result = device_rebind(device, handle);
+    LeaveCriticalSection(&device->control_lock);
+    if (result != USB_SUCCESS) {
+        fn_release_interface(handle, 0);
+        fn_close(handle);
+    }
+}
+
+// 内部函数：为所有已断开的设备查找重新出现的同一序列号设备(事件线程中调用)
+static void device_reattach_run(void) {
+    libusb_device **list = NULL;
+    ssize_t count = 0;
+    int devices = ATOMIC_LOAD(&g_device_count);
+    usb_device_t **map = ATOMIC_LOAD(&g_device_map);
+    for (int i = 0; i < devices; i++) {
+        usb_device_t *device = map[i];
+        if (!ATOMIC_LOAD(&device->in_use) || !ATOMIC_LOAD(&device->lost)) continue;
+        if (!list) {
+            count = fn_get_device_list(g_ctx, &list);
+            if (count < 0) return;
+        }
+        device_reattach(device, list, count);
+    }
+    if (list) fn_free_device_list(list, 1);
+}
+
+// 导出函数实现
+USB_API int USB_ScanDevice(device_info_t* devices, int max_devices) {
+    if (!devices || max_devices <= 0) return USB_ERROR_INVALID;
+
+    int result = initialize_usb();
+    if (result != USB_SUCCESS) return result;
+
+    // 有热插拔通知时缓存总是最新的，否则比较一次设备列表
+    if (!g_hotplug_registered || g_cache_dirty || !g_cache_valid) {
+        result = device_cache_refresh();
+        if (result != USB_SUCCESS && !g_cache_valid) return result;
+    }
+
+    AcquireSRWLockShared(&g_cache_lock);
+    int found = g_cache_count < max_devices ? g_cache_count : max_devices;
+    for (int i = 0; i < found; i++) {
+        devices[i] = g_cache[i].info.info;
+    }
+    ReleaseSRWLockShared(&g_cache_lock);
+
+    return found;
+}
+
+USB_API int USB_ScanDeviceEx(device_info_ex_t* devices, int max_devices, int flags) {
+    if (!devices || max_devices <= 0 || (flags & ~USB_SCAN_NO_OPEN)) return USB_ERROR_INVALID;
+
+    int result = initialize_usb();
+    if (result != USB_SUCCESS) return result;
+
+    if (!(flags & USB_SCAN_NO_OPEN)) {
+        if (!g_hotplug_registered || g_cache_dirty || !g_cache_valid) {
+            result = device_cache_refresh();
+            if (result != USB_SUCCESS && !g_cache_valid) return result;
+        }
+
+        AcquireSRWLockShared(&g_cache_lock);
+        int found = g_cache_count < max_devices ? g_cache_count : max_devices;
+        for (int i = 0; i < found; i++) {
+            devices[i] = g_cache[i].info;
+        }
+        ReleaseSRWLockShared(&g_cache_lock);
+        return found;
+    }
+
+    // 只枚举描述符，序列号取自设备缓存或位置缓存，未知时为空
+    libusb_device **list;
+    ssize_t count = fn_get_device_list(g_ctx, &list);
+    if (count < 0) return USB_ERROR_IO;
+
+    int found = 0;
+    for (ssize_t i = 0; i < count && found < max_devices; i++) {
+        struct libusb_device_descriptor desc;
+        if (!is_target_device(list[i], &desc)) continue;
+
+        device_location_t location;
+        get_device_location(list[i], &location);
+        device_info_ex_t *info = &devices[found++];
+        fill_device_info_ex(list[i], &desc, &location, info);
+
+        AcquireSRWLockShared(&g_cache_lock);
+        for (int j = 0; j < g_cache_count; j++) {
+            if (same_enumeration(&g_cache[j].location, &location)) {
+                memcpy(info->info.serial_number, g_cache[j].info.info.serial_number, sizeof(info->info.serial_number));
+                break;
+            }
+        }
+        ReleaseSRWLockShared(&g_cache_lock);
+    }
+    fn_free_device_list(list, 1);
+
+    return found;
+}
+
+USB_API int USB_ScanChanges(unsigned long long* cursor, device_info_t* added, int max_added, int* num_added,
+                            device_info_t* removed, int max_removed, int* num_removed) {
+    if (!cursor || !num_added || !num_removed) return USB_ERROR_INVALID;
+    if ((max_added > 0 && !added) || (max_removed > 0 && !removed)) return USB_ERROR_INVALID;
+
+    int result = initialize_usb();
+    if (result != USB_SUCCESS) return result;
+
+    // 有热插拔通知或事件线程定期刷新时，空闲轮询只比较版本号
+    InterlockedExchange(&g_cache_tracking, 1);
+    if (!g_cache_valid || g_cache_dirty || (!g_hotplug_registered && !g_event_thread)) {
+        result = device_cache_refresh();
+        if (result != USB_SUCCESS && !g_cache_valid) return result;
+    }
+
+    unsigned long long since = *cursor;
+    int adds = 0, removes = 0;
+    AcquireSRWLockShared(&g_cache_lock);
+    if (since > g_topology_version || (since != 0 && since < g_change_log_floor)) {
+        // 游标无效或其后的离开记录已被覆盖，调用者需要以0重新获取全部设备
+        ReleaseSRWLockShared(&g_cache_lock);
+        *num_added = *num_removed = 0;
+        return USB_ERROR_INTERRUPTED;
+    }
+    if (since != g_topology_version) {
+        for (int i = 0; i < g_cache_count; i++) {
+            if (g_cache[i].version <= since) continue;
+            if (adds < max_added) added[adds] = g_cache[i].info.info;
+            adds++;
+        }
+        // 游标为0时只返回当前设备；在游标之后到达又离开的设备不报告
+        unsigned long long logged = g_change_log_count < CHANGE_LOG_SIZE ? g_change_log_count : CHANGE_LOG_SIZE;
+        for (unsigned long long n = g_change_log_count - logged; since && n < g_change_log_count; n++) {
+            change_log_entry_t *log = &g_change_log[n % CHANGE_LOG_SIZE];
+            if (log->departed <= since || log->arrived > since) continue;
+            if (removes < max_removed) removed[removes] = log->info;
+            removes++;
+        }
+    }
+    unsigned long long version = g_topology_version;
+    ReleaseSRWLockShared(&g_cache_lock);
+
+    *num_added = adds;
+    *num_removed = removes;
+    if (adds > max_added || removes > max_removed) return USB_ERROR_OVERFLOW;
+    *cursor = version;
+    return USB_SUCCESS;
+}
+
+USB_API int USB_OpenDeviceEx(const char* target_serial) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    if (find_device_handle(target_serial)) return USB_ERROR_BUSY;
+
+    int result = initialize_usb();
+    if (result != USB_SUCCESS) return result;
+
+    libusb_device **list;
+    ssize_t count = fn_get_device_list(g_ctx, &list);
+    if (count < 0) return USB_ERROR_IO;
+
+    int have_cached;
+    libusb_device_handle *handle = open_serial_in_list(list, count, target_serial, &have_cached);
+    fn_free_device_list(list, 1);
+    if (!handle) {
+        if (have_cached) location_forget(target_serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+
+    result = fn_claim_interface(handle, 0);
+    if (result != 0) {
+        fn_close(handle);
+        return libusb_error_to_usb(result);  // 通常是被其他进程占用(USB_ERROR_BUSY)或没有权限
+    }
+    usb_endpoint_info_t endpoints[USB_MAX_ENDPOINTS];
+    int num_endpoints = discover_endpoints(handle, endpoints);
+    result = add_device_mapping(target_serial, handle, endpoints, num_endpoints);
+    if (result <= 0) {
+        // 其他线程同时打开了该设备
+        fn_release_interface(handle, 0);
+        fn_close(handle);
+        return result;
+    }
+
+    // 设备已发布，预分配与关闭设备在control_lock下互斥
+    usb_device_t *device = resolve_device(result);
+    if (device) {
+        EnterCriticalSection(&device->control_lock);
+        if (resolve_device(result) == device) pool_prefill(device);
+        LeaveCriticalSection(&device->control_lock);
+    }
+    return result;
+}
+
+USB_API int USB_OpenDevice(const char* target_serial) {
+    int handle = USB_OpenDeviceEx(target_serial);
+    return handle > 0 ? USB_SUCCESS : handle;
+}
+
+USB_API int USB_GetDeviceHandle(const char* target_serial) {
+    if (!target_serial) return USB_ERROR_INVALID;
+
+    int handle = find_device_handle(target_serial);
+    return handle ? handle : USB_ERROR_NOT_FOUND;
+}
+
+USB_API int USB_CloseDeviceEx(int handle) {
+    usb_device_t *device = begin_remove_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    InterlockedExchange(&device->reattach, 0);
+    device_stop_stream(device);
+    usb_writer_t *writer = device_detach_writer(device);
+    if (writer) writer_destroy(writer);
+    invalidate_device(device);
+    // 摘下写入状态之后、句柄失效之前的写入可能重新创建了写入状态
+    writer = device->writer;
+    device->writer = NULL;
+    if (writer) writer_destroy(writer);
+    pool_release(&device->pool);
+    device_close_retired(device);
+    free(device->retired);
+    device->retired = NULL;
+    device_clear_lost(device);
+    LeaveCriticalSection(&device->control_lock);
+
+    fn_release_interface(device->handle, 0);
+    fn_close(device->handle);
+    finish_remove_device(device);
+
+    return USB_SUCCESS;
+}
+
+USB_API int USB_CloseDevice(const char* target_serial) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_CloseDeviceEx(find_device_handle(target_serial));
+}
+
+// 内部函数：预读模式下从流接收队列读取(调用者持有io_lock共享锁)
+// 超时与同步读取相同，批量端点按字节流读取，中断端点每次返回一个数据包，放不下时丢弃该包
+static int prefetch_read(usb_device_t *device, unsigned char *data, int length) {
+    usb_stream_t *stream = device->stream;
+    ULONGLONG deadline = GetTickCount64() + device->config.timeout_ms;  // USB_ConfigureDevice把0换算为默认值
+    int result;
+
+    EnterCriticalSection(&device->read_lock);
+    if (!stream_reader_enter(stream)) {
+        result = USB_ERROR_BUSY;  // USB_ReadStream等正在读取同一队列
+    } else {
+        if (device->config.type == LIBUSB_TRANSFER_TYPE_BULK) {
+            do {
+                result = stream_wait(stream, deadline);
+                if (result == USB_SUCCESS) result = ring_read_bytes(stream->ring, data, length);
+            } while (result == 0);
+        } else {
+            result = stream_wait(stream, deadline);
+            if (result == USB_SUCCESS) {
+                ring_slot_t *slot = ring_peek(stream->ring);
+                int remaining = (int)(slot->length - stream->ring->read_offset);
+                if (remaining > length) {
+                    result = USB_ERROR_OVERFLOW;
+                } else {
+                    memcpy(data, (unsigned char*)(slot + 1) + stream->ring->read_offset, remaining);
+                    result = remaining;
+                }
+                ring_advance(stream->ring);
+            }
+        }
+        stream_reader_leave(stream);
+    }
+    LeaveCriticalSection(&device->read_lock);
+    return result;
+}
+
+// 内部函数：同步读取(调用者持有io_lock共享锁)
+// 端点停止时清除后重试一次，瞬时错误立即重试，之后按指数退避最多READ_MAX_RETRIES次
+static int device_read_sync(usb_device_t *device, unsigned char *data, int length) {
+    const device_config_t *config = &device->config;
+    libusb_device_handle *handle = ATOMIC_LOAD(&device->handle);
+    int cleared = 0;
+    for (int attempt = 0; ; attempt++) {
+        int actual_length = 0;
+        int result = config->type == LIBUSB_TRANSFER_TYPE_BULK
+            ? fn_bulk_transfer(handle, config->endpoint, data, length, &actual_length, config->timeout_ms)
+            : fn_interrupt_transfer(handle, config->endpoint, data, length, &actual_length, config->timeout_ms);
+        if (result == LIBUSB_SUCCESS) return actual_length;
+        if (result == LIBUSB_ERROR_TIMEOUT && actual_length > 0) return actual_length;  // 超时前已收到的数据
+
+        if (result == LIBUSB_ERROR_PIPE && !cleared) {
+            cleared = 1;
+            if (fn_clear_halt(handle, config->endpoint) == 0) continue;
+        } else if ((result == LIBUSB_ERROR_IO || result == LIBUSB_ERROR_INTERRUPTED) && attempt < READ_MAX_RETRIES) {
+            if (attempt > 0) Sleep(RETRY_BACKOFF_MS << (attempt - 1));
+            continue;
+        }
+        if (result == LIBUSB_ERROR_NO_DEVICE) device_mark_lost(device, handle);
+        return libusb_error_to_usb(result);
+    }
+}
+
+USB_API int USB_ReadDataEx(int handle, unsigned char* data, int length) {
+    if (!data || length <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    if (device->config.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+        device_release(device);
+        return USB_ERROR_NOT_SUPPORTED;  // 等时端点只能流式读取
+    }
+    if (device->prefetch && device->stream) {
+        int result = prefetch_read(device, data, length);
+        device_release(device);
+        return result;
+    }
+    int result = device_read_sync(device, data, length);
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_ReadData(const char* target_serial, unsigned char* data, int length) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_ReadDataEx(find_device_handle(target_serial), data, length);
+}
+
+USB_API int USB_WriteAsyncEx(int handle, const unsigned char* data, int length) {
+    if (!data || length <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    usb_writer_t *writer = device_get_writer(device);
+    int result = writer ? writer_write(writer, data, length, GetTickCount64() + device->config.timeout_ms, 0) : USB_ERROR_NO_MEM;
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_WriteAsync(const char* target_serial, const unsigned char* data, int length) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_WriteAsyncEx(find_device_handle(target_serial), data, length);
+}
+
+USB_API int USB_FlushWriteEx(int handle, int timeout_ms) {
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    // 没有写入过的设备没有需要等待的数据
+    usb_writer_t *writer = device->writer;
+    int result = writer ? writer_flush(writer, timeout_deadline(timeout_ms)) : USB_SUCCESS;
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_FlushWrite(const char* target_serial, int timeout_ms) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_FlushWriteEx(find_device_handle(target_serial), timeout_ms);
+}
+
+USB_API int USB_WriteDataEx(int handle, const unsigned char* data, int length) {
+    if (!data || length <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    ULONGLONG deadline = GetTickCount64() + device->config.timeout_ms;
+    usb_writer_t *writer = device_get_writer(device);
+    int result = writer ? writer_write(writer, data, length, deadline, 0) : USB_ERROR_NO_MEM;
+    if (result > 0) {
+        int flushed = writer_flush(writer, deadline);
+        if (flushed != USB_SUCCESS) result = flushed;
+    }
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_WriteData(const char* target_serial, const unsigned char* data, int length) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_WriteDataEx(find_device_handle(target_serial), data, length);
+}
+
+USB_API int USB_StartCommandChannelEx(int handle, int tag_offset, int tag_size) {
+    if (tag_offset < 0 || tag_offset >= COMMAND_MAX_LENGTH || (tag_size != 1 && tag_size != 2)) return USB_ERROR_INVALID;
+
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_SUCCESS;
+    if (resolve_device(handle) != device) {
+        result = USB_ERROR_NOT_FOUND;
+    } else if (device->config.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+        result = USB_ERROR_NOT_SUPPORTED;
+    } else if (device->stream && device->stream->commands) {
+        result = USB_ERROR_BUSY;
+    } else {
+        usb_commands_t *commands = commands_create(tag_offset, tag_size);
+        if (!commands) {
+            result = USB_ERROR_NO_MEM;
+        } else if (!device->stream && (result = device_start_stream(device, 0, 0)) != USB_SUCCESS) {
+            commands_destroy(commands);
+        } else {
+            // 流的传输已在途，发布后回调才开始按标签分发
+            ATOMIC_STORE(&device->stream->commands, commands);
+        }
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_StartCommandChannel(const char* target_serial, int tag_offset, int tag_size) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_StartCommandChannelEx(find_device_handle(target_serial), tag_offset, tag_size);
+}
+
+// 内部函数：写入标签后把命令作为一条独立消息发送，失败时放弃该标签
+// 返回USB_SUCCESS表示命令的完成会被报告(包括发送失败前已被通道关闭完成的情况)
+static int command_send(usb_device_t *device, usb_commands_t *commands, int tag,
+                        const unsigned char *command, int length, ULONGLONG deadline) {
+    unsigned char message[COMMAND_MAX_LENGTH];
+    memcpy(message, command, length);
+    command_set_tag(commands, message, tag);
+
+    usb_writer_t *writer = device_get_writer(device);
+    int result = writer ? writer_write(writer, message, length, deadline, 1) : USB_ERROR_NO_MEM;
+    if (result < 0 && commands_abandon(commands, tag)) return result;
+    return USB_SUCCESS;
+}
+
+USB_API int USB_SendCommandEx(int handle, const unsigned char* command, int length,
+                              unsigned char* response, int response_size, int timeout_ms) {
+    if (!command || length <= 0 || length > COMMAND_MAX_LENGTH || !response || response_size <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result;
+    usb_commands_t *commands = device->stream ? ATOMIC_LOAD(&device->stream->commands) : NULL;
+    if (!commands) {
+        result = USB_ERROR_INVALID;
+    } else if (length < commands->tag_offset + commands->tag_size) {
+        result = USB_ERROR_INVALID;
+    } else {
+        ULONGLONG deadline = timeout_deadline(timeout_ms);
+        int tag = commands_begin(commands, response, response_size, NULL, NULL);
+        result = tag;
+        if (tag >= 0) {
+            result = command_send(device, commands, tag, command, length, deadline);
+            if (result == USB_SUCCESS) result = commands_wait(commands, tag, deadline);
+        }
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_SendCommand(const char* target_serial, const unsigned char* command, int length,
+                            unsigned char* response, int response_size, int timeout_ms) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_SendCommandEx(find_device_handle(target_serial), command, length, response, response_size, timeout_ms);
+}
+
+USB_API int USB_SendCommandAsyncEx(int handle, const unsigned char* command, int length,
+                                   usb_command_callback_t callback, void* user_data) {
+    if (!command || length <= 0 || length > COMMAND_MAX_LENGTH || !callback) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result;
+    usb_commands_t *commands = device->stream ? ATOMIC_LOAD(&device->stream->commands) : NULL;
+    if (!commands) {
+        result = USB_ERROR_INVALID;
+    } else if (length < commands->tag_offset + commands->tag_size) {
+        result = USB_ERROR_INVALID;
+    } else {
+        int tag = commands_begin(commands, NULL, 0, callback, user_data);
+        result = tag;
+        if (tag >= 0) {
+            result = command_send(device, commands, tag, command, length, GetTickCount64() + device->config.timeout_ms);
+            if (result == USB_SUCCESS) result = tag;
+        }
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_SendCommandAsync(const char* target_serial, const unsigned char* command, int length,
+                                 usb_command_callback_t callback, void* user_data) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_SendCommandAsyncEx(find_device_handle(target_serial), command, length, callback, user_data);
+}
+
+USB_API int USB_CancelCommandEx(int handle, int tag) {
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result = USB_ERROR_INVALID;
+    usb_commands_t *commands = device->stream ? ATOMIC_LOAD(&device->stream->commands) : NULL;
+    if (commands && tag >= 0 && tag < commands->num_tags) {
+        // 只能取消异步命令，同步命令由等待者自己超时
+        usb_command_callback_t callback = NULL;
+        void *user_data = NULL;
+        EnterCriticalSection(&commands->lock);
+        command_slot_t *slot = &commands->slots[tag];
+        if (slot->state == COMMAND_PENDING && slot->callback) {
+            callback = slot->callback;
+            user_data = slot->user_data;
+            slot->state = COMMAND_FREE;
+        }
+        LeaveCriticalSection(&commands->lock);
+        if (callback) {
+            callback(tag, USB_ERROR_INTERRUPTED, NULL, user_data);
+            result = USB_SUCCESS;
+        } else {
+            result = USB_ERROR_NOT_FOUND;
+        }
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_CancelCommand(const char* target_serial, int tag) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_CancelCommandEx(find_device_handle(target_serial), tag);
+}
+
+USB_API int USB_GetEndpointsEx(int handle, usb_endpoint_info_t* endpoints, int max_endpoints) {
+    if (!endpoints || max_endpoints <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int count = device->num_endpoints < max_endpoints ? device->num_endpoints : max_endpoints;
+    memcpy(endpoints, device->endpoints, count * sizeof(usb_endpoint_info_t));
+    device_release(device);
+    return count;
+}
+
+USB_API int USB_GetEndpoints(const char* target_serial, usb_endpoint_info_t* endpoints, int max_endpoints) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_GetEndpointsEx(find_device_handle(target_serial), endpoints, max_endpoints);
+}
+
+USB_API int USB_ConfigureDeviceEx(int handle, int endpoint, int transfer_type, int buffer_size, int timeout_ms) {
+    if (endpoint < 0 || endpoint > 0xFF || (endpoint && !(endpoint & LIBUSB_ENDPOINT_IN))) return USB_ERROR_INVALID;
+    if (transfer_type < 0 || transfer_type > USB_TRANSFER_INTERRUPT) return USB_ERROR_INVALID;
+    if (buffer_size < 0 || buffer_size > MAX_BUFFER_SIZE || timeout_ms < 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_SUCCESS;
+    device_config_t config;
+    device_default_config(device, &config);
+    if (endpoint) {
+        // 未能发现端点时接受调用者指定的任意IN端点
+        const usb_endpoint_info_t *info = find_endpoint(device, (unsigned char)endpoint);
+        config.endpoint = (unsigned char)endpoint;
+        if (info) {
+            config.type = info->transfer_type;
+            config.alt_setting = info->alt_setting;
+            config.buffer_size = default_buffer_size(info);
+        } else if (device->num_endpoints > 0) {
+            result = USB_ERROR_INVALID;
+        }
+    }
+    if (transfer_type && transfer_type != config.type) {
+        config.type = (unsigned char)transfer_type;
+        if (config.type == LIBUSB_TRANSFER_TYPE_BULK) config.buffer_size = BULK_DEFAULT_BUFFER_SIZE;
+    }
+    if (buffer_size) config.buffer_size = buffer_size;
+    if (timeout_ms) config.timeout_ms = timeout_ms;
+
+    // 批量IN传输长度不是最大包长的整数倍时，设备发送的整包可能溢出缓冲区
+    // 等时传输按最大包长把缓冲区划分为多个包，因此必须知道端点描述符
+    const usb_endpoint_info_t *config_endpoint = find_endpoint(device, config.endpoint);
+    int max_packet_size = config_endpoint ? config_endpoint->max_packet_size : 0;
+    if (config_endpoint && config_endpoint->transfer_type != config.type) {
+        result = USB_ERROR_INVALID;
+    } else if (config.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+        if (!max_packet_size) {
+            if (result == USB_SUCCESS) result = USB_ERROR_NOT_SUPPORTED;
+        } else if (config.buffer_size % max_packet_size != 0) {
+            result = USB_ERROR_INVALID;
+        } else {
+            config.packet_size = max_packet_size;
+        }
+    } else if (config.type == LIBUSB_TRANSFER_TYPE_BULK && max_packet_size && config.buffer_size % max_packet_size != 0) {
+        result = USB_ERROR_INVALID;
+    }
+
+    if (resolve_device(handle) != device) {
+        result = USB_ERROR_NOT_FOUND;
+    } else if (device->stream) {
+        result = USB_ERROR_BUSY;  // 流式传输运行时不能更改
+    } else if (result == USB_SUCCESS) {
+        // 切换备用设置时不能有同步读取正在进行，因此在独占锁内执行
+        // 写入状态绑定了OUT端点，空闲时丢弃，下次写入时按新配置重新创建
+        usb_writer_t *writer = NULL;
+        AcquireSRWLockExclusive(&device->io_lock);
+        if (device->writer) {
+            EnterCriticalSection(&device->writer->lock);
+            if (device->writer->inflight > 0 || device->writer->staged > 0) result = USB_ERROR_BUSY;
+            LeaveCriticalSection(&device->writer->lock);
+            if (result == USB_SUCCESS) {
+                writer = device->writer;
+                device->writer = NULL;
+            }
+        }
+        if (result == USB_SUCCESS && config.alt_setting != device->alt_setting) {
+            if (fn_set_interface_alt_setting(device->handle, 0, config.alt_setting) == 0) {
+                device->alt_setting = config.alt_setting;
+            } else {
+                result = USB_ERROR_IO;
+            }
+        }
+        if (result == USB_SUCCESS) device->config = config;
+        device_close_retired(device);
+        ReleaseSRWLockExclusive(&device->io_lock);
+        if (writer) writer_destroy(writer);
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_ConfigureDevice(const char* target_serial, int endpoint, int transfer_type, int buffer_size, int timeout_ms) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_ConfigureDeviceEx(find_device_handle(target_serial), endpoint, transfer_type, buffer_size, timeout_ms);
+}
+
+USB_API int USB_StartStreamEx(int handle, int num_transfers, int queue_packets) {
+    if (num_transfers > STREAM_MAX_TRANSFERS || queue_packets > STREAM_MAX_QUEUE) return USB_ERROR_INVALID;
+
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    int result = resolve_device(handle) == device ? device_start_stream(device, num_transfers, queue_packets) : USB_ERROR_NOT_FOUND;
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_StartStream(const char* target_serial, int num_transfers, int queue_packets) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_StartStreamEx(find_device_handle(target_serial), num_transfers, queue_packets);
+}
+
+
+USB_API int USB_ReadStreamEx(int handle, unsigned char* data, int length, int timeout_ms) {
+    if (!data || length <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result;
+    usb_stream_t *stream = device->stream;
+    if (!stream) {
+        result = USB_ERROR_INVALID;
+    } else if (!stream_reader_enter(stream)) {
+        result = USB_ERROR_BUSY;
+    } else {
+        result = stream_wait(stream, timeout_deadline(timeout_ms));
+        if (result == USB_SUCCESS) {
+            ring_slot_t *slot = ring_peek(stream->ring);
+            unsigned int offset = stream->ring->read_offset;
+            if (slot->flags & RING_SLOT_GAP) {
+                result = USB_ERROR_DATA_LOST;
+                ring_advance(stream->ring);
+            } else if ((int)(slot->length - offset) > length) {
+                result = USB_ERROR_OVERFLOW;
+            } else {
+                memcpy(data, (unsigned char*)(slot + 1) + offset, slot->length - offset);
+                result = slot->length - offset;
+                ring_advance(stream->ring);
+            }
+        }
+        stream_reader_leave(stream);
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_ReadStream(const char* target_serial, unsigned char* data, int length, int timeout_ms) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_ReadStreamEx(find_device_handle(target_serial), data, length, timeout_ms);
+}
+
+USB_API int USB_ReadStreamBytesEx(int handle, unsigned char* data, int length, int timeout_ms) {
+    if (!data || length <= 0) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result;
+    usb_stream_t *stream = device->stream;
+    if (!stream) {
+        result = USB_ERROR_INVALID;
+    } else if (!stream_reader_enter(stream)) {
+        result = USB_ERROR_BUSY;
+    } else {
+        // 队列中只有零长度包时继续等待，保证成功时至少返回1字节
+        ULONGLONG deadline = timeout_deadline(timeout_ms);
+        do {
+            result = stream_wait(stream, deadline);
+            if (result == USB_SUCCESS) result = ring_read_bytes(stream->ring, data, length);
+        } while (result == 0);
+        stream_reader_leave(stream);
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_ReadStreamBytes(const char* target_serial, unsigned char* data, int length, int timeout_ms) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_ReadStreamBytesEx(find_device_handle(target_serial), data, length, timeout_ms);
+}
+
+USB_API int USB_ReadBatchEx(int handle, unsigned char* buf, int slot_size, int max_packets,
+                            int* lengths_out, unsigned long long* timestamps_out, int timeout_ms) {
+    if (!buf || slot_size <= 0 || max_packets <= 0 || !lengths_out) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result;
+    usb_stream_t *stream = device->stream;
+    if (!stream) {
+        result = USB_ERROR_INVALID;
+    } else if (!stream_reader_enter(stream)) {
+        result = USB_ERROR_BUSY;
+    } else {
+        result = stream_wait(stream, timeout_deadline(timeout_ms));
+        if (result == USB_SUCCESS) {
+            result = ring_read_batch(stream->ring, buf, slot_size, max_packets, lengths_out, timestamps_out);
+            if (result == 0) result = USB_ERROR_OVERFLOW;
+        }
+        stream_reader_leave(stream);
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_ReadBatch(const char* target_serial, unsigned char* buf, int slot_size, int max_packets,
+                          int* lengths_out, unsigned long long* timestamps_out, int timeout_ms) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_ReadBatchEx(find_device_handle(target_serial), buf, slot_size, max_packets,
+                           lengths_out, timestamps_out, timeout_ms);
+}
+
+USB_API int USB_GetStreamStatsEx(int handle, usb_stream_stats_t* stats) {
+    if (!stats) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result = USB_ERROR_INVALID;
+    usb_stream_t *stream = device->stream;
+    if (stream) {
+        usb_ring_t *ring = stream->ring;
+        stats->packets = ATOMIC_LOAD(&ring->packets);
+        stats->overflows = ATOMIC_LOAD(&ring->overflows);
+        stats->queued = ATOMIC_LOAD(&ring->head) - ATOMIC_LOAD(&ring->tail);
+        stats->capacity = ring->mask + 1;
+        stats->recovered = ATOMIC_LOAD(&stream->recovered);
+        result = USB_SUCCESS;
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_GetStreamStats(const char* target_serial, usb_stream_stats_t* stats) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_GetStreamStatsEx(find_device_handle(target_serial), stats);
+}
+
+USB_API int USB_GetPoolStatsEx(int handle, usb_pool_stats_t* stats) {
+    if (!stats) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    usb_pool_t *pool = &device->pool;
+    memset(stats, 0, sizeof(*stats));
+    AcquireSRWLockExclusive(&pool->lock);
+    for (int i = 0; i < pool->num_blocks; i++) {
+        const pool_block_t *block = &pool->blocks[i];
+        stats->reserved_bytes += block->size;
+        if (block->in_use) stats->in_use_bytes += block->size;
+        if (block->device_memory) stats->device_memory_bytes += block->size;
+    }
+    stats->reserved_transfers = pool->num_transfers;
+    for (int i = 0; i < pool->num_transfers; i++) {
+        if (pool->transfers[i].in_use) stats->in_use_transfers++;
+    }
+    stats->heap_allocations = pool->heap_allocations;
+    ReleaseSRWLockExclusive(&pool->lock);
+    if (device->stream) {
+        stats->stream_buffer_mode = pool_is_device_memory(pool, device->stream->buffers) ? USB_BUFFER_DEVICE_MEMORY : USB_BUFFER_HEAP;
+    }
+
+    device_release(device);
+    return USB_SUCCESS;
+}
+
+USB_API int USB_GetPoolStats(const char* target_serial, usb_pool_stats_t* stats) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_GetPoolStatsEx(find_device_handle(target_serial), stats);
+}
+
+USB_API int USB_SetDeviceFilter(const usb_device_filter_t* filters, int count) {
+    if (count < 0 || count > MAX_DEVICE_FILTERS || (count > 0 && !filters)) return USB_ERROR_INVALID;
+
+    device_filter_t *filter = NULL;
+    if (count > 0) {
+        int result = filter_compile(filters, count, &filter);
+        if (result != USB_SUCCESS) return result;
+    }
+
+    AcquireSRWLockExclusive(&g_registry_lock);
+    retire_memory(InterlockedExchangePointer((void* volatile*)&g_device_filter, filter));
+    ReleaseSRWLockExclusive(&g_registry_lock);
+
+    // 匹配的设备集合改变，下次扫描时重新比较设备列表
+    InterlockedExchange(&g_cache_dirty, 1);
+    return USB_SUCCESS;
+}
+
+USB_API int USB_RegisterChangeCallback(usb_device_change_callback_t callback, void* user_data) {
+    AcquireSRWLockExclusive(&g_notify_lock);
+    g_change_callback = callback;
+    g_change_user_data = user_data;
+    ReleaseSRWLockExclusive(&g_notify_lock);
+
+    // 立即初始化，使事件线程开始跟踪设备变化
+    return callback ? initialize_usb() : USB_SUCCESS;
+}
+
+USB_API int USB_SetEventPollInterval(int interval_ms) {
+    if (interval_ms <= 0 || interval_ms > EVENT_POLL_MAX_MS) return USB_ERROR_INVALID;
+    InterlockedExchange(&g_event_poll_ms, interval_ms);
+    return USB_SUCCESS;
+}
+
+USB_API int USB_StopStreamEx(int handle) {
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_ERROR_NOT_FOUND;
+    if (resolve_device(handle) == device) {
+        result = device_stop_stream(device) ? USB_SUCCESS : USB_ERROR_INVALID;
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_StopStream(const char* target_serial) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_StopStreamEx(find_device_handle(target_serial));
+}
+
+USB_API int USB_SetPrefetchEx(int handle, int enable) {
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_SUCCESS;
+    if (resolve_device(handle) != device) {
+        result = USB_ERROR_NOT_FOUND;
+    } else if (!enable) {
+        if (device->prefetch == PREFETCH_OWNED) {
+            device_stop_stream(device);
+        } else {
+            InterlockedExchange(&device->prefetch, PREFETCH_OFF);
+        }
+    } else if (device->prefetch == PREFETCH_OFF) {
+        if (device->config.type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS || device->data_callback) {
+            result = USB_ERROR_NOT_SUPPORTED;  // 数据不进入接收队列
+        } else if (device->stream) {
+            InterlockedExchange(&device->prefetch, PREFETCH_SHARED);
+        } else if ((result = device_start_stream(device, 0, 0)) == USB_SUCCESS) {
+            InterlockedExchange(&device->prefetch, PREFETCH_OWNED);
+        }
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_SetPrefetch(const char* target_serial, int enable) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_SetPrefetchEx(find_device_handle(target_serial), enable);
+}
+
+USB_API int USB_RegisterDataCallbackEx(int handle, usb_data_callback_t callback, void* user_data) {
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_SUCCESS;
+    if (resolve_device(handle) != device) {
+        result = USB_ERROR_NOT_FOUND;
+    } else if (device->stream) {
+        result = USB_ERROR_BUSY;  // 运行中的流的传输回调不加锁读取回调指针
+    } else {
+        device->data_callback = callback;
+        device->data_user_data = user_data;
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_RegisterDataCallback(const char* target_serial, usb_data_callback_t callback, void* user_data) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_RegisterDataCallbackEx(find_device_handle(target_serial), callback, user_data);
+}
+
+// 内部函数：查找数据回调指针所属的流，包括正在销毁的流(调用者持有io_lock共享锁)
+static usb_stream_t* device_buffer_stream(usb_device_t *device, const unsigned char *data, int *index) {
+    *index = stream_buffer_index(device->stream, data);
+    if (*index >= 0) return device->stream;
+    *index = stream_buffer_index(device->draining, data);
+    return *index >= 0 ? device->draining : NULL;
+}
+
+USB_API int USB_HoldBufferEx(int handle, const unsigned char* data) {
+    if (!data) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result = USB_ERROR_INVALID;
+    int index;
+    usb_stream_t *stream = device_buffer_stream(device, data, &index);
+    if (stream && !stream->stopping) {
+        // 只有回调中或已被保持的缓冲区可以保持，引用数为0说明传输已重新提交
+        LONG pending = stream->pending[index];
+        while (pending > 0) {
+            LONG seen = InterlockedCompareExchange(&stream->pending[index], pending + 1, pending);
+            if (seen == pending) {
+                InterlockedIncrement(&stream->holds[index]);
+                result = USB_SUCCESS;
+                break;
+            }
+            pending = seen;
+        }
+    }
+
+    device_release(device);
+    return result;
+}
+
+USB_API int USB_HoldBuffer(const char* target_serial, const unsigned char* data) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_HoldBufferEx(find_device_handle(target_serial), data);
+}
+
+USB_API int USB_ReleaseBufferEx(int handle, const unsigned char* data) {
+    if (!data) return USB_ERROR_INVALID;
+
+    usb_device_t *device = device_acquire(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    int result = USB_ERROR_INVALID;
+    int index;
+    usb_stream_t *stream = device_buffer_stream(device, data, &index);
+    if (stream) {
+        LONG holds = stream->holds[index];
+        while (holds > 0) {
+            LONG seen = InterlockedCompareExchange(&stream->holds[index], holds - 1, holds);
+            if (seen == holds) {
+                stream_buffer_unref(stream, index);
+                result = USB_SUCCESS;
+                break;
+            }
+            holds = seen;
+        }
+    }
+
+    device_release(device);
+    return result;
+}
+
+// 内部函数：按序列号查找正在关闭的设备的句柄，关闭时设备已从序列号索引中移除，未找到返回0
+static int find_closing_device_handle(const char* serial) {
+    int handle = 0;
+    AcquireSRWLockShared(&g_registry_lock);
+    for (int i = 0; i < g_device_count && !handle; i++) {
+        usb_device_t *device = g_device_map[i];
+        if (device->closing && device->in_use && strcmp(device->serial, serial) == 0) handle = make_device_handle(device);
+    }
+    ReleaseSRWLockShared(&g_registry_lock);
+    return handle;
+}
+
+USB_API int USB_ReleaseBuffer(const char* target_serial, const unsigned char* data) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    // 关闭设备会等待保持的缓冲区释放，此时仍须能按序列号找到设备
+    int handle = find_device_handle(target_serial);
+    if (!handle) handle = find_closing_device_handle(target_serial);
+    return USB_ReleaseBufferEx(handle, data);
+}
+
+USB_API int USB_SetAutoReattachEx(int handle, int enable) {
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+    if (!g_event_thread) return USB_ERROR_NOT_SUPPORTED;  // 由事件线程查找并重连
+
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_SUCCESS;
+    if (resolve_device(handle) != device) {
+        result = USB_ERROR_NOT_FOUND;
+    } else if (enable) {
+        InterlockedExchange(&device->reattach, 1);
+    } else {
+        // 已断开时不再等待，挂起的传输按设备断开结束
+        InterlockedExchange(&device->reattach, 0);
+        if (device->stream) stream_finish_lost(device->stream, USB_ERROR_NOT_FOUND);
+        device_clear_lost(device);
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_SetAutoReattach(const char* target_serial, int enable) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_SetAutoReattachEx(find_device_handle(target_serial), enable);
+}
+
+USB_API int USB_GetReattachStatsEx(int handle, usb_reattach_stats_t* stats) {
+    if (!stats) return USB_ERROR_INVALID;
+
+    usb_device_t *device = resolve_device(handle);
+    if (!device) return USB_ERROR_NOT_FOUND;
+
+    // 停机时间在重连时累加，control_lock保证读到一致的值
+    EnterCriticalSection(&device->control_lock);
+    int result = USB_SUCCESS;
+    if (resolve_device(handle) != device) {
+        result = USB_ERROR_NOT_FOUND;
+    } else {
+        stats->disconnects = (unsigned int)device->disconnects;
+        stats->reattaches = (unsigned int)device->reattaches;
+        stats->downtime_us = device->downtime_us;
+        stats->last_downtime_us = device->last_downtime_us;
+        stats->lost_transfers = ATOMIC_LOAD(&device->lost_transfers);
+        stats->lost_write_bytes = ATOMIC_LOAD(&device->lost_write_bytes);
+        stats->attached = !ATOMIC_LOAD(&device->lost);
+        if (!stats->attached) stats->downtime_us += usb_timestamp_us() - device->lost_at_us;
+    }
+    LeaveCriticalSection(&device->control_lock);
+
+    return result;
+}
+
+USB_API int USB_GetReattachStats(const char* target_serial, usb_reattach_stats_t* stats) {
+    if (!target_serial) return USB_ERROR_INVALID;
+    return USB_GetReattachStatsEx(find_device_handle(target_serial), stats);
 }
 
 // DLL入口点
@@ -303,18 +4400,63 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
     switch (fdwReason) {
         case DLL_PROCESS_ATTACH:
             // 初始化
+            DisableThreadLibraryCalls(hinstDLL);
             break;
         case DLL_PROCESS_DETACH:
             // 清理
+            // 此后事件线程刷新缓存时不再创建工作线程，它们要等本函数返回才能启动
+            InterlockedExchange(&g_unloading, 1);
+            // 进程退出时(lpvReserved非NULL)其他线程已被终止，不能再等待事件线程
+            if (g_initialized && lpvReserved) {
+                stop_event_thread(1);
+            }
             if (g_initialized) {
                 // 关闭所有打开的设备
-                for (int i = 0; i < MAX_DEVICES; i++) {
-                    if (g_device_map[i].in_use) {
-                        fn_release_interface(g_device_map[i].handle, 0);
-                        fn_close(g_device_map[i].handle);
-                        g_device_map[i].in_use = 0;
+                for (int i = 0; i < g_device_count; i++) {
+                    usb_device_t *device = g_device_map[i];
+                    if (device->in_use) {
+                        // 等待事件线程中进行的重连完成，之后不再替换句柄
+                        if (!lpvReserved) EnterCriticalSection(&device->control_lock);
+                        device->reattach = 0;
+                        if (!lpvReserved) LeaveCriticalSection(&device->control_lock);
+                        if (device->stream) {
+                            stream_destroy(device->stream);
+                            device->stream = NULL;
+                        }
+                        if (device->writer) {
+                            writer_destroy(device->writer);
+                            device->writer = NULL;
+                        }
+                        pool_release(&device->pool);
+                        device_close_retired(device);
+                        free(device->retired);
+                        device->retired = NULL;
+                        device_clear_lost(device);
+                        fn_release_interface(device->handle, 0);
+                        fn_close(device->handle);
+                        device->in_use = 0;
                     }
                 }
+                // 事件线程会刷新设备缓存，必须在释放下面的表之前停止
+                stop_event_thread(0);
+                if (g_hotplug_registered) {
+                    fn_hotplug_deregister_callback(g_ctx, g_hotplug_handle);
+                    g_hotplug_registered = 0;
+                }
+                device_table_free();
+                free(g_device_filter);
+                g_device_filter = NULL;
+                free(g_locations);
+                g_locations = NULL;
+                g_location_count = g_location_capacity = 0;
+                disk_cache_close();
+                free(g_cache);
+                g_cache = NULL;
+                g_cache_count = g_cache_capacity = 0;
+                g_cache_valid = 0;
+                g_cache_enumeration = 0;
+                g_cache_tracking = 0;
+                g_topology_version = g_change_log_count = g_change_log_floor = 0;
                 fn_exit(g_ctx);
                 g_ctx = NULL;
                 g_initialized = 0;
@@ -323,6 +4465,7 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
                 FreeLibrary(g_hLib);
                 g_hLib = NULL;
             }
+            InterlockedExchange(&g_unloading, 0);
             break;
     }
     return TRUE;
@@ -15,10 +15,18 @@ extern "C" {
     #define USB_API
 #endif
 
-// 目标设备的 VID 和 PID
+// 目标设备的 VID 和 PID，未调用USB_SetDeviceFilter时的默认匹配条件
 #define VENDOR_ID   0x1733
 #define PRODUCT_ID  0xAABB
 
+// 设备匹配条件，字段为USB_MATCH_ANY时匹配任意值
+#define USB_MATCH_ANY  -1
+typedef struct {
+    int vid;                     // 厂商ID
+    int pid;                     // 产品ID
+    int device_class;            // 设备描述符中的bDeviceClass
+} usb_device_filter_t;
+
 // 设备信息结构体
 typedef struct {
     unsigned short vid;          // 厂商ID
@@ -28,6 +36,114 @@ typedef struct {
     unsigned char device_address;// 设备地址
 } device_info_t;
 
+// 设备协商速度
+#define USB_SPEED_UNKNOWN     0
+#define USB_SPEED_LOW         1    // 1.5 Mbit/s
+#define USB_SPEED_FULL        2    // 12 Mbit/s
+#define USB_SPEED_HIGH        3    // 480 Mbit/s
+#define USB_SPEED_SUPER       4    // 5 Gbit/s
+#define USB_SPEED_SUPER_PLUS  5    // 10 Gbit/s
+
+#define USB_MAX_PORT_DEPTH    7
+
+// 扩展设备信息，除序列号外都来自libusb已缓存的描述符，获取时不打开设备
+typedef struct {
+    device_info_t info;                              // 基本信息，与USB_ScanDevice相同
+    unsigned char port_depth;                        // 端口路径长度，0表示libusb不支持端口路径
+    unsigned char port_numbers[USB_MAX_PORT_DEPTH];  // 从根集线器开始的端口号，重新插拔后保持不变
+    unsigned char speed;                             // 协商速度，USB_SPEED_*
+    unsigned char device_class;                      // bDeviceClass
+    unsigned short bcd_usb;                          // USB规范版本
+    unsigned short bcd_device;                       // 设备版本
+    unsigned char in_endpoint;                       // 接口0的第一个IN端点地址，0表示没有
+    unsigned char out_endpoint;                      // 接口0的第一个OUT端点地址，0表示没有
+    unsigned short in_max_packet_size;               // IN端点每个服务周期的最大字节数
+    unsigned short out_max_packet_size;              // OUT端点每个服务周期的最大字节数
+} device_info_ex_t;
+
+// USB_ScanDeviceEx标志
+#define USB_SCAN_NO_OPEN      0x01 // 不打开任何设备，序列号只取自已有缓存，未知时为空
+
+// 端点传输类型，与USB描述符bmAttributes的低两位一致
+#define USB_TRANSFER_DEFAULT      0    // 使用端点自身的类型
+#define USB_TRANSFER_ISOCHRONOUS  1
+#define USB_TRANSFER_BULK         2
+#define USB_TRANSFER_INTERRUPT    3
+
+#define USB_MAX_ENDPOINTS     32
+
+// 打开设备时从活动配置接口0各备用设置发现的端点
+typedef struct {
+    unsigned char address;           // 端点地址，bit7为1表示IN
+    unsigned char transfer_type;     // USB_TRANSFER_*
+    unsigned short max_packet_size;  // 每个服务周期的最大字节数
+    unsigned char interval;          // bInterval
+    unsigned char alt_setting;       // 端点所在的备用设置，等时端点通常不在设置0中
+} usb_endpoint_info_t;
+
+/**
+ * @brief 设备变化回调函数类型
+ * @param device 到达或离开的设备信息，仅在回调期间有效
+ * @param arrived 1表示设备到达，0表示设备离开
+ * @param user_data 注册时传入的用户数据
+ */
+typedef void (*usb_device_change_callback_t)(const device_info_t* device, int arrived, void* user_data);
+
+/**
+ * @brief 异步命令完成回调函数类型，在后台事件线程中执行，不能阻塞
+ * @param tag 命令的标签，即USB_SendCommandAsync的返回值
+ * @param result 成功为响应长度，失败为错误码(取消或通道关闭时为USB_ERROR_INTERRUPTED)
+ * @param response 响应数据，仅在回调期间有效，失败时为NULL
+ * @param user_data 发送时传入的用户数据
+ */
+typedef void (*usb_command_callback_t)(int tag, int result, const unsigned char* response, void* user_data);
+
+/**
+ * @brief 流数据回调函数类型，在后台事件线程中执行，不能停止流或关闭设备
+ * @param data 指向传输缓冲区中的数据包，回调返回后失效，除非调用了USB_HoldBuffer；
+ *             间隙标记和流终止时为NULL
+ * @param length 成功为数据包长度，data为NULL时为USB_ERROR_DATA_LOST(等时流间隙)或流终止的原因
+ *               (USB_StopStream或关闭设备时为USB_ERROR_INTERRUPTED)
+ * @param user_data 注册时传入的用户数据
+ */
+typedef void (*usb_data_callback_t)(const unsigned char* data, int length, void* user_data);
+
+// 流式读取统计信息
+typedef struct {
+    unsigned long long packets;  // 已接收的数据包数
+    unsigned long long overflows;// 接收队列满而丢弃的数据包数
+    unsigned int queued;         // 当前队列中待读取的数据包数
+    unsigned int capacity;       // 队列容量(数据包数)
+    unsigned long long recovered;// 端点停止或瞬时错误后自动恢复的传输数，其数据已丢失
+} usb_stream_stats_t;
+
+// 传输缓冲区所在的内存类型
+#define USB_BUFFER_NONE           0    // 没有运行中的流
+#define USB_BUFFER_HEAP           1    // 普通内存，内核在传输时经中转缓冲区复制
+#define USB_BUFFER_DEVICE_MEMORY  2    // libusb_dev_mem_alloc分配的usbfs映射内存，设备直接DMA，省去复制(仅Linux)
+
+// 设备传输和缓冲区池的内存使用，池在打开设备时按默认配置预分配，关闭设备时释放
+typedef struct {
+    unsigned long long reserved_bytes;   // 池持有的缓冲区内存(含接收队列)
+    unsigned long long in_use_bytes;     // 其中流和写入当前占用的部分
+    unsigned int reserved_transfers;     // 池持有的传输对象数
+    unsigned int in_use_transfers;       // 其中当前占用的传输对象数
+    unsigned long long heap_allocations; // 打开设备以来池申请缓冲区(含设备内存)和传输对象的累计次数
+    unsigned long long device_memory_bytes; // reserved_bytes中位于设备内存的部分
+    int stream_buffer_mode;              // 当前流传输缓冲区的类型，USB_BUFFER_*
+} usb_pool_stats_t;
+
+// 自动重连统计信息，自打开设备起累计
+typedef struct {
+    unsigned int disconnects;            // 检测到设备断开的次数
+    unsigned int reattaches;             // 自动重连成功的次数
+    unsigned long long downtime_us;      // 断开到重连的累计时间(微秒)，含当前仍在断开中的时间
+    unsigned long long last_downtime_us; // 最近一次重连前的断开时间(微秒)
+    unsigned long long lost_transfers;   // 因断开丢失的流传输数，每个传输的数据(等时为一批数据包)已丢失
+    unsigned long long lost_write_bytes; // 因断开未能发送的写入字节数
+    int attached;                        // 1表示设备当前可用，0表示已断开等待重连
+} usb_reattach_stats_t;
+
 // 函数返回值定义
 #define USB_SUCCESS             0    // 成功
 #define USB_ERROR_NOT_FOUND    -1    // 设备未找到
@@ -41,19 +157,51 @@ typedef struct {
 #define USB_ERROR_INTERRUPTED -9    // 被中断
 #define USB_ERROR_NO_MEM      -10   // 内存不足
 #define USB_ERROR_NOT_SUPPORTED -11 // 不支持的操作
+#define USB_ERROR_DATA_LOST   -12   // 等时流此处有数据包丢失(间隙标记)
 
 /**
  * @brief 扫描USB设备
+ * 结果来自库内设备缓存：首次调用时枚举总线，之后只打开新出现的设备读取序列号；
+ * libusb支持热插拔时缓存由热插拔事件更新，扫描不访问总线
+ * 序列号同时保存在临时目录的usb_api_serials.bin中(环境变量USB_API_SERIAL_CACHE可指定路径，设为空则禁用)，
+ * 进程启动时若设备拓扑未变，首次扫描无需打开设备
  * @param devices 设备信息数组，用于存储扫描到的设备信息
  * @param max_devices 最大设备数量
  * @return 成功返回扫描到的设备数量，失败返回错误码
  */
 USB_API int USB_ScanDevice(device_info_t* devices, int max_devices);
 
+/**
+ * @brief 扫描USB设备并返回扩展信息
+ * @param devices 扩展设备信息数组
+ * @param max_devices 最大设备数量
+ * @param flags 0与USB_ScanDevice相同；USB_SCAN_NO_OPEN时只枚举描述符，不打开任何设备
+ * @return 成功返回扫描到的设备数量，失败返回错误码
+ */
+USB_API int USB_ScanDeviceEx(device_info_ex_t* devices, int max_devices, int flags);
+
+/**
+ * @brief 增量扫描：只返回游标之后到达和离开的设备，不枚举总线
+ * 首次以*cursor为0调用返回当前全部设备(都在added中)，之后传回上次得到的游标；
+ * libusb不支持热插拔时，首次调用后由后台每秒比较一次设备列表
+ * @param cursor 输入上次返回的拓扑版本，成功时输出当前版本
+ * @param added 到达的设备数组
+ * @param max_added added数组大小
+ * @param num_added 输出到达的设备数
+ * @param removed 离开的设备数组
+ * @param max_removed removed数组大小
+ * @param num_removed 输出离开的设备数
+ * @return 成功返回USB_SUCCESS；数组不足时返回USB_ERROR_OVERFLOW，num_added/num_removed为所需大小，
+ *         游标不变；游标过旧(变化记录已被覆盖)时返回USB_ERROR_INTERRUPTED，需以0重新开始
+ */
+USB_API int USB_ScanChanges(unsigned long long* cursor, device_info_t* added, int max_added, int* num_added,
+                            device_info_t* removed, int max_removed, int* num_removed);
+
 /**
  * @brief 打开USB设备
+ * 只打开VID/PID匹配的设备；USB_ScanDevice扫描到过的设备按其位置直接打开
  * @param target_serial 目标设备序列号
- * @return 成功返回USB_SUCCESS，失败返回错误码
+ * @return 成功返回USB_SUCCESS，失败返回错误码，接口0被其他程序占用时返回USB_ERROR_BUSY
  */
 USB_API int USB_OpenDevice(const char* target_serial);
 
@@ -69,10 +217,454 @@ USB_API int USB_CloseDevice(const char* target_serial);
  * @param target_serial 目标设备序列号
  * @param data 数据缓冲区
  * @param length 要读取的数据长度
- * @return 成功返回实际读取的数据长度，失败返回错误码
+ * @return 成功返回实际读取的数据长度，失败返回错误码，配置为等时端点时返回USB_ERROR_NOT_SUPPORTED
+ * @note 开启预读(USB_SetPrefetch)后从后台接收队列读取，不再每次发起传输
+ * @note 错误码与libusb错误一一对应：超时为USB_ERROR_TIMEOUT(超时前已收到数据时返回该数据)，
+ *       端点停止为USB_ERROR_PIPE，设备已断开为USB_ERROR_NOT_FOUND。端点停止时自动清除并重试一次，
+ *       瞬时IO错误自动重试(间隔0、1、2毫秒)，仍然失败才返回错误，通常无需重新打开设备
  */
 USB_API int USB_ReadData(const char* target_serial, unsigned char* data, int length);
 
+/**
+ * @brief 写入数据并等待此前排队的所有数据发送完成
+ * @param target_serial 目标设备序列号
+ * @param data 数据缓冲区
+ * @param length 要写入的数据长度
+ * @return 成功返回写入的数据长度，失败返回错误码，超过USB_ConfigureDevice设置的超时返回USB_ERROR_TIMEOUT
+ * @note 使用与读取端点编号相同的OUT端点，没有时使用当前备用设置中第一个中断或批量OUT端点
+ * @note 返回USB_ERROR_PIPE时端点停止状态已被清除，可以直接重新写入，出错的数据不会自动重发
+ */
+USB_API int USB_WriteData(const char* target_serial, const unsigned char* data, int length);
+
+/**
+ * @brief 把数据放入写入队列后立即返回，多个OUT传输同时在途
+ * @param target_serial 目标设备序列号
+ * @param data 数据缓冲区，返回后即可重用
+ * @param length 要写入的数据长度
+ * @return 成功返回排队的数据长度，失败返回错误码，之前的异步写入失败时返回该错误
+ * @note 小块写入会合并到同一个传输中(中断端点合并到一个包，批量端点最多16KB)，
+ *       写满一个传输或没有传输在途时立即提交，否则在下一个传输完成时提交；
+ *       所有传输都在途时最多等待USB_ConfigureDevice设置的超时
+ */
+USB_API int USB_WriteAsync(const char* target_serial, const unsigned char* data, int length);
+
+/**
+ * @brief 提交合并中的数据并等待已排队的写入全部完成
+ * @param target_serial 目标设备序列号
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待：提交合并中的数据后只检查一次是否已全部完成
+ * @return 全部成功返回USB_SUCCESS，否则返回第一个尚未报告的写入错误或USB_ERROR_TIMEOUT
+ * @note 关闭设备会取消尚未完成的写入
+ */
+USB_API int USB_FlushWrite(const char* target_serial, int timeout_ms);
+
+/**
+ * @brief 启动命令通道，命令和响应在同一位置携带标签，多个命令可以同时等待响应
+ * @param target_serial 目标设备序列号
+ * @param tag_offset 标签在命令和响应中的字节偏移
+ * @param tag_size 标签字节数，1(最多256个命令同时等待)或2(小端，最多1024个)
+ * @return 成功返回USB_SUCCESS，通道已启动返回USB_ERROR_BUSY，等时端点返回USB_ERROR_NOT_SUPPORTED
+ * @note 流式读取未启动时以默认参数启动；每个IN传输作为一个响应按标签匹配，
+ *       不匹配任何等待中命令的数据照常进入流接收队列；USB_StopStream或关闭设备时通道随之关闭
+ */
+USB_API int USB_StartCommandChannel(const char* target_serial, int tag_offset, int tag_size);
+
+/**
+ * @brief 发送命令并等待对应标签的响应
+ * @param target_serial 目标设备序列号
+ * @param command 命令数据，标签位置的内容会被替换为分配的标签
+ * @param length 命令长度，最大4096字节且不超过一个OUT传输(中断端点为最大包长，批量端点16KB)，否则返回USB_ERROR_INVALID
+ * @param response 响应缓冲区
+ * @param response_size 响应缓冲区大小，小于响应长度时返回USB_ERROR_OVERFLOW
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待：命令照常发送，响应尚未到达时返回USB_ERROR_TIMEOUT
+ * @return 成功返回响应长度，失败返回错误码，没有空闲标签时返回USB_ERROR_BUSY
+ * @note 每个命令作为独立的OUT传输发送，不与其他写入合并
+ */
+USB_API int USB_SendCommand(const char* target_serial, const unsigned char* command, int length,
+                            unsigned char* response, int response_size, int timeout_ms);
+
+/**
+ * @brief 发送命令后立即返回，收到响应时调用回调
+ * @param target_serial 目标设备序列号
+ * @param command 命令数据，返回后即可重用
+ * @param length 命令长度，限制与USB_SendCommand相同
+ * @param callback 完成回调，返回成功时保证恰好调用一次，返回失败时不会调用
+ * @param user_data 传给回调函数的用户数据
+ * @return 成功返回命令的标签，失败返回错误码
+ */
+USB_API int USB_SendCommandAsync(const char* target_serial, const unsigned char* command, int length,
+                                 usb_command_callback_t callback, void* user_data);
+
+/**
+ * @brief 取消等待响应的异步命令，回调以USB_ERROR_INTERRUPTED立即调用
+ * @param target_serial 目标设备序列号
+ * @param tag USB_SendCommandAsync返回的标签
+ * @return 成功返回USB_SUCCESS，命令已完成返回USB_ERROR_NOT_FOUND
+ */
+USB_API int USB_CancelCommand(const char* target_serial, int tag);
+
+/**
+ * @brief 获取打开设备时发现的端点
+ * @param target_serial 目标设备序列号
+ * @param endpoints 端点信息数组
+ * @param max_endpoints 数组最大容量
+ * @return 成功返回写入的端点数量，失败返回错误码
+ */
+USB_API int USB_GetEndpoints(const char* target_serial, usb_endpoint_info_t* endpoints, int max_endpoints);
+
+/**
+ * @brief 配置USB_ReadData和流式读取使用的端点、传输类型、缓冲区大小和超时
+ * @param target_serial 目标设备序列号
+ * @param endpoint IN端点地址，0表示默认端点(备用设置0中第一个中断或批量IN端点，没有时为0x81)，
+ *                 端点不在当前备用设置中时自动切换接口0的备用设置
+ * @param transfer_type USB_TRANSFER_*，0表示使用端点自身的类型，指定时必须与端点类型一致
+ * @param buffer_size 每个传输的缓冲区大小，0表示默认值(中断端点为最大包长，批量端点为65536，等时端点为32个包)，
+ *                    最大1048576，批量和等时端点必须是最大包长的整数倍，等时传输每个包占一个最大包长
+ * @param timeout_ms USB_ReadData超时时间，0表示默认值1000
+ * @return 成功返回USB_SUCCESS，流式读取运行中或有写入未完成时返回USB_ERROR_BUSY，切换备用设置失败返回USB_ERROR_IO，
+ *         未能发现描述符的等时端点返回USB_ERROR_NOT_SUPPORTED
+ * @note 等时端点只能流式读取，每个包作为一个数据包入队，出错或因队列满丢失的包以USB_ERROR_DATA_LOST间隙标记表示
+ */
+USB_API int USB_ConfigureDevice(const char* target_serial, int endpoint, int transfer_type, int buffer_size, int timeout_ms);
+
+/**
+ * @brief 启动流式读取，在USB_ConfigureDevice配置的端点上保持多个传输同时提交
+ * @param target_serial 目标设备序列号
+ * @param num_transfers 同时提交的传输数量，<=0 使用默认值(中断端点4，批量端点8)，最大32
+ * @param queue_packets 接收队列可缓存的传输数量，向上取整为2的幂，<=0 使用默认值(最多1024个且不超过16MB)，
+ *                      最大1048576，且队列总大小不超过256MB
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ * @note 传输遇到端点停止或瞬时错误时流不终止：后台清除停止状态后重新提交，连续出错时按1、2、4...毫秒退避，
+ *       中间没有成功的传输、连续出错超过5次才终止，读取返回对应的错误码；恢复次数见usb_stream_stats_t.recovered
+ */
+USB_API int USB_StartStream(const char* target_serial, int num_transfers, int queue_packets);
+
+/**
+ * @brief 从流接收队列中读取一个数据包，同一设备同一时刻只允许一个线程读取
+ * @param target_serial 目标设备序列号
+ * @param data 数据缓冲区
+ * @param length 缓冲区长度，小于数据包长度时返回USB_ERROR_OVERFLOW，已被USB_ReadStreamBytes部分读取的数据包只返回剩余部分
+ * @param timeout_ms 队列为空时的最长等待时间(毫秒)，0 表示不等待
+ * @return 成功返回数据包长度，失败返回错误码，其他线程正在读取时返回USB_ERROR_BUSY，
+ *         读到间隙标记时返回USB_ERROR_DATA_LOST，之后可以继续读取
+ */
+USB_API int USB_ReadStream(const char* target_serial, unsigned char* data, int length, int timeout_ms);
+
+/**
+ * @brief 按连续字节流读取流接收队列，不保留数据包边界，适合批量端点的高速数据流
+ * @param target_serial 目标设备序列号
+ * @param data 数据缓冲区
+ * @param length 缓冲区长度，未读完的数据包剩余部分留给下一次读取
+ * @param timeout_ms 队列为空时的最长等待时间(毫秒)，0 表示不等待
+ * @return 成功返回读取的字节数(至少1字节，不等待填满缓冲区)，失败返回错误码，
+ *         读取在间隙标记处截断，标记本身单独返回一次USB_ERROR_DATA_LOST
+ */
+USB_API int USB_ReadStreamBytes(const char* target_serial, unsigned char* data, int length, int timeout_ms);
+
+/**
+ * @brief 一次读取流接收队列中所有已到达的数据包
+ * @param target_serial 目标设备序列号
+ * @param buf 连续的数据缓冲区，第i个数据包存放在 buf + i * slot_size
+ * @param slot_size 每个数据包占用的缓冲区长度
+ * @param max_packets 最多读取的数据包数量
+ * @param lengths_out 输出每个数据包的实际长度，间隙标记为USB_ERROR_DATA_LOST，至少max_packets个元素
+ * @param timestamps_out 输出每个数据包的到达时间(微秒)，可为NULL
+ * @param timeout_ms 队列为空时等待第一个数据包的最长时间(毫秒)，0 表示不等待
+ * @return 成功返回读取的数据包数量，失败返回错误码，队首数据包超过slot_size时返回USB_ERROR_OVERFLOW
+ */
+USB_API int USB_ReadBatch(const char* target_serial, unsigned char* buf, int slot_size, int max_packets,
+                          int* lengths_out, unsigned long long* timestamps_out, int timeout_ms);
+
+/**
+ * @brief 获取流式读取统计信息
+ * @param target_serial 目标设备序列号
+ * @param stats 统计信息输出
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ */
+USB_API int USB_GetStreamStats(const char* target_serial, usb_stream_stats_t* stats);
+
+/**
+ * @brief 获取设备传输和缓冲区池的内存使用
+ * @param target_serial 目标设备序列号
+ * @param stats 统计信息输出
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ * @note 流式传输的数据路径不分配内存；启动/停止流和重建写入状态在配置不变时复用池中的对象，
+ *       heap_allocations不再增长；传输缓冲区优先使用设备内存，libusb不支持或分配失败时使用普通内存，
+ *       设置环境变量USB_API_DEVICE_MEMORY=0可以禁用设备内存
+ */
+USB_API int USB_GetPoolStats(const char* target_serial, usb_pool_stats_t* stats);
+
+/**
+ * @brief 停止流式读取，取消所有已提交的传输
+ * @param target_serial 目标设备序列号
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ */
+USB_API int USB_StopStream(const char* target_serial);
+
+/**
+ * @brief 开启或关闭预读，开启后后台保持传输提交，USB_ReadData直接从流接收队列取数据
+ * @param target_serial 目标设备序列号
+ * @param enable 非0开启，0关闭
+ * @return 成功返回USB_SUCCESS，等时端点或已注册数据回调时返回USB_ERROR_NOT_SUPPORTED
+ * @note 流式读取未启动时以默认参数启动，关闭预读时停止；已启动的流直接用于预读，关闭预读时保留。
+ *       队列中已有数据时USB_ReadData立即返回，否则按配置的超时等待；批量端点按字节流读取，
+ *       中断端点每次返回一个数据包，缓冲区放不下时丢弃该包并返回USB_ERROR_OVERFLOW。
+ *       预读期间不能更改配置；USB_StopStream同时关闭预读
+ */
+USB_API int USB_SetPrefetch(const char* target_serial, int enable);
+
+/**
+ * @brief 注册流数据回调，之后启动的流把每个数据包直接从传输缓冲区交给回调，不经过接收队列
+ * @param target_serial 目标设备序列号
+ * @param callback 回调函数，NULL 表示取消注册，恢复为接收队列
+ * @param user_data 传给回调函数的用户数据
+ * @return 成功返回USB_SUCCESS，流正在运行时返回USB_ERROR_BUSY
+ * @note 传输在回调返回后才重新提交，回调耗时直接占用传输流水线；
+ *       回调模式下USB_ReadStream等读取函数返回USB_ERROR_NOT_SUPPORTED；
+ *       命令通道的响应仍按标签交给等待中的命令，只有不匹配的数据进入回调
+ */
+USB_API int USB_RegisterDataCallback(const char* target_serial, usb_data_callback_t callback, void* user_data);
+
+/**
+ * @brief 在数据回调中保持当前缓冲区，回调返回后数据仍然有效，直到USB_ReleaseBuffer
+ * @param target_serial 目标设备序列号
+ * @param data 数据回调收到的指针
+ * @return 成功返回USB_SUCCESS，data不是回调中或已被保持的缓冲区时返回USB_ERROR_INVALID
+ * @note 被保持的缓冲区所在的传输暂不重新提交，应尽快释放；等时流一个传输包含多个数据包，
+ *       保持其中任意一个都会保持整个传输；停止流、关闭设备或卸载DLL时所有保持自动失效，
+ *       不等待调用者释放，缓冲区随流一起释放，之后data不能再访问，USB_ReleaseBuffer返回USB_ERROR_INVALID
+ */
+USB_API int USB_HoldBuffer(const char* target_serial, const unsigned char* data);
+
+/**
+ * @brief 释放USB_HoldBuffer保持的缓冲区，每次保持对应一次释放，全部释放后传输重新提交
+ * @param target_serial 目标设备序列号
+ * @param data 保持时传入的指针
+ * @return 成功返回USB_SUCCESS，data未被保持或保持已因流停止失效时返回USB_ERROR_INVALID
+ */
+USB_API int USB_ReleaseBuffer(const char* target_serial, const unsigned char* data);
+
+/**
+ * @brief 开启或关闭自动重连，开启后设备断开不再需要关闭并重新打开
+ * @param target_serial 目标设备序列号
+ * @param enable 非0开启，0关闭
+ * @return 成功返回USB_SUCCESS，后台事件线程未运行时返回USB_ERROR_NOT_SUPPORTED
+ * @note 设备断开后，后台线程每20毫秒(收到热插拔通知时立即)查找同一序列号的设备，找到后重新声明接口0、
+ *       恢复备用设置，原句柄和流保持有效：挂起的流传输以新设备重新提交，接收队列中的数据和数据回调不受影响，
+ *       断开期间的读取等待重连(同步读取返回USB_ERROR_NOT_FOUND)；
+ *       断开期间丢失的数据见usb_reattach_stats_t，等时流在此处产生间隙标记。
+ *       关闭自动重连时若设备已断开，流按设备断开终止
+ */
+USB_API int USB_SetAutoReattach(const char* target_serial, int enable);
+
+/**
+ * @brief 获取自动重连统计信息
+ * @param target_serial 目标设备序列号
+ * @param stats 统计信息输出
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ */
+USB_API int USB_GetReattachStats(const char* target_serial, usb_reattach_stats_t* stats);
+
+/**
+ * @brief 设置后台事件线程处理libusb事件的轮询间隔
+ * @param interval_ms 轮询间隔(毫秒)，范围1~1000，默认100
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ */
+USB_API int USB_SetEventPollInterval(int interval_ms);
+
+/**
+ * @brief 设置扫描和打开时匹配的设备，满足任一条件的设备都会被匹配
+ * 条件在枚举时只比较设备描述符，不匹配的设备不会被打开；设置后下次扫描按新条件更新设备缓存
+ * @param filters 匹配条件数组
+ * @param count 条件数量，最多4096；为0时恢复为只匹配VENDOR_ID/PRODUCT_ID
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ */
+USB_API int USB_SetDeviceFilter(const usb_device_filter_t* filters, int count);
+
+/**
+ * @brief 注册设备到达/离开通知回调，传入NULL取消注册
+ * 回调在后台事件线程或调用USB_ScanDevice的线程中执行，不能在回调中调用本函数；
+ * libusb不支持热插拔时，后台每秒比较一次设备列表
+ * @param callback 回调函数
+ * @param user_data 传给回调函数的用户数据
+ * @return 成功返回USB_SUCCESS，失败返回错误码
+ */
+USB_API int USB_RegisterChangeCallback(usb_device_change_callback_t callback, void* user_data);
+
+/*
+ * 整数句柄接口
+ * 句柄由USB_OpenDeviceEx返回，内部以O(1)直接定位设备，不再按序列号逐个比较。
+ * 设备关闭后旧句柄立即失效(返回USB_ERROR_NOT_FOUND)，即使同一序列号被重新打开。
+ * 上面以序列号为参数的函数都是对这些函数的简单封装。
+ * 所有接口均可在多个线程中并发调用；关闭设备或停止流时，阻塞在该设备上的读取立即返回
+ * USB_ERROR_INTERRUPTED或USB_ERROR_NOT_FOUND。
+ */
+
+/**
+ * @brief 打开USB设备并返回整数句柄
+ * @param target_serial 目标设备序列号
+ * @return 成功返回大于0的设备句柄，失败返回错误码
+ */
+USB_API int USB_OpenDeviceEx(const char* target_serial);
+
+/**
+ * @brief 获取已打开设备的整数句柄
+ * @param target_serial 目标设备序列号
+ * @return 成功返回大于0的设备句柄，设备未打开返回USB_ERROR_NOT_FOUND
+ */
+USB_API int USB_GetDeviceHandle(const char* target_serial);
+
+/**
+ * @brief 关闭USB设备，见USB_CloseDevice
+ * @param handle 设备句柄
+ */
+USB_API int USB_CloseDeviceEx(int handle);
+
+/**
+ * @brief 读取数据，见USB_ReadData
+ * @param handle 设备句柄
+ */
+USB_API int USB_ReadDataEx(int handle, unsigned char* data, int length);
+
+/**
+ * @brief 写入数据，见USB_WriteData
+ * @param handle 设备句柄
+ */
+USB_API int USB_WriteDataEx(int handle, const unsigned char* data, int length);
+
+/**
+ * @brief 异步写入数据，见USB_WriteAsync
+ * @param handle 设备句柄
+ */
+USB_API int USB_WriteAsyncEx(int handle, const unsigned char* data, int length);
+
+/**
+ * @brief 等待写入完成，见USB_FlushWrite
+ * @param handle 设备句柄
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待
+ */
+USB_API int USB_FlushWriteEx(int handle, int timeout_ms);
+
+/**
+ * @brief 启动命令通道，见USB_StartCommandChannel
+ * @param handle 设备句柄
+ */
+USB_API int USB_StartCommandChannelEx(int handle, int tag_offset, int tag_size);
+
+/**
+ * @brief 发送命令并等待响应，见USB_SendCommand
+ * @param handle 设备句柄
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待
+ */
+USB_API int USB_SendCommandEx(int handle, const unsigned char* command, int length,
+                              unsigned char* response, int response_size, int timeout_ms);
+
+/**
+ * @brief 异步发送命令，见USB_SendCommandAsync
+ * @param handle 设备句柄
+ */
+USB_API int USB_SendCommandAsyncEx(int handle, const unsigned char* command, int length,
+                                   usb_command_callback_t callback, void* user_data);
+
+/**
+ * @brief 取消异步命令，见USB_CancelCommand
+ * @param handle 设备句柄
+ */
+USB_API int USB_CancelCommandEx(int handle, int tag);
+
+/**
+ * @brief 获取打开设备时发现的端点，见USB_GetEndpoints
+ * @param handle 设备句柄
+ */
+USB_API int USB_GetEndpointsEx(int handle, usb_endpoint_info_t* endpoints, int max_endpoints);
+
+/**
+ * @brief 配置设备传输参数，见USB_ConfigureDevice
+ * @param handle 设备句柄
+ */
+USB_API int USB_ConfigureDeviceEx(int handle, int endpoint, int transfer_type, int buffer_size, int timeout_ms);
+
+/**
+ * @brief 启动流式读取，见USB_StartStream
+ * @param handle 设备句柄
+ */
+USB_API int USB_StartStreamEx(int handle, int num_transfers, int queue_packets);
+
+/**
+ * @brief 从流接收队列中读取一个数据包，见USB_ReadStream
+ * @param handle 设备句柄
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待
+ */
+USB_API int USB_ReadStreamEx(int handle, unsigned char* data, int length, int timeout_ms);
+
+/**
+ * @brief 按连续字节流读取流接收队列，见USB_ReadStreamBytes
+ * @param handle 设备句柄
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待
+ */
+USB_API int USB_ReadStreamBytesEx(int handle, unsigned char* data, int length, int timeout_ms);
+
+/**
+ * @brief 一次读取流接收队列中所有已到达的数据包，见USB_ReadBatch
+ * @param handle 设备句柄
+ * @param timeout_ms 最长等待时间(毫秒)，0 表示不等待
+ */
+USB_API int USB_ReadBatchEx(int handle, unsigned char* buf, int slot_size, int max_packets,
+                            int* lengths_out, unsigned long long* timestamps_out, int timeout_ms);
+
+/**
+ * @brief 获取流式读取统计信息，见USB_GetStreamStats
+ * @param handle 设备句柄
+ */
+USB_API int USB_GetStreamStatsEx(int handle, usb_stream_stats_t* stats);
+
+/**
+ * @brief 获取设备传输和缓冲区池的内存使用，见USB_GetPoolStats
+ * @param handle 设备句柄
+ */
+USB_API int USB_GetPoolStatsEx(int handle, usb_pool_stats_t* stats);
+
+/**
+ * @brief 停止流式读取，见USB_StopStream
+ * @param handle 设备句柄
+ */
+USB_API int USB_StopStreamEx(int handle);
+
+/**
+ * @brief 开启或关闭预读，见USB_SetPrefetch
+ * @param handle 设备句柄
+ */
+USB_API int USB_SetPrefetchEx(int handle, int enable);
+
+/**
+ * @brief 注册流数据回调，见USB_RegisterDataCallback
+ * @param handle 设备句柄
+ */
+USB_API int USB_RegisterDataCallbackEx(int handle, usb_data_callback_t callback, void* user_data);
+
+/**
+ * @brief 保持数据回调中的缓冲区，见USB_HoldBuffer
+ * @param handle 设备句柄
+ */
+USB_API int USB_HoldBufferEx(int handle, const unsigned char* data);
+
+/**
+ * @brief 释放保持的缓冲区，见USB_ReleaseBuffer
+ * @param handle 设备句柄
+ */
+USB_API int USB_ReleaseBufferEx(int handle, const unsigned char* data);
+
+/**
+ * @brief 开启或关闭自动重连，见USB_SetAutoReattach
+ * @param handle 设备句柄
+ */
+USB_API int USB_SetAutoReattachEx(int handle, int enable);
+
+/**
+ * @brief 获取自动重连统计信息，见USB_GetReattachStats
+ * @param handle 设备句柄
+ */
+USB_API int USB_GetReattachStatsEx(int handle, usb_reattach_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif